@@ -53,7 +53,7 @@
 
 void analyse_one_frame(struct CODEC2 *c2, MODEL *model, short speech[]);
 void synthesise_one_frame(struct CODEC2 *c2, short speech[], MODEL *model,
-			  float ak[]);
+			  COMP Aw[]);
 void codec2_encode_3200(struct CODEC2 *c2, unsigned char * bits, short speech[]);
 void codec2_decode_3200(struct CODEC2 *c2, short speech[], const unsigned char * bits);
 void codec2_encode_2400(struct CODEC2 *c2, unsigned char * bits, short speech[]);
@@ -105,13 +105,18 @@ struct CODEC2 * CODEC2_WIN32SUPPORT codec2_create(int mode)
     c2->hpf_states[0] = c2->hpf_states[1] = 0.0;
     for(i=0; i<2*N; i++)
 	c2->Sn_[i] = 0;
-    c2->fft_fwd_cfg = kiss_fft_alloc(FFT_ENC, 0, NULL, NULL);
+    c2->fft_fwd_cfg = kiss_fftr_alloc(FFT_ENC, 0, NULL, NULL);
     make_analysis_window(c2->fft_fwd_cfg, c2->w,c2->W);
     make_synthesis_window(c2->Pn);
-    c2->fft_inv_cfg = kiss_fft_alloc(FFT_DEC, 1, NULL, NULL);
+    c2->fft_inv_cfg = kiss_fftr_alloc(FFT_DEC, 1, NULL, NULL);
+    lpc_spectrum_init(&c2->lpc_spec);
+    c2->synth = CODEC2_SYNTH_FFT;
+    make_osc_table(c2->osc_cos);
     quantise_init();
+    lsp_vq_init(&c2->lsp_vq);
     c2->prev_Wo_enc = 0.0;
     c2->bg_est = 0.0;
+    c2->rand_seed = 1;
     c2->ex_phase = 0.0;
 
     for(l=1; l<=MAX_AMP; l++)
@@ -125,7 +130,7 @@ struct CODEC2 * CODEC2_WIN32SUPPORT codec2_create(int mode)
     }
     c2->prev_e_dec = 1;
 
-    c2->nlp = nlp_create();
+    c2->nlp = nlp_create(M);
     if (c2->nlp == NULL) {
 	free (c2);
 	return NULL;
@@ -245,6 +250,27 @@ void CODEC2_WIN32SUPPORT codec2_decode(struct CODEC2 *c2, short speech[], const
  	codec2_decode_1200(c2, speech, bits);
 }
 
+/*---------------------------------------------------------------------------*\
+                                                       
+  FUNCTION....: codec2_decode_batch	     
+
+  Decodes nframes frames packed one after the other, each frame taking
+  (codec2_bits_per_frame()+7)/8 bytes, into nframes*
+  codec2_samples_per_frame() speech samples.  Same as calling
+  codec2_decode() for each frame.  Intended for offline transcoding.
+
+\*---------------------------------------------------------------------------*/
+
+void CODEC2_WIN32SUPPORT codec2_decode_batch(struct CODEC2 *c2, short speech[], const unsigned char *bits, int nframes)
+{
+    int nsam, nbytes, f;
+
+    nsam = codec2_samples_per_frame(c2);
+    nbytes = (codec2_bits_per_frame(c2) + 7)/8;
+    for(f=0; f<nframes; f++)
+	codec2_decode(c2, &speech[f*nsam], &bits[f*nbytes]);
+}
+
 
 /*---------------------------------------------------------------------------*\
                                                        
@@ -331,6 +357,7 @@ void codec2_decode_3200(struct CODEC2 *c2, short speech[], const unsigned char *
     float   e[2];
     float   snr;
     float   ak[2][LPC_ORD+1];
+    COMP    Aw[2][FFT_ENC];
     int     i,j;
     unsigned int nbit = 0;
 
@@ -376,15 +403,15 @@ void codec2_decode_3200(struct CODEC2 *c2, short speech[], const unsigned char *
     interpolate_lsp_ver2(&lsps[0][0], c2->prev_lsps_dec, &lsps[1][0], 0.5);
     for(i=0; i<2; i++) {
 	lsp_to_lpc(&lsps[i][0], &ak[i][0], LPC_ORD);
-	aks_to_M2(c2->fft_fwd_cfg, &ak[i][0], LPC_ORD, &model[i], e[i], &snr, 0, 0, 
-                  c2->lpc_pf, c2->bass_boost, c2->beta, c2->gamma); 
+	aks_to_M2(&c2->lpc_spec, &ak[i][0], LPC_ORD, &model[i], e[i], &snr, 0, 0, 
+                  c2->lpc_pf, c2->bass_boost, c2->beta, c2->gamma, &Aw[i][0]);
 	apply_lpc_correction(&model[i]);
     }
 
     /* synthesise ------------------------------------------------*/
 
     for(i=0; i<2; i++)
-	synthesise_one_frame(c2, &speech[N*i], &model[i], &ak[i][0]);
+	synthesise_one_frame(c2, &speech[N*i], &model[i], &Aw[i][0]);
 
     /* update memories for next frame ----------------------------*/
 
@@ -479,6 +506,7 @@ void codec2_decode_2400(struct CODEC2 *c2, short speech[], const unsigned char *
     float   e[2];
     float   snr;
     float   ak[2][LPC_ORD+1];
+    COMP    Aw[2][FFT_ENC];
     int     i,j;
     unsigned int nbit = 0;
 
@@ -522,15 +550,15 @@ void codec2_decode_2400(struct CODEC2 *c2, short speech[], const unsigned char *
     interpolate_lsp_ver2(&lsps[0][0], c2->prev_lsps_dec, &lsps[1][0], 0.5);
     for(i=0; i<2; i++) {
 	lsp_to_lpc(&lsps[i][0], &ak[i][0], LPC_ORD);
-	aks_to_M2(c2->fft_fwd_cfg, &ak[i][0], LPC_ORD, &model[i], e[i], &snr, 0, 0, 
-                  c2->lpc_pf, c2->bass_boost, c2->beta, c2->gamma); 
+	aks_to_M2(&c2->lpc_spec, &ak[i][0], LPC_ORD, &model[i], e[i], &snr, 0, 0, 
+                  c2->lpc_pf, c2->bass_boost, c2->beta, c2->gamma, &Aw[i][0]);
 	apply_lpc_correction(&model[i]);
     }
 
     /* synthesise ------------------------------------------------*/
 
     for(i=0; i<2; i++)
-	synthesise_one_frame(c2, &speech[N*i], &model[i], &ak[i][0]);
+	synthesise_one_frame(c2, &speech[N*i], &model[i], &Aw[i][0]);
 
     /* update memories for next frame ----------------------------*/
 
@@ -641,6 +669,7 @@ void codec2_decode_1400(struct CODEC2 *c2, short speech[], const unsigned char *
     float   e[4];
     float   snr;
     float   ak[4][LPC_ORD+1];
+    COMP    Aw[4][FFT_ENC];
     int     i,j;
     unsigned int nbit = 0;
     float   weight;
@@ -695,15 +724,15 @@ void codec2_decode_1400(struct CODEC2 *c2, short speech[], const unsigned char *
     }
     for(i=0; i<4; i++) {
 	lsp_to_lpc(&lsps[i][0], &ak[i][0], LPC_ORD);
-	aks_to_M2(c2->fft_fwd_cfg, &ak[i][0], LPC_ORD, &model[i], e[i], &snr, 0, 0,
-                  c2->lpc_pf, c2->bass_boost, c2->beta, c2->gamma); 
+	aks_to_M2(&c2->lpc_spec, &ak[i][0], LPC_ORD, &model[i], e[i], &snr, 0, 0,
+                  c2->lpc_pf, c2->bass_boost, c2->beta, c2->gamma, &Aw[i][0]);
 	apply_lpc_correction(&model[i]);
     }
 
     /* synthesise ------------------------------------------------*/
 
     for(i=0; i<4; i++)
-	synthesise_one_frame(c2, &speech[N*i], &model[i], &ak[i][0]);
+	synthesise_one_frame(c2, &speech[N*i], &model[i], &Aw[i][0]);
 
     /* update memories for next frame ----------------------------*/
 
@@ -790,7 +819,7 @@ void codec2_encode_1200(struct CODEC2 *c2, unsigned char * bits, short speech[])
     WoE_index = encode_WoE(&model, e, c2->xq_enc);
     pack(bits, &nbit, WoE_index, WO_E_BITS);
  
-    encode_lsps_vq(lsp_indexes, lsps, lsps_, LPC_ORD);
+    encode_lsps_vq(&c2->lsp_vq, lsp_indexes, lsps, lsps_, LPC_ORD);
     for(i=0; i<LSP_PRED_VQ_INDEXES; i++) {
 	pack(bits, &nbit, lsp_indexes[i], lsp_pred_vq_bits(i));
     }
@@ -819,6 +848,7 @@ void codec2_decode_1200(struct CODEC2 *c2, short speech[], const unsigned char *
     float   e[4];
     float   snr;
     float   ak[4][LPC_ORD+1];
+    COMP    Aw[4][FFT_ENC];
     int     i,j;
     unsigned int nbit = 0;
     float   weight;
@@ -873,15 +903,15 @@ void codec2_decode_1200(struct CODEC2 *c2, short speech[], const unsigned char *
     }
     for(i=0; i<4; i++) {
 	lsp_to_lpc(&lsps[i][0], &ak[i][0], LPC_ORD);
-	aks_to_M2(c2->fft_fwd_cfg, &ak[i][0], LPC_ORD, &model[i], e[i], &snr, 0, 0,
-                  c2->lpc_pf, c2->bass_boost, c2->beta, c2->gamma); 
+	aks_to_M2(&c2->lpc_spec, &ak[i][0], LPC_ORD, &model[i], e[i], &snr, 0, 0,
+                  c2->lpc_pf, c2->bass_boost, c2->beta, c2->gamma, &Aw[i][0]);
 	apply_lpc_correction(&model[i]);
     }
 
     /* synthesise ------------------------------------------------*/
 
     for(i=0; i<4; i++)
-	synthesise_one_frame(c2, &speech[N*i], &model[i], &ak[i][0]);
+	synthesise_one_frame(c2, &speech[N*i], &model[i], &Aw[i][0]);
 
     /* update memories for next frame ----------------------------*/
 
@@ -892,23 +922,42 @@ void codec2_decode_1200(struct CODEC2 *c2, short speech[], const unsigned char *
 }
 
 
+/*---------------------------------------------------------------------------*\
+                                                       
+  FUNCTION....: codec2_rand()	     
+
+  Returns a pseudo random number 0..CODEC2_RAND_MAX, the C standard's
+  example rand() on a caller supplied seed.
+
+\*---------------------------------------------------------------------------*/
+
+int codec2_rand(unsigned long *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return (unsigned)(*seed/65536) % 32768;
+}
+
 /*---------------------------------------------------------------------------*\
                                                        
   FUNCTION....: synthesise_one_frame()	     
   AUTHOR......: David Rowe			      
   DATE CREATED: 23/8/2010 
 
-  Synthesise 80 speech samples (10ms) from model parameters.
+  Synthesise 80 speech samples (10ms) from model parameters.  Aw[] is
+  the LPC spectrum of the frame from aks_to_M2().
 
 \*---------------------------------------------------------------------------*/
 
-void synthesise_one_frame(struct CODEC2 *c2, short speech[], MODEL *model, float ak[])
+void synthesise_one_frame(struct CODEC2 *c2, short speech[], MODEL *model, COMP Aw[])
 {
     int     i;
 
-    phase_synth_zero_order(c2->fft_fwd_cfg, model, ak, &c2->ex_phase, LPC_ORD);
-    postfilter(model, &c2->bg_est);
-    synthesise(c2->fft_inv_cfg, c2->Sn_, model, c2->Pn, 1);
+    phase_synth_zero_order(model, Aw, &c2->ex_phase, &c2->rand_seed);
+    postfilter(model, &c2->bg_est, &c2->rand_seed);
+    if (c2->synth == CODEC2_SYNTH_OSC)
+	synthesise_osc(c2->osc_cos, c2->Sn_, model, c2->Pn, 1);
+    else
+	synthesise(c2->fft_inv_cfg, c2->Sn_, model, c2->Pn, 1);
     ear_protection(c2->Sn_, N);
 
     for(i=0; i<N; i++) {
@@ -938,6 +987,7 @@ void analyse_one_frame(struct CODEC2 *c2, MODEL *model, short speech[])
     COMP    Sw[FFT_ENC];
     COMP    Sw_[FFT_ENC];
     COMP    Ew[FFT_ENC];
+    HARM_MAP hm;
     float   pitch, snr;
     int     i;
 
@@ -949,6 +999,7 @@ void analyse_one_frame(struct CODEC2 *c2, MODEL *model, short speech[])
       c2->Sn[i+M-N] = speech[i];
 
     dft_speech(c2->fft_fwd_cfg, Sw, c2->Sn, c2->w);
+    harm_map_power(&hm, Sw);
 
     /* Estimate pitch */
 
@@ -958,9 +1009,10 @@ void analyse_one_frame(struct CODEC2 *c2, MODEL *model, short speech[])
 
     /* estimate model parameters */
 
-    two_stage_pitch_refinement(model, Sw);
-    estimate_amplitudes(model, Sw, c2->W);
-    snr = est_voicing_mbe(model, Sw, c2->W, Sw_, Ew, c2->prev_Wo_enc);
+    two_stage_pitch_refinement(model, &hm);
+    harm_map_bands(&hm, model);
+    estimate_amplitudes(model, Sw, &hm);
+    snr = est_voicing_mbe(model, Sw, c2->W, &hm, Sw_, Ew, c2->prev_Wo_enc);
     //fprintf(stderr,"snr %3.2f  v: %d  Wo: %f prev_Wo: %f\n", 
     //	   snr, model->voiced, model->Wo, c2->prev_Wo_enc);
     c2->prev_Wo_enc = model->Wo;
@@ -1015,6 +1067,18 @@ void CODEC2_WIN32SUPPORT codec2_set_lpc_post_filter(struct CODEC2 *c2, int enabl
     c2->gamma = gamma;
 }
 
+/*
+   Selects the synthesis engine, CODEC2_SYNTH_FFT (default) or
+   CODEC2_SYNTH_OSC.  Both produce the same speech to within float
+   rounding, OSC uses less CPU for most speakers.
+*/
+
+void CODEC2_WIN32SUPPORT codec2_set_synthesis(struct CODEC2 *c2, int synth)
+{
+    assert((synth == CODEC2_SYNTH_FFT) || (synth == CODEC2_SYNTH_OSC));
+    c2->synth = synth;
+}
+
 /* 
    Allows optional stealing of one of the voicing bits for use as a
    spare bit, only 1400 bit/s supported for now.  Experimental method
@@ -51,16 +51,21 @@
 #define CODEC2_MODE_1400 2
 #define CODEC2_MODE_1200 3
 
+#define CODEC2_SYNTH_FFT 0  /* inverse FFT synthesis (default)  */
+#define CODEC2_SYNTH_OSC 1  /* recursive oscillator synthesis   */
+
 struct CODEC2;
 
 struct CODEC2 * CODEC2_WIN32SUPPORT codec2_create(int mode);
 void CODEC2_WIN32SUPPORT codec2_destroy(struct CODEC2 *codec2_state);
 void CODEC2_WIN32SUPPORT codec2_encode(struct CODEC2 *codec2_state, unsigned char * bits, short speech_in[]);
 void CODEC2_WIN32SUPPORT codec2_decode(struct CODEC2 *codec2_state, short speech_out[], const unsigned char *bits);
+void CODEC2_WIN32SUPPORT codec2_decode_batch(struct CODEC2 *codec2_state, short speech_out[], const unsigned char *bits, int nframes);
 int  CODEC2_WIN32SUPPORT codec2_samples_per_frame(struct CODEC2 *codec2_state);
 int  CODEC2_WIN32SUPPORT codec2_bits_per_frame(struct CODEC2 *codec2_state);
 
 void CODEC2_WIN32SUPPORT codec2_set_lpc_post_filter(struct CODEC2 *codec2_state, int enable, int bass_boost, float beta, float gamma);
+void CODEC2_WIN32SUPPORT codec2_set_synthesis(struct CODEC2 *codec2_state, int synth);
 int  CODEC2_WIN32SUPPORT codec2_get_spare_bit_index(struct CODEC2 *codec2_state);
 int  CODEC2_WIN32SUPPORT codec2_rebuild_spare_bit(struct CODEC2 *codec2_state, int unpacked_bits[]);
 
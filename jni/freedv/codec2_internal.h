@@ -31,7 +31,7 @@
 
 struct CODEC2 {
     int           mode;
-    kiss_fft_cfg  fft_fwd_cfg;             /* forward FFT config                        */
+    kiss_fftr_cfg fft_fwd_cfg;             /* forward real FFT config                   */
     float         w[M];	                   /* time domain hamming window                */
     COMP          W[FFT_ENC];	           /* DFT of w[]                                */
     float         Pn[2*N];	           /* trapezoidal synthesis window              */
@@ -39,10 +39,14 @@ struct CODEC2 {
     float         hpf_states[2];           /* high pass filter states                   */
     void         *nlp;                     /* pitch predictor states                    */
 
-    kiss_fft_cfg  fft_inv_cfg;             /* inverse FFT config                        */
+    kiss_fftr_cfg fft_inv_cfg;             /* inverse real FFT config                   */
+    LPC_SPEC      lpc_spec;                /* LPC spectrum twiddles                     */
     float         Sn_[2*N];	           /* synthesised output speech                 */
+    int           synth;                   /* CODEC2_SYNTH_FFT or CODEC2_SYNTH_OSC      */
+    float         osc_cos[FFT_DEC];        /* cos() table for synthesise_osc()          */
     float         ex_phase;                /* excitation model phase track              */
     float         bg_est;                  /* background noise estimate for post filter */
+    unsigned long rand_seed;               /* codec2_rand() state                       */
     float         prev_Wo_enc;             /* previous frame's pitch estimate           */
     MODEL         prev_model_dec;          /* previous frame's model parameters         */
     float         prev_lsps_dec[LPC_ORD];  /* previous frame's LSPs                     */
@@ -54,6 +58,7 @@ struct CODEC2 {
     float         gamma;
 
     float         xq_enc[2];               /* joint pitch and energy VQ states          */
+    LSP_VQ        lsp_vq;                  /* LSP VQ codebooks for encode_lsps_vq()     */
     float         xq_dec[2];
 };
 
@@ -57,6 +57,14 @@
 #define P_MIN    20		/* minimum pitch                        */
 #define P_MAX    160		/* maximum pitch                        */
 
+/* Random numbers for the decoder.  Each decoder keeps its own seed, so
+   decoders running in parallel don't share (or race on) rand()'s
+   state and each one's output depends only on its own input. */
+
+#define CODEC2_RAND_MAX 32767
+
+int codec2_rand(unsigned long *seed);
+
 /*---------------------------------------------------------------------------*\
                                                                              
 				TYPEDEFS                                      
@@ -67,6 +67,12 @@ extern "C" {
 #define FDMDV_OS                 6         /* oversampling rate           */
 #define FDMDV_OS_TAPS           48         /* number of OS filter taps    */
 
+/* 48 kHz channelizer, FDMDV_NSUB complex 8 kHz sub-bands centred
+   0, FDMDV_SUB_HZ, 2*FDMDV_SUB_HZ ... Hz of a real 48 kHz stream */
+
+#define FDMDV_NSUB               7
+#define FDMDV_SUB_HZ          4000
+
 /* FFT points */
 
 #define FDMDV_NSPEC             512
@@ -75,6 +81,10 @@ extern "C" {
 /* FDMDV states and stats structures */
 
 struct FDMDV;
+struct FDMDV_DOWNMIX;
+struct FDMDV_RESAMPLER;
+struct FDMDV_CHANNELIZER;
+struct FDMDV_CLOCK;
     
 struct FDMDV_STATS {
     float  snr_est;                /* estimated SNR of rx signal in dB (3 kHz noise BW)  */
@@ -82,7 +92,8 @@ struct FDMDV_STATS {
     int    fest_coarse_fine;       /* freq est state, 0-coarse 1-fine                    */ 
     float  foff;                   /* estimated freq offset in Hz                        */       
     float  rx_timing;              /* estimated optimum timing offset in samples         */
-    float  clock_offset;           /* Estimated tx/rx sample clock offset in ppm         */
+    float  clock_offset;           /* Estimated tx/rx sample clock offset in ppm, +ve    */
+                                   /* when the rx clock is fast                          */
 };
 
 struct FDMDV * CODEC2_WIN32SUPPORT fdmdv_create(void);
@@ -90,6 +101,7 @@ void           CODEC2_WIN32SUPPORT fdmdv_destroy(struct FDMDV *fdmdv_state);
     
 void           CODEC2_WIN32SUPPORT fdmdv_mod(struct FDMDV *fdmdv_state, COMP tx_fdm[], int tx_bits[], int *sync_bit);
 void           CODEC2_WIN32SUPPORT fdmdv_demod(struct FDMDV *fdmdv_state, int rx_bits[], int *sync_bit, COMP rx_fdm[], int *nin);
+int            CODEC2_WIN32SUPPORT fdmdv_set_fast_acquisition(struct FDMDV *fdmdv_state, int enable);
     
 void           CODEC2_WIN32SUPPORT fdmdv_get_test_bits(struct FDMDV *fdmdv_state, int tx_bits[]);
 void           CODEC2_WIN32SUPPORT fdmdv_put_test_bits(struct FDMDV *f, int *sync, int *bit_errors, int *ntest_bits, int rx_bits[]);
@@ -100,6 +112,27 @@ void           CODEC2_WIN32SUPPORT fdmdv_get_rx_spectrum(struct FDMDV *fdmdv_sta
 void           CODEC2_WIN32SUPPORT fdmdv_8_to_48(float out48k[], float in8k[], int n);
 void           CODEC2_WIN32SUPPORT fdmdv_48_to_8(float out8k[], float in48k[], int n);
 
+struct FDMDV_RESAMPLER * CODEC2_WIN32SUPPORT fdmdv_resampler_create(void);
+void           CODEC2_WIN32SUPPORT fdmdv_resampler_destroy(struct FDMDV_RESAMPLER *r);
+void           CODEC2_WIN32SUPPORT fdmdv_resample_8_to_48(struct FDMDV_RESAMPLER *r, float out48k[], const float in8k[], int n);
+void           CODEC2_WIN32SUPPORT fdmdv_resample_48_to_8(struct FDMDV_RESAMPLER *r, float out8k[], const float in48k[], int n);
+
+struct FDMDV_DOWNMIX * CODEC2_WIN32SUPPORT fdmdv_downmix_create(void);
+void           CODEC2_WIN32SUPPORT fdmdv_downmix_destroy(struct FDMDV_DOWNMIX *d);
+int            CODEC2_WIN32SUPPORT fdmdv_downmix_48_to_8(struct FDMDV_DOWNMIX *d, short out8k[], int max_out,
+                                                         const unsigned char in48k[], int *nbytes);
+
+struct FDMDV_CLOCK * CODEC2_WIN32SUPPORT fdmdv_clock_create(void);
+void           CODEC2_WIN32SUPPORT fdmdv_clock_destroy(struct FDMDV_CLOCK *c);
+int            CODEC2_WIN32SUPPORT fdmdv_clock_resample(struct FDMDV_CLOCK *c, COMP out[], int max_out,
+                                                        const short in[], int *nin);
+void           CODEC2_WIN32SUPPORT fdmdv_clock_track(struct FDMDV_CLOCK *c, struct FDMDV *fdmdv, struct FDMDV_STATS *stats);
+
+struct FDMDV_CHANNELIZER * CODEC2_WIN32SUPPORT fdmdv_channelizer_create(void);
+void           CODEC2_WIN32SUPPORT fdmdv_channelizer_destroy(struct FDMDV_CHANNELIZER *c);
+int            CODEC2_WIN32SUPPORT fdmdv_channelize(struct FDMDV_CHANNELIZER *c, COMP *out8k[], const float in48k[], int n);
+int            CODEC2_WIN32SUPPORT fdmdv_channelizer_pilot(struct FDMDV_CHANNELIZER *c, int sub, float *foff);
+
 void           CODEC2_WIN32SUPPORT fdmdv_freq_shift(COMP rx_fdm_fcorr[], COMP rx_fdm[], float foff, COMP *foff_rect, COMP *foff_phase_rect, int nin);
 
 /* debug/development function(s) */
@@ -32,6 +32,7 @@
 #include "comp.h"
 #include "fdmdv.h"
 #include "kiss_fft.h"
+#include "kiss_fftr.h"
 
 /*---------------------------------------------------------------------------*\
                                                                              
@@ -63,16 +64,30 @@
 #define NPILOTBASEBAND (NPILOTCOEFF+M+M/P)  /* number of pilot baseband samples reqd for pilot LPF   */
 #define NPILOTLPF                  (4*M)    /* number of samples we DFT pilot over, pilot est window */
 #define MPILOTFFT                    256
+#define NC_PAD          (((NC+1)+3) & ~3)   /* NC+1 rounded up to a multiple of 4 for SIMD   */
 
 /* freq offset sestimation states */
 
 #define COARSE                   0
 #define FINE                     1
 
+/* fast acquisition, see fdmdv_set_fast_acquisition() */
+
+#define NACQ                    12  /* frames buffered while acquiring                              */
+#define NACQ_MIN                 8  /* frames buffered before hypotheses are first tried            */
+#define NACQ_STEP                2  /* frames between attempts                                       */
+#define NACQ_PEAKS               2  /* pilot DFT peaks tried from each of the two time shifts       */
+#define NACQ_SYNC                5  /* sync bit changes needed at the end of the window to accept   */
+#define ACQ_PEAK_RATIO         5.5  /* pilot DFT peak to mean power ratio worth trying              */
+
 /* averaging filter coeffs */
 
 #define TRACK_COEFF              0.5
 #define SNR_COEFF                0.9       /* SNR est averaging filter coeff */
+#define CLOCK_ALPHA              0.005     /* sample clock tracker, alpha-beta filter on rx_timing */
+#define CLOCK_BETA               0.0000125
+#define CLOCK_N                  800       /* fine frames before the tracker gains settle at the above */
+#define CLOCK_DELAY              6         /* frames before a resampler change shows in rx_timing */
 
 /*---------------------------------------------------------------------------*\
                                                                              
@@ -80,6 +95,41 @@
 
 \*---------------------------------------------------------------------------*/
 
+/* Bank of NC+1 complex oscillators, real and imag parts in separate
+   arrays so all carriers are stepped together.  Lanes NC+1..NC_PAD-1
+   are padding that holds a stationary unit phasor */
+
+struct FDMDV_OSC {
+    float phase_re[NC_PAD];
+    float phase_im[NC_PAD];
+    float freq_re[NC_PAD];
+    float freq_im[NC_PAD];
+};
+
+/* rx filter memory for each carrier at rate M.  Real and imag parts
+   are kept apart for the real valued filter, and every sample is
+   written twice, at index and index+NFILTER, so the last NFILTER
+   samples are always contiguous from index and nothing is shifted */
+
+struct FDMDV_RX_FILTER {
+    float re[NC+1][2*NFILTER];
+    float im[NC+1][2*NFILTER];
+    int   index;
+};
+
+/* Timing estimation memories, double written rings like struct
+   FDMDV_RX_FILTER.  The rate M baseband memory is stored time major
+   with one lane per carrier, so the resampling filter runs across all
+   carriers at once while summing each carrier in tap order */
+
+struct FDMDV_RX_TIMING {
+    COMP  filt[NC+1][2*NT*P];               /* rate P filtered symbols     */
+    int   filt_index;
+    float bb_re[2*NFILTERTIMING][NC_PAD];   /* rate M baseband samples     */
+    float bb_im[2*NFILTERTIMING][NC_PAD];
+    int   bb_index;
+};
+
 struct FDMDV {
     /* test data (test frame) states */
 
@@ -118,10 +168,9 @@ struct FDMDV {
     
     /* Demodulator */
 
-    COMP  phase_rx[NC+1];
-    COMP  rx_filter_memory[NC+1][NFILTER];
-    COMP  rx_filter_mem_timing[NC+1][NT*P];
-    COMP  rx_baseband_mem_timing[NC+1][NFILTERTIMING];
+    struct FDMDV_OSC osc_rx;
+    struct FDMDV_RX_FILTER rx_filter_memory;
+    struct FDMDV_RX_TIMING rx_timing_mem;
     float rx_timing;
     COMP  phase_difference[NC+1];
     COMP  prev_rx_symbols[NC+1];
@@ -131,6 +180,14 @@ struct FDMDV {
     int  fest_state;
     int  coarse_fine;
 
+    /* sample clock offset tracking */
+
+    float clock_timing;                     /* smoothed rx_timing with the nin steps put back */
+    float clock_rate;                       /* its drift in samples per frame                 */
+    int   clock_n;                          /* fine frames tracked, up to CLOCK_N             */
+    float clock_corr[CLOCK_DELAY+1];        /* ppm the last frames were resampled by, newest  */
+                                            /* first, see fdmdv_clock_track()                 */
+
     /* SNR estimation states */
 
     float sig_est[NC+1];
@@ -139,9 +196,96 @@ struct FDMDV {
     /* Buf for FFT/waterfall */
 
     float fft_buf[2*FDMDV_NSPEC];
-    kiss_fft_cfg fft_cfg;             
+    kiss_fftr_cfg fft_cfg;             
+
+    /* fast acquisition states, NULL unless enabled */
+
+    struct FDMDV_ACQ *acq;
  };
 
+/* buffered frames and scratch demods for fast acquisition */
+
+struct FDMDV_ACQ {
+    COMP          buf[NACQ][M];   /* last nframes frames, the newest before head */
+    int           nframes;
+    int           head;
+    int           count;          /* frames since the last attempt               */
+    struct FDMDV *hyp;            /* scratch demod for trying hypotheses         */
+};
+
+/* 8 <-> 48 kHz sample rate converter states */
+
+#define MEM8           (FDMDV_OS_TAPS/FDMDV_OS) /* 8 kHz filter memory                       */
+#define OS_PAD         8                        /* FDMDV_OS rounded up to a multiple of 4    */
+#define RESAMPLE_BLOCK FDMDV_NOM_SAMPLES_PER_FRAME  /* 8 kHz samples converted per pass      */
+
+struct FDMDV_RESAMPLER {
+    float coeff[MEM8][OS_PAD];                       /* upsampler polyphase filter       */
+    float buf8[MEM8 + RESAMPLE_BLOCK];               /* 8 kHz memory + current block     */
+    float buf48[FDMDV_OS_TAPS + FDMDV_OS*RESAMPLE_BLOCK]; /* 48 kHz memory + current block */
+};
+
+/* 48 kHz stereo to 8 kHz mono front end states */
+
+struct FDMDV_DOWNMIX {
+    float         mem[2*FDMDV_OS_TAPS];    /* 48 kHz mono filter memory, stored twice */
+    int           index;                   /* next write position in mem[]             */
+    int           phase;                   /* 48 kHz samples since last output         */
+    unsigned char partial[4];              /* stereo sample split across calls         */
+    int           npartial;
+};
+
+/* fractional resampler and timing loop for sample clock offset correction */
+
+#define CLOCK_NT      16                   /* interpolator taps                          */
+#define CLOCK_NP      64                   /* interpolator phases per input sample       */
+#define CLOCK_TIMING  (M/P)                /* rx_timing steered to, mid nin window       */
+#define CLOCK_KP      50.0                 /* loop gains, ppm per sample of timing error */
+#define CLOCK_KI      0.2                  /* ... and ppm per frame per sample           */
+#define CLOCK_MAX_PPM 10000.0
+
+struct FDMDV_CLOCK {
+    float h[CLOCK_NP+1][CLOCK_NT];         /* interpolator for mu = p/CLOCK_NP, oldest tap first */
+    float mem[2*CLOCK_NT];                 /* input, stored twice                        */
+    int   index;                           /* next write position in mem[]               */
+    float mu;                              /* next output time, input samples past tap   */
+                                           /* CLOCK_NT/2-1                               */
+    float step;                            /* input samples per output sample            */
+    float ppm;                             /* loop integrator, the clock offset          */
+};
+
+/* 48 kHz polyphase channelizer and per sub-band pilot detector */
+
+#define CHAN_K      (48000/FDMDV_SUB_HZ)   /* filter bank branches and DFT size         */
+#define CHAN_D      (CHAN_K/2)             /* decimation to 8 kHz, equals FDMDV_OS      */
+#define CHAN_Q      8                      /* prototype filter taps per branch          */
+#define CHAN_PAD    8                      /* FDMDV_NSUB rounded up to a multiple of 4  */
+#define NDET        (8*M)                  /* pilot detector DFT, Rs/8 (6.25 Hz) bins   */
+#define DET_HZ      2600                   /* pilots are searched for within this of a  */
+                                           /* sub-band centre (Hz), the passband edge   */
+#define DET_BW      1200                   /* FDMDV signal bandwidth (Hz)               */
+#define DET_BETA    0.25                   /* detector spectrum averaging filter coeff  */
+#define DET_ON      8.0                    /* pilot line to mean power ratio to detect  */
+#define DET_OFF     4.0                    /* ... and to lose a pilot already detected  */
+
+struct FDMDV_CHANNELIZER {
+    float        h[CHAN_K][CHAN_Q];          /* prototype LPF, one row per branch        */
+    float        dft_re[CHAN_K][CHAN_PAD];   /* cos(2.pi.k.s/K), row s, sub-band k across */
+    float        dft_im[CHAN_K][CHAN_PAD];   /* -sin(2.pi.k.s/K)                         */
+    float        mem[CHAN_K][2*CHAN_Q];      /* input by time mod K, each stored twice   */
+    int          index;                      /* next write position in each mem[] row    */
+    int          phase;                      /* time mod K of the next input sample      */
+    int          ndec;                       /* input samples since the last output      */
+
+    kiss_fft_cfg fft_cfg;
+    float        window[NDET];
+    COMP         det_buf[FDMDV_NSUB][NDET];  /* sub-band samples for the next DFT        */
+    int          ndet;
+    float        det_pow[FDMDV_NSUB][NDET];  /* averaged power spectrum                  */
+    int          pilot[FDMDV_NSUB];          /* 1 while a pilot is detected              */
+    float        foff[FDMDV_NSUB];           /* its offset from the sub-band centre (Hz) */
+};
+
 /*---------------------------------------------------------------------------*\
                                                                              
                               FUNCTION PROTOTYPES
@@ -153,17 +297,16 @@ void tx_filter(COMP tx_baseband[NC+1][M], COMP tx_symbols[], COMP tx_filter_memo
 void fdm_upconvert(COMP tx_fdm[], COMP tx_baseband[NC+1][M], COMP phase_tx[], COMP freq_tx[]);
 void generate_pilot_fdm(COMP *pilot_fdm, int *bit, float *symbol, float *filter_mem, COMP *phase, COMP *freq);
 void generate_pilot_lut(COMP pilot_lut[], COMP *pilot_freq);
-float rx_est_freq_offset(struct FDMDV *f, COMP rx_fdm[], int nin);
-void lpf_peak_pick(float *foff, float *max, COMP pilot_baseband[], COMP pilot_lpf[], kiss_fft_cfg fft_pilot_cfg, COMP S[], int nin);
+float rx_est_freq_offset(struct FDMDV *f, COMP rx_fdm[], int nin, int do_fft);
+void lpf_peak_pick(float *foff, float *max, COMP pilot_baseband[], COMP pilot_lpf[], kiss_fft_cfg fft_pilot_cfg, COMP S[], int nin, int do_fft);
 void freq_shift(COMP rx_fdm_fcorr[], COMP rx_fdm[], float foff, COMP *foff_rect, COMP *foff_phase_rect, int nin);
-void fdm_downconvert(COMP rx_baseband[NC+1][M+M/P], COMP rx_fdm[], COMP phase_rx[], COMP freq[], int nin);
-void rx_filter(COMP rx_filt[NC+1][P+1], COMP rx_baseband[NC+1][M+M/P], COMP rx_filter_memory[NC+1][NFILTER], int nin);
+void fdm_downconvert(COMP rx_baseband[NC+1][M+M/P], COMP rx_fdm[], struct FDMDV_OSC *osc, int nin);
+void rx_filter(COMP rx_filt[NC+1][P+1], COMP rx_baseband[NC+1][M+M/P], struct FDMDV_RX_FILTER *rx_filter_memory, int nin);
 float rx_est_timing(COMP  rx_symbols[], 
 		   COMP  rx_filt[NC+1][P+1], 
 		   COMP  rx_baseband[NC+1][M+M/P], 
-		   COMP  rx_filter_mem_timing[NC+1][NT*P], 
+		   struct FDMDV_RX_TIMING *mem,
 		   float env[],
-		   COMP  rx_baseband_mem_timing[NC+1][NFILTERTIMING], 
 		   int   nin);	 
 float qpsk_to_bits(int rx_bits[], int *sync_bit, COMP phase_difference[], COMP prev_rx_symbols[], COMP rx_symbols[]);
 void snr_update(float sig_est[], float noise_est[], COMP phase_difference[]);
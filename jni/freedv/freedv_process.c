@@ -11,6 +11,8 @@
 
 #include "codec2.h"
 #include "fdmdv.h"
+#include "../freedv_decode.h"
+#include "../freedv_spectrum.h"
 
 #define UNUSED __attribute__((unused))
 
@@ -49,19 +51,33 @@
 #define BITS_PER_CODEC_FRAME (2*FDMDV_BITS_PER_FRAME)
 #define BYTES_PER_CODEC_FRAME (BITS_PER_CODEC_FRAME/8)
 
-// Globals --------------------------------------
-
-struct FDMDV *fdmdv;
-struct CODEC2 *codec2;
+/* One receiver: demod, speech decoder and the buffers between them.
+ * Contexts share nothing, so any number can run on different threads. */
+struct freedv_rx {
+    struct FDMDV *fdmdv;
+    struct CODEC2 *codec2;
+    struct FDMDV_DOWNMIX *downmix;
+    struct FDMDV_CLOCK *clock;
+    struct freedv_spectrum *spectrum;   /* Not owned, may be NULL. */
+
+    // Main processing loop states ------------------
+
+    short  input_buf[2*FDMDV_NOM_SAMPLES_PER_FRAME];
+    int    n_input_buf;
+    COMP   rx_fdm[FDMDV_NOM_SAMPLES_PER_FRAME]; /* resampled demod input */
+    int    n_rx_fdm;
+    short *output_buf;
+    int    n_output_buf;
+    int    codec_bits[2*FDMDV_BITS_PER_FRAME];
+    int    state;
+    struct FDMDV_STATS stats;
+};
 
-// Main processing loop states ------------------
+// Globals --------------------------------------
 
-short  input_buf[2*FDMDV_NOM_SAMPLES_PER_FRAME];
-int    n_input_buf = 0;
-int    g_nin = FDMDV_NOM_SAMPLES_PER_FRAME;
-short *output_buf;
-int    n_output_buf = 0;
-int    codec_bits[2*FDMDV_BITS_PER_FRAME];
+/* Default context behind freedv_create() and friends, with its state
+ * and stats mirrored for the single channel JNI getters. */
+static struct freedv_rx *g_rx;
 int    g_state = 0;
 struct FDMDV_STATS stats;
 
@@ -70,13 +86,60 @@ typedef struct {
     float               in8k[MEM8 + N8];
 } paCallBackData;
 
+struct freedv_rx *freedv_rx_create(void) {
+    struct freedv_rx *rx = calloc(1, sizeof(*rx));
+
+    if (!rx)
+        return NULL;
+    rx->fdmdv = fdmdv_create();
+    rx->codec2 = codec2_create(CODEC2_MODE_1400);
+    rx->downmix = fdmdv_downmix_create();
+    rx->clock = fdmdv_clock_create();
+    if (rx->codec2)
+        rx->output_buf = (short*)malloc(2*sizeof(short)*codec2_samples_per_frame(rx->codec2)); 
+    if (!(rx->output_buf && rx->fdmdv && rx->codec2 && rx->downmix &&
+            rx->clock)) {
+        freedv_rx_destroy(rx);
+        return NULL;
+    }
+    return rx;
+}
+
+void freedv_rx_destroy(struct freedv_rx *rx) {
+    if (!rx)
+        return;
+    if (rx->fdmdv)
+        fdmdv_destroy(rx->fdmdv);
+    if (rx->codec2)
+        codec2_destroy(rx->codec2);
+    if (rx->downmix)
+        fdmdv_downmix_destroy(rx->downmix);
+    if (rx->clock)
+        fdmdv_clock_destroy(rx->clock);
+    free(rx->output_buf);
+    free(rx);
+}
+
+void freedv_rx_get_stats(struct freedv_rx *rx, struct FDMDV_STATS *st) {
+    *st = rx->stats;
+}
+
+int freedv_rx_synced(struct freedv_rx *rx) {
+    return rx->state > 0;
+}
+
+void freedv_rx_set_spectrum(struct freedv_rx *rx, struct freedv_spectrum *sp) {
+    rx->spectrum = sp;
+}
+
+int freedv_rx_set_fast_acquisition(struct freedv_rx *rx, int enable) {
+    return fdmdv_set_fast_acquisition(rx->fdmdv, enable);
+}
+
 int freedv_create() {
-    fdmdv = fdmdv_create();
-    codec2 = codec2_create(CODEC2_MODE_1400);
+    g_rx = freedv_rx_create();
     fprintf(stderr, "Created context\n");
-
-    output_buf = (short*)malloc(2*sizeof(short)*codec2_samples_per_frame(codec2)); 
-    return (output_buf && fdmdv && codec2);
+    return g_rx != NULL;
 }
 
 /*------------------------------------------------------------------*\
@@ -115,44 +178,38 @@ int freedv_create() {
   are effectively clocked at the remote modulator sound card D/A clock
   rate.  We slip/gain buffers supplied to sound card 2 to compensate.
 
-  The current demod handles varying clock rates by having a variable
-  number of input samples, e.g. 120 160 (nominal) or 200.  However the
-  A/D always delivers a fixed number of samples.
-
-  So we currently need some logic between the A/D and the demod:
-    + A/D delivers fixed number of samples
-    + demod processes a variable number of samples
-    + this means we run demod 0,1 or 2 times, depending 
-      on number of buffered A/D samples
-    + demod always outputs 1 frame of bits
-    + so run demod and speech decoder 0, 1 or 2 times
+  The demod on its own handles varying clock rates by asking for a
+  variable number of input samples, e.g. 120 160 (nominal) or 200,
+  which means running it 0, 1 or 2 times per A/D buffer.  Instead the
+  A/D samples go through a fractional resampler that a timing loop
+  (fdmdv_clock_track()) locks to the remote modulator's clock:
+    + A/D delivers any number of samples, all consumed every call
+    + resampler delivers samples on the tx clock
+    + demod always processes N8 of them, its timing is held mid
+      window so it never needs to ask for more or less
+    + the demod runs 0 or 2 times for a buffer only when a whole
+      frame of clock offset has built up, e.g. every 200 seconds at
+      100 ppm
   
   The ouput of the demod is codec voice data so it's OK if we miss or
   repeat a frame every now and again.
 
-  TODOs:
-
-    + this might work with arbitrary input and output buffer lengths,
-    0,1, or 2 only apply if we are inputting the nominal number of
-    samples on every call.
-
-    + so the I/O buffer sizes might not matter, as long as they of
-    reasonable size (say twice the nominal size).
-
 \*------------------------------------------------------------------*/
 
-void per_frame_rx_processing(short  output_buf[], /* output buf of decoded speech samples          */
-                             int   *n_output_buf, /* how many samples currently in output_buf[]    */
-                             int    codec_bits[], /* current frame of bits for decoder             */
-                             short  input_buf[],  /* input buf of modem samples input to demod     */ 
-                             int   *n_input_buf   /* how many samples currently in input_buf[]     */
-                             )
+static void per_frame_rx_processing(struct freedv_rx *rx)
 {
+    struct FDMDV  *fdmdv = rx->fdmdv;
+    struct CODEC2 *codec2 = rx->codec2;
+    short  *output_buf = rx->output_buf;   /* output buf of decoded speech samples          */
+    int    *n_output_buf = &rx->n_output_buf; /* how many samples currently in output_buf[] */
+    int    *codec_bits = rx->codec_bits;   /* current frame of bits for decoder             */
+    short  *input_buf = rx->input_buf;     /* input buf of modem samples input to demod     */
+    int    *n_input_buf = &rx->n_input_buf; /* how many samples currently in input_buf[]    */
+    COMP   *rx_fdm = rx->rx_fdm;           /* resampled demod input                         */
     int    sync_bit;
-    COMP   rx_fdm[FDMDV_MAX_SAMPLES_PER_FRAME];
     int    rx_bits[FDMDV_BITS_PER_FRAME];
     unsigned char  packed_bits[BYTES_PER_CODEC_FRAME];
-    int    i, nin_prev, bit, byte;
+    int    i, nin, used, bit, byte;
     int    next_state;
 
     if (!(*n_input_buf <= (2*FDMDV_NOM_SAMPLES_PER_FRAME))) {
@@ -160,49 +217,40 @@ void per_frame_rx_processing(short  output_buf[], /* output buf of decoded speec
     }
    
     /*
-      This while loop will run the demod 0, 1 (nominal) or 2 times:
-
-      0: when tx sample clock runs faster than rx, occasionally we
-         will run out of samples
-
-      1: normal, run decoder once, every 2nd frame output a frame of
-         speech samples to D/A
-
-      2: when tx sample clock runs slower than rx, occasionally we will
-         have enough samples to run demod twice.
-
-      With a +/- 10 Hz sample clock difference at FS=8000Hz (+/- 1250
-      ppm), case 0 or 1 occured about once every 30 seconds.  This is
-      no problem for the decoded audio.
+      This while loop will run the demod once per N8 resampled
+      samples, normally once per call.  A frame may be partly
+      resampled when input runs out, it is finished next call.
     */
 
-    while(*n_input_buf >= g_nin) {
+    while(1) {
 
-        // demod per frame processing
+        // resample onto the tx clock
 
-        for(i=0; i<g_nin; i++) {
-            rx_fdm[i].real = (float)input_buf[i]/FDMDV_SCALE;
-            rx_fdm[i].imag = 0.0;
-        }
-
-        nin_prev = g_nin;
-        fdmdv_demod(fdmdv, rx_bits, &sync_bit, rx_fdm, &g_nin);
-        *n_input_buf -= nin_prev;
-        if (!(*n_input_buf >= 0)) {
-            fprintf(stderr, "Assert: *n_input_buf >= 0\n");
-        }
+        used = *n_input_buf;
+        rx->n_rx_fdm += fdmdv_clock_resample(rx->clock, &rx_fdm[rx->n_rx_fdm],
+                                             N8 - rx->n_rx_fdm, input_buf, &used);
+        *n_input_buf -= used;
 
         // shift input buffer
 
         for(i=0; i<*n_input_buf; i++)
-            input_buf[i] = input_buf[i+nin_prev];
+            input_buf[i] = input_buf[i+used];
 
-#if 0
-        // compute rx spectrum & get demod stats, and update GUI plot data
+        if (rx->n_rx_fdm < N8)
+            break;
+        rx->n_rx_fdm = 0;
+
+        // demod per frame processing, the clock loop keeps nin at N8
+
+        nin = N8;
+        fdmdv_demod(fdmdv, rx_bits, &sync_bit, rx_fdm, &nin);
+
+        // feed the spectrum engine & get demod stats, and update GUI plot data
 
-        fdmdv_get_rx_spectrum(fdmdv, rx_spec, rx_fdm, nin_prev);
-#endif
-        fdmdv_get_demod_stats(fdmdv, &stats);
+        if (rx->spectrum)
+            freedv_spectrum_write(rx->spectrum, rx_fdm, N8);
+        fdmdv_get_demod_stats(fdmdv, &rx->stats);
+        fdmdv_clock_track(rx->clock, fdmdv, &rx->stats);
 
         /* 
            State machine to:
@@ -216,8 +264,8 @@ void per_frame_rx_processing(short  output_buf[], /* output buf of decoded speec
              one frame of codec bits.
         */
 
-        next_state = g_state;
-        switch (g_state) {
+        next_state = rx->state;
+        switch (rx->state) {
         case 0:
             /* mute output audio when out of sync */
 
@@ -230,7 +278,7 @@ void per_frame_rx_processing(short  output_buf[], /* output buf of decoded speec
                 fprintf(stderr, "Assert: *n_output_buf <= (2*codec2_samples_per_frame(codec2))\n");
             }
 
-            if ((stats.fest_coarse_fine == 1) && (stats.snr_est > 3.0))
+            if ((rx->stats.fest_coarse_fine == 1) && (rx->stats.snr_est > 3.0))
                 next_state = 1;
 
             break;
@@ -245,14 +293,14 @@ void per_frame_rx_processing(short  output_buf[], /* output buf of decoded speec
             else
                 next_state = 1;
 
-            if (stats.fest_coarse_fine == 0)
+            if (rx->stats.fest_coarse_fine == 0)
                 next_state = 0;
 
             break;
         case 2:
             next_state = 1;
 
-            if (stats.fest_coarse_fine == 0)
+            if (rx->stats.fest_coarse_fine == 0)
                 next_state = 0;
 
             if (sync_bit == 1) {
@@ -293,42 +341,87 @@ void per_frame_rx_processing(short  output_buf[], /* output buf of decoded speec
             }
             break;
         }
-        g_state = next_state;
+        rx->state = next_state;
     }
 }
 
+/* Copies up to max_speech decoded samples out of the context. */
+static int take_speech(struct freedv_rx *rx, short speech_out[], int max_speech) {
+    int i, n;
+
+    n = rx->n_output_buf;
+    if (n > max_speech)
+        n = max_speech;
+    memcpy(speech_out, rx->output_buf, n*sizeof(short));
+    rx->n_output_buf -= n;
+    for(i=0; i<rx->n_output_buf; i++)
+        rx->output_buf[i] = rx->output_buf[i+n];
+    return n;
+}
+
 /**
- * Pass in FDMDV_NOM_SAMPLES_PER_FRAME shorts worth of data.
+ * Pass in FDMDV_NOM_SAMPLES_PER_FRAME 8 kHz modem samples. Up to N8
+ * decoded speech samples are written to speech_out, the number
+ * written is returned.
  */
-int freedv_decode(uint16_t *input) {
-    int i;
-
-//    jshortArray outputArray = (*env)->NewShortArray(env, N8);
-    uint16_t *outputArray;
-
-   outputArray = (uint16_t *)malloc(N8 * sizeof(uint16_t));
-
-    memcpy(&input_buf[n_input_buf], input,
+int freedv_rx_decode(struct freedv_rx *rx, short speech_out[],
+        const short *input) {
+    memcpy(&rx->input_buf[rx->n_input_buf], input,
             sizeof(short) * FDMDV_NOM_SAMPLES_PER_FRAME);
-    n_input_buf += FDMDV_NOM_SAMPLES_PER_FRAME;
+    rx->n_input_buf += FDMDV_NOM_SAMPLES_PER_FRAME;
 
     /* Decode frame. */
-    per_frame_rx_processing(output_buf, &n_output_buf,
-            codec_bits,
-            input_buf, &n_input_buf);
-
-    if (n_output_buf >= N8) {
-        /* Copy to output buf array. */
-//        (*env)->SetShortArrayRegion(env, outputArray, 0, N8, output_buf);
-        memcpy(outputArray, output_buf, N8*sizeof(uint16_t));
-        n_output_buf -= N8;
-        if (!(n_output_buf >= 0)) {
-            fprintf(stderr, "Assert:n_output_buf >= 0\n");
-        }
+    per_frame_rx_processing(rx);
 
-        /* Shift speech sample output buffer. */
-        for(i=0; i<n_output_buf; i++)
-            output_buf[i] = output_buf[i+N8];
+    if (rx->n_output_buf >= N8)
+        return take_speech(rx, speech_out, N8);
+    return 0;
+}
+
+/**
+ * Pass in raw 48 kHz 16-bit stereo capture, any number of bytes. It is
+ * converted straight into input_buf at 8 kHz and demodulated as soon as
+ * enough samples are buffered. Up to max_speech decoded speech samples
+ * are copied to speech_out, the number copied is returned.
+ */
+int freedv_rx_decode_48k_stereo(struct freedv_rx *rx, short speech_out[],
+        int max_speech, const uint8_t *pcm, int nbytes) {
+    int nspeech = 0;
+    int n, used;
+
+    while (nbytes > 0) {
+        used = nbytes;
+        n = fdmdv_downmix_48_to_8(rx->downmix, &rx->input_buf[rx->n_input_buf],
+                2*FDMDV_NOM_SAMPLES_PER_FRAME - rx->n_input_buf, pcm, &used);
+        rx->n_input_buf += n;
+        pcm += used;
+        nbytes -= used;
+
+        per_frame_rx_processing(rx);
+
+        nspeech += take_speech(rx, &speech_out[nspeech], max_speech - nspeech);
     }
+    return nspeech;
+}
+
+/**
+ * Pass in FDMDV_NOM_SAMPLES_PER_FRAME shorts worth of data.
+ */
+int freedv_decode(uint16_t *input) {
+    short speech[N8];
+
+    freedv_rx_decode(g_rx, speech, (short *)input);
+    g_state = g_rx->state;
+    stats = g_rx->stats;
     return 0;
 }
+
+int freedv_decode_48k_stereo(short speech_out[], int max_speech,
+        const uint8_t *pcm, int nbytes) {
+    int nspeech = freedv_rx_decode_48k_stereo(g_rx, speech_out, max_speech,
+            pcm, nbytes);
+
+    g_state = g_rx->state;
+    stats = g_rx->stats;
+    return nspeech;
+}
@@ -18,6 +18,154 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
  fixed or floating point complex numbers.  It also delares the kf_ internal functions.
  */
 
+#if !defined(FIXED_POINT) && !defined(USE_SIMD)
+#include "vec.h"
+#if defined(__SSE__) || defined(VEC_NEON)
+#define KF_VEC
+#endif
+#endif
+
+#ifdef KF_VEC
+
+static int kf_use_vec = 1;
+
+/* Radix 2 and 4 butterflies working on two neighbouring columns k, k+1
+   at once, one vector holding two kiss_fft_cpx as r,i,r,i.  The ops
+   are the same as C_MUL/C_ADD/C_SUB in the same order, so with SSE the
+   output is bit exact with the scalar butterflies.  Used when the
+   stage length m is even, which covers every stage of a power of two
+   FFT apart from the m == 1 stage at the bottom of the recursion */
+
+#if defined(__SSE__)
+
+typedef __m128 kf_v2;
+
+static inline kf_v2 kf_v2_load(const kiss_fft_cpx *p)    { return _mm_loadu_ps((const float *)p); }
+static inline void  kf_v2_store(kiss_fft_cpx *p, kf_v2 a) { _mm_storeu_ps((float *)p, a); }
+static inline kf_v2 kf_v2_add(kf_v2 a, kf_v2 b)          { return _mm_add_ps(a, b); }
+static inline kf_v2 kf_v2_sub(kf_v2 a, kf_v2 b)          { return _mm_sub_ps(a, b); }
+
+/* tw[0] and tw[stride] */
+
+static inline kf_v2 kf_v2_load_tw(const kiss_fft_cpx *tw, size_t stride)
+{
+    return _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)tw),
+                        (const __m64 *)(tw + stride));
+}
+
+/* i,r,i,r with the sign of the real or imag lanes flipped, i.e. a*j or a*-j */
+
+static inline kf_v2 kf_v2_mul_j(kf_v2 a)
+{
+    return _mm_xor_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2,3,0,1)), _mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f));
+}
+
+static inline kf_v2 kf_v2_mul_mj(kf_v2 a)
+{
+    return _mm_xor_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2,3,0,1)), _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f));
+}
+
+static inline kf_v2 kf_v2_cmul(kf_v2 a, kf_v2 b)
+{
+    __m128 br = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2,2,0,0));
+    __m128 bi = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3,3,1,1));
+    __m128 t  = _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2,3,0,1)), bi);
+
+    /* r = ar*br + -(ai*bi), i = ai*br + ar*bi */
+    return _mm_add_ps(_mm_mul_ps(a, br), _mm_xor_ps(t, _mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f)));
+}
+
+#else /* VEC_NEON */
+
+typedef float32x4_t kf_v2;
+
+static inline kf_v2 kf_v2_load(const kiss_fft_cpx *p)    { return vld1q_f32((const float *)p); }
+static inline void  kf_v2_store(kiss_fft_cpx *p, kf_v2 a) { vst1q_f32((float *)p, a); }
+static inline kf_v2 kf_v2_add(kf_v2 a, kf_v2 b)          { return vaddq_f32(a, b); }
+static inline kf_v2 kf_v2_sub(kf_v2 a, kf_v2 b)          { return vsubq_f32(a, b); }
+
+static inline kf_v2 kf_v2_load_tw(const kiss_fft_cpx *tw, size_t stride)
+{
+    return vcombine_f32(vld1_f32((const float *)tw), vld1_f32((const float *)(tw + stride)));
+}
+
+static inline kf_v2 kf_v2_flip(kf_v2 a, uint32_t re, uint32_t im)
+{
+    const uint32_t m[4] = { re, im, re, im };
+    return vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(a), vld1q_u32(m)));
+}
+
+static inline kf_v2 kf_v2_mul_j(kf_v2 a)  { return kf_v2_flip(vrev64q_f32(a), 0x80000000, 0); }
+static inline kf_v2 kf_v2_mul_mj(kf_v2 a) { return kf_v2_flip(vrev64q_f32(a), 0, 0x80000000); }
+
+static inline kf_v2 kf_v2_cmul(kf_v2 a, kf_v2 b)
+{
+    float32x4x2_t bb = vtrnq_f32(b, b);     /* br,br,.. and bi,bi,.. */
+    float32x4_t   t  = vmulq_f32(vrev64q_f32(a), bb.val[1]);
+
+    return vaddq_f32(vmulq_f32(a, bb.val[0]), kf_v2_flip(t, 0x80000000, 0));
+}
+
+#endif
+
+static void kf_bfly2_vec(
+        kiss_fft_cpx * Fout,
+        const size_t fstride,
+        const kiss_fft_cfg st,
+        int m
+        )
+{
+    kiss_fft_cpx * Fout2 = Fout + m;
+    kiss_fft_cpx * tw1 = st->twiddles;
+    kf_v2 a, t;
+    int k;
+
+    for (k=0; k<m; k+=2) {
+        a = kf_v2_load(&Fout[k]);
+        t = kf_v2_cmul(kf_v2_load(&Fout2[k]), kf_v2_load_tw(tw1, fstride));
+        tw1 += 2*fstride;
+        kf_v2_store(&Fout2[k], kf_v2_sub(a, t));
+        kf_v2_store(&Fout[k], kf_v2_add(a, t));
+    }
+}
+
+static void kf_bfly4_vec(
+        kiss_fft_cpx * Fout,
+        const size_t fstride,
+        const kiss_fft_cfg st,
+        const size_t m
+        )
+{
+    kiss_fft_cpx *tw1,*tw2,*tw3;
+    kf_v2 f0, s0, s1, s2, s3, s4, s5;
+    size_t k;
+
+    tw3 = tw2 = tw1 = st->twiddles;
+
+    for (k=0; k<m; k+=2) {
+        s0 = kf_v2_cmul(kf_v2_load(&Fout[k+m]),   kf_v2_load_tw(tw1, fstride));
+        s1 = kf_v2_cmul(kf_v2_load(&Fout[k+2*m]), kf_v2_load_tw(tw2, fstride*2));
+        s2 = kf_v2_cmul(kf_v2_load(&Fout[k+3*m]), kf_v2_load_tw(tw3, fstride*3));
+        tw1 += 2*fstride;
+        tw2 += 4*fstride;
+        tw3 += 6*fstride;
+
+        f0 = kf_v2_load(&Fout[k]);
+        s5 = kf_v2_sub(f0, s1);
+        f0 = kf_v2_add(f0, s1);
+        s3 = kf_v2_add(s0, s2);
+        s4 = kf_v2_sub(s0, s2);
+        kf_v2_store(&Fout[k+2*m], kf_v2_sub(f0, s3));
+        kf_v2_store(&Fout[k], kf_v2_add(f0, s3));
+
+        s4 = st->inverse ? kf_v2_mul_j(s4) : kf_v2_mul_mj(s4);
+        kf_v2_store(&Fout[k+m], kf_v2_add(s5, s4));
+        kf_v2_store(&Fout[k+3*m], kf_v2_sub(s5, s4));
+    }
+}
+
+#endif
+
 static void kf_bfly2(
         kiss_fft_cpx * Fout,
         const size_t fstride,
@@ -28,6 +176,12 @@ static void kf_bfly2(
     kiss_fft_cpx * Fout2;
     kiss_fft_cpx * tw1 = st->twiddles;
     kiss_fft_cpx t;
+#ifdef KF_VEC
+    if (kf_use_vec && (m & 1) == 0) {
+        kf_bfly2_vec(Fout,fstride,st,m);
+        return;
+    }
+#endif
     Fout2 = Fout + m;
     do{
         C_FIXDIV(*Fout,2); C_FIXDIV(*Fout2,2);
@@ -54,6 +208,12 @@ static void kf_bfly4(
     const size_t m2=2*m;
     const size_t m3=3*m;
 
+#ifdef KF_VEC
+    if (kf_use_vec && (m & 1) == 0) {
+        kf_bfly4_vec(Fout,fstride,st,m);
+        return;
+    }
+#endif
 
     tw3 = tw2 = tw1 = st->twiddles;
 
@@ -393,6 +553,16 @@ void kiss_fft_cleanup(void)
     // nothing needed any more
 }
 
+int kiss_fft_use_vec(int enable)
+{
+#ifdef KF_VEC
+    kf_use_vec = enable;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 int kiss_fft_next_fast_size(int n)
 {
     while(1) {
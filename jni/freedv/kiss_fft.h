@@ -113,6 +113,14 @@ void kiss_fft_cleanup(void);
  */
 int kiss_fft_next_fast_size(int n);
 
+/*
+ * Turns the vectorised radix 2 and 4 butterflies off (enable = 0) or
+ * back on, so they can be checked against the scalar ones.  Affects
+ * every FFT in the process; not thread safe.  Returns 1 if the build
+ * has vector butterflies.
+ */
+int kiss_fft_use_vec(int enable);
+
 /* for real ffts, we need an even size */
 #define kiss_fftr_next_fast_size_real(n) \
         (kiss_fft_next_fast_size( ((n)+1)>>1)<<1)
@@ -0,0 +1,232 @@
+/*
+Copyright (c) 2003-2004, Mark Borgerding
+
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+    * Neither the author nor the names of any contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "kiss_fftr.h"
+#include "_kiss_fft_guts.h"
+
+struct kiss_fftr_state{
+    kiss_fft_cfg substate;
+    kiss_fft_cpx * tmpbuf;
+    kiss_fft_cpx * super_twiddles;
+#ifdef USE_SIMD    
+    void * pad;
+#endif    
+};
+
+/* Full length complex FFTs for kiss_fftr_use_complex(), one per size
+   and direction, allocated on first use */
+
+#define KF_NCOMPLEX 8
+
+struct kf_complex {
+    int nfft;
+    int inverse;
+    kiss_fft_cfg cfg;
+    kiss_fft_cpx * buf;
+};
+
+static int kf_use_complex;
+static struct kf_complex kf_complex[KF_NCOMPLEX];
+
+static struct kf_complex * kf_complex_get(int nfft,int inverse)
+{
+    int i;
+
+    for (i = 0; i < KF_NCOMPLEX && kf_complex[i].cfg; ++i)
+        if (kf_complex[i].nfft == nfft && kf_complex[i].inverse == inverse)
+            return &kf_complex[i];
+    if (i == KF_NCOMPLEX)
+        return NULL;
+    kf_complex[i].buf = (kiss_fft_cpx *) KISS_FFT_MALLOC(sizeof(kiss_fft_cpx) * nfft * 2);
+    kf_complex[i].cfg = kiss_fft_alloc(nfft, inverse, NULL, NULL);
+    if (!kf_complex[i].buf || !kf_complex[i].cfg) {
+        KISS_FFT_FREE(kf_complex[i].buf);
+        KISS_FFT_FREE(kf_complex[i].cfg);
+        kf_complex[i].buf = NULL;
+        kf_complex[i].cfg = NULL;
+        return NULL;
+    }
+    kf_complex[i].nfft = nfft;
+    kf_complex[i].inverse = inverse;
+    return &kf_complex[i];
+}
+
+void kiss_fftr_use_complex(int enable)
+{
+    int i;
+
+    kf_use_complex = enable;
+    if (enable)
+        return;
+    for (i = 0; i < KF_NCOMPLEX; ++i) {
+        KISS_FFT_FREE(kf_complex[i].buf);
+        KISS_FFT_FREE(kf_complex[i].cfg);
+        kf_complex[i].buf = NULL;
+        kf_complex[i].cfg = NULL;
+    }
+}
+
+kiss_fftr_cfg kiss_fftr_alloc(int nfft,int inverse_fft,void * mem,size_t * lenmem)
+{
+    int i;
+    kiss_fftr_cfg st = NULL;
+    size_t subsize, memneeded;
+
+    if (nfft & 1) {
+        fprintf(stderr,"Real FFT optimization must be even.\n");
+        return NULL;
+    }
+    nfft >>= 1;
+
+    kiss_fft_alloc (nfft, inverse_fft, NULL, &subsize);
+    memneeded = sizeof(struct kiss_fftr_state) + subsize + sizeof(kiss_fft_cpx) * ( nfft * 3 / 2);
+
+    if (lenmem == NULL) {
+        st = (kiss_fftr_cfg) KISS_FFT_MALLOC (memneeded);
+    } else {
+        if (*lenmem >= memneeded)
+            st = (kiss_fftr_cfg) mem;
+        *lenmem = memneeded;
+    }
+    if (!st)
+        return NULL;
+
+    st->substate = (kiss_fft_cfg) (st + 1); /*just beyond kiss_fftr_state struct */
+    st->tmpbuf = (kiss_fft_cpx *) (((char *) st->substate) + subsize);
+    st->super_twiddles = st->tmpbuf + nfft;
+    kiss_fft_alloc(nfft, inverse_fft, st->substate, &subsize);
+
+    for (i = 0; i < nfft/2; ++i) {
+        double phase =
+            -3.14159265358979323846264338327 * ((double) (i+1) / nfft + .5);
+        if (inverse_fft)
+            phase *= -1;
+        kf_cexp (st->super_twiddles+i,phase);
+    }
+    return st;
+}
+
+void kiss_fftr(kiss_fftr_cfg st,const kiss_fft_scalar *timedata,kiss_fft_cpx *freqdata)
+{
+    /* input buffer timedata is stored row-wise */
+    int k,ncfft;
+    kiss_fft_cpx fpnk,fpk,f1k,f2k,tw,tdc;
+    struct kf_complex * kfc;
+
+    if ( st->substate->inverse) {
+        fprintf(stderr,"kiss fft usage error: improper alloc\n");
+        exit(1);
+    }
+
+    ncfft = st->substate->nfft;
+
+    if (kf_use_complex && (kfc = kf_complex_get(ncfft * 2, 0)) != NULL) {
+        for (k = 0; k < ncfft * 2; ++k) {
+            kfc->buf[k].r = timedata[k];
+            kfc->buf[k].i = 0;
+        }
+        kiss_fft(kfc->cfg, kfc->buf, kfc->buf + ncfft * 2);
+        memcpy(freqdata, kfc->buf + ncfft * 2, sizeof(kiss_fft_cpx) * (ncfft + 1));
+        return;
+    }
+
+    /*perform the parallel fft of two real signals packed in real,imag.
+      The half length result goes straight into freqdata, which is then
+      split in place: each pass reads bins k and ncfft-k before writing
+      them, so no scratch (and no write to cfg) is needed */
+    kiss_fft( st->substate , (const kiss_fft_cpx*)timedata, freqdata );
+    /* The real part of the DC element of the frequency spectrum in freqdata
+     * contains the sum of the even-numbered elements of the input time sequence
+     * The imag part is the sum of the odd-numbered elements
+     *
+     * The sum of tdc.r and tdc.i is the sum of the input time sequence. 
+     *      yielding DC of input time sequence
+     * The difference of tdc.r - tdc.i is the sum of the input (dot product) [1,-1,1,-1... 
+     *      yielding Nyquist bin of input time sequence
+     */
+ 
+    tdc.r = freqdata[0].r;
+    tdc.i = freqdata[0].i;
+    C_FIXDIV(tdc,2);
+    CHECK_OVERFLOW_OP(tdc.r ,+, tdc.i);
+    CHECK_OVERFLOW_OP(tdc.r ,-, tdc.i);
+    freqdata[0].r = tdc.r + tdc.i;
+    freqdata[ncfft].r = tdc.r - tdc.i;
+    freqdata[ncfft].i = freqdata[0].i = 0;
+
+    for ( k=1;k <= ncfft/2 ; ++k ) {
+        fpk    = freqdata[k]; 
+        fpnk.r =   freqdata[ncfft-k].r;
+        fpnk.i = - freqdata[ncfft-k].i;
+        C_FIXDIV(fpk,2);
+        C_FIXDIV(fpnk,2);
+
+        C_ADD( f1k, fpk , fpnk );
+        C_SUB( f2k, fpk , fpnk );
+        C_MUL( tw , f2k , st->super_twiddles[k-1]);
+
+        freqdata[k].r = HALF_OF(f1k.r + tw.r);
+        freqdata[k].i = HALF_OF(f1k.i + tw.i);
+        freqdata[ncfft-k].r = HALF_OF(f1k.r - tw.r);
+        freqdata[ncfft-k].i = HALF_OF(tw.i - f1k.i);
+    }
+}
+
+void kiss_fftri(kiss_fftr_cfg st,const kiss_fft_cpx *freqdata,kiss_fft_scalar *timedata)
+{
+    /* input buffer timedata is stored row-wise */
+    int k, ncfft;
+    struct kf_complex * kfc;
+
+    if (st->substate->inverse == 0) {
+        fprintf (stderr, "kiss fft usage error: improper alloc\n");
+        exit (1);
+    }
+
+    ncfft = st->substate->nfft;
+
+    if (kf_use_complex && (kfc = kf_complex_get(ncfft * 2, 1)) != NULL) {
+        for (k = 0; k <= ncfft; ++k)
+            kfc->buf[k] = freqdata[k];
+        for (k = 1; k < ncfft; ++k) {
+            kfc->buf[ncfft * 2 - k].r = freqdata[k].r;
+            kfc->buf[ncfft * 2 - k].i = -freqdata[k].i;
+        }
+        kiss_fft(kfc->cfg, kfc->buf, kfc->buf + ncfft * 2);
+        for (k = 0; k < ncfft * 2; ++k)
+            timedata[k] = kfc->buf[ncfft * 2 + k].r;
+        return;
+    }
+
+    st->tmpbuf[0].r = freqdata[0].r + freqdata[ncfft].r;
+    st->tmpbuf[0].i = freqdata[0].r - freqdata[ncfft].r;
+    C_FIXDIV(st->tmpbuf[0],2);
+
+    for (k = 1; k <= ncfft / 2; ++k) {
+        kiss_fft_cpx fk, fnkc, fek, fok, tmp;
+        fk = freqdata[k];
+        fnkc.r = freqdata[ncfft - k].r;
+        fnkc.i = -freqdata[ncfft - k].i;
+        C_FIXDIV( fk , 2 );
+        C_FIXDIV( fnkc , 2 );
+
+        C_ADD (fek, fk, fnkc);
+        C_SUB (tmp, fk, fnkc);
+        C_MUL (fok, tmp, st->super_twiddles[k-1]);
+        C_ADD (st->tmpbuf[k],     fek, fok);
+        C_SUB (st->tmpbuf[ncfft - k], fek, fok);
+        st->tmpbuf[ncfft - k].i *= -1;
+    }
+    kiss_fft (st->substate, st->tmpbuf, (kiss_fft_cpx *) timedata);
+}
@@ -0,0 +1,63 @@
+#ifndef KISS_FTR_H
+#define KISS_FTR_H
+
+#include "kiss_fft.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    
+/* 
+ 
+ Real optimized version can save about 45% cpu time vs. complex fft of a real seq.
+
+ 
+ 
+ */
+
+typedef struct kiss_fftr_state *kiss_fftr_cfg;
+
+
+kiss_fftr_cfg kiss_fftr_alloc(int nfft,int inverse_fft,void * mem, size_t * lenmem);
+/*
+ nfft must be even
+
+ If you don't care to allocate space, use mem = lenmem = NULL 
+*/
+
+
+void kiss_fftr(kiss_fftr_cfg cfg,const kiss_fft_scalar *timedata,kiss_fft_cpx *freqdata);
+/*
+ input timedata has nfft scalar points
+ output freqdata has nfft/2+1 complex points, the rest of the spectrum
+ is the complex conjugate of these.
+
+ The forward transform only reads cfg, so one forward cfg can be
+ shared by several threads.
+*/
+
+void kiss_fftri(kiss_fftr_cfg cfg,const kiss_fft_cpx *freqdata,kiss_fft_scalar *timedata);
+/*
+ input freqdata has  nfft/2+1 complex points
+ output timedata has nfft scalar points, scaled by nfft like the
+ complex inverse kiss_fft()
+
+ The inverse transform uses scratch space in cfg, so an inverse cfg
+ must not be used by two threads at once.
+*/
+
+#define kiss_fftr_free free
+
+/*
+ * Makes kiss_fftr() and kiss_fftri() run a full length complex FFT of
+ * the real signal (enable = 1), the way the codec did before it used
+ * kiss_fftr, so the two can be checked against each other.  The full
+ * length cfgs are kept in a small cache that enable = 0 frees.  Affects
+ * every real FFT in the process; not thread safe.
+ */
+void kiss_fftr_use_complex(int enable);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
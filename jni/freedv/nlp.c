@@ -28,7 +28,8 @@
 #include "defines.h"
 #include "nlp.h"
 #include "dump.h"
-#include "kiss_fft.h"
+#include "kiss_fftr.h"
+#include "vec.h"
 
 #include <assert.h>
 #include <math.h>
@@ -111,10 +112,16 @@ const float nlp_fir[] = {
 };
 
 typedef struct {
+    int           m;                 /* analysis window size         */
+    float         w[PMAX_M/DEC];     /* DFT window                   */
     float         sq[PMAX_M];	     /* squared speech samples       */
     float         mem_x,mem_y;       /* memory for notch filter      */
-    float         mem_fir[NLP_NTAP]; /* decimation FIR filter memory */
-    kiss_fft_cfg  fft_cfg;           /* kiss FFT config              */
+    float         mem_fir[2*NLP_NTAP]; /* decimation FIR filter memory,
+                                          each sample stored twice so
+                                          the last NLP_NTAP are always
+                                          contiguous                  */
+    int           fir_pos;           /* oldest sample in mem_fir[]   */
+    kiss_fftr_cfg fft_cfg;           /* kiss real FFT config         */
 } NLP;
 
 float test_candidate_mbe(COMP Sw[], COMP W[], float f0);
@@ -127,27 +134,34 @@ float post_process_sub_multiples(COMP Fw[],
                                                                              
   nlp_create()                                                                  
                                                                              
-  Initialisation function for NLP pitch estimator.
+  Initialisation function for NLP pitch estimator, m is the analysis
+  window size that will be passed to nlp().
 
 \*---------------------------------------------------------------------------*/
 
-void *nlp_create()
+void *nlp_create(int m)
 {
     NLP *nlp;
     int  i;
 
+    assert(m <= PMAX_M);
     nlp = (NLP*)malloc(sizeof(NLP));
     if (nlp == NULL)
 	return NULL;
 
+    nlp->m = m;
+    for(i=0; i<m/DEC; i++)
+	nlp->w[i] = 0.5 - 0.5*cos(2*PI*i/(m/DEC-1));
+
     for(i=0; i<PMAX_M; i++)
 	nlp->sq[i] = 0.0;
     nlp->mem_x = 0.0;
     nlp->mem_y = 0.0;
-    for(i=0; i<NLP_NTAP; i++)
+    for(i=0; i<2*NLP_NTAP; i++)
 	nlp->mem_fir[i] = 0.0;
+    nlp->fir_pos = 0;
 
-    nlp->fft_cfg = kiss_fft_alloc (PE_FFT_SIZE, 0, NULL, NULL);
+    nlp->fft_cfg = kiss_fftr_alloc (PE_FFT_SIZE, 0, NULL, NULL);
     assert(nlp->fft_cfg != NULL);
 
     return (void*)nlp;
@@ -216,28 +230,39 @@ float nlp(
 {
     NLP   *nlp;
     float  notch;		    /* current notch filter output    */
-    COMP   fw[PE_FFT_SIZE];	    /* DFT of squared signal (input)  */
-    COMP   Fw[PE_FFT_SIZE];	    /* DFT of squared signal (output) */
+    float  fw[PE_FFT_SIZE];	    /* DFT of squared signal (input)  */
+    COMP   Fw[PE_FFT_SIZE/2+1];	    /* DFT of squared signal (output) */
     float  gmax;
     int    gmax_bin;
-    int   i,j;
-    float best_f0;
+    int   i,pos,dec_only;
+    float sq, best_f0;
 
     assert(nlp_state != NULL);
-    assert(m <= PMAX_M);
     nlp = (NLP*)nlp_state;
+    assert(m == nlp->m);
+
+    /* Only every DEC-th filtered sample is read by the DFT below.  As
+       long as the frame shift is a multiple of DEC those samples stay
+       on the same phase as they move down sq[], so the FIR output
+       for the others is never needed. */
+
+    #ifdef DUMP
+    dec_only = 0;		/* dump_sq() wants every sample */
+    #else
+    dec_only = (n % DEC) == 0;
+    #endif
 
-    /* Square, notch filter at DC, and LP filter vector */
+    /* Square, notch filter at DC, and LP filter vector in one pass */
 
-    for(i=m-n; i<m; i++) 	    /* square latest speech samples */
-	nlp->sq[i] = Sn[i]*Sn[i];
+    pos = nlp->fir_pos;
+    for(i=m-n; i<m; i++) {
+	sq = Sn[i]*Sn[i];
 
-    for(i=m-n; i<m; i++) {	/* notch filter at DC */
-	notch = nlp->sq[i] - nlp->mem_x;
+	notch = sq - nlp->mem_x;
 	notch += COEFF*nlp->mem_y;
-	nlp->mem_x = nlp->sq[i];
+	nlp->mem_x = sq;
 	nlp->mem_y = notch;
-	nlp->sq[i] = notch + 1.0;  /* With 0 input vectors to codec,
+	notch += 1.0;		   /* With 0 input vectors to codec,
 				      kiss_fft() would take a long
 				      time to execute when running in
 				      real time.  Problem was traced
@@ -245,34 +270,31 @@ float nlp(
 				      this function. Adding this small
 				      constant fixed problem.  Not
 				      exactly sure why. */
-    }
 
-    for(i=m-n; i<m; i++) {	/* FIR filter vector */
+	nlp->mem_fir[pos] = nlp->mem_fir[pos+NLP_NTAP] = notch;
+	if (++pos == NLP_NTAP)
+	    pos = 0;
 
-	for(j=0; j<NLP_NTAP-1; j++)
-	    nlp->mem_fir[j] = nlp->mem_fir[j+1];
-	nlp->mem_fir[NLP_NTAP-1] = nlp->sq[i];
-
-	nlp->sq[i] = 0.0;
-	for(j=0; j<NLP_NTAP; j++)
-	    nlp->sq[i] += nlp->mem_fir[j]*nlp_fir[j];
+	if (!dec_only || (i % DEC) == 0)
+	    nlp->sq[i] = vec_dot(&nlp->mem_fir[pos], nlp_fir, NLP_NTAP);
     }
+    nlp->fir_pos = pos;
 
     /* Decimate and DFT */
 
-    for(i=0; i<PE_FFT_SIZE; i++) {
-	fw[i].real = 0.0;
-	fw[i].imag = 0.0;
-    }
-    for(i=0; i<m/DEC; i++) {
-	fw[i].real = nlp->sq[i*DEC]*(0.5 - 0.5*cos(2*PI*i/(m/DEC-1)));
-    }
+    for(i=0; i<m/DEC; i++)
+	fw[i] = nlp->sq[i*DEC]*nlp->w[i];
+    for(; i<PE_FFT_SIZE; i++)
+	fw[i] = 0.0;
     #ifdef DUMP
     dump_dec(Fw);
     #endif
 
-    kiss_fft(nlp->fft_cfg, (kiss_fft_cpx *)fw, (kiss_fft_cpx *)Fw);
-    for(i=0; i<PE_FFT_SIZE; i++)
+    /* fw[] is real so only the first half of the spectrum is needed,
+       the peak searches below stay well under PE_FFT_SIZE/2 */
+
+    kiss_fftr(nlp->fft_cfg, fw, (kiss_fft_cpx *)Fw);
+    for(i=0; i<=PE_FFT_SIZE/2; i++)
 	Fw[i].real = Fw[i].real*Fw[i].real + Fw[i].imag*Fw[i].imag;
 
     #ifdef DUMP
@@ -27,7 +27,6 @@
 
 #include "defines.h"
 #include "phase.h"
-#include "kiss_fft.h"
 #include "comp.h"
 #include "glottal.c"
 
@@ -44,21 +43,17 @@
   aks_to_H()
 
   Samples the complex LPC synthesis filter spectrum at the harmonic
-  frequencies.
+  frequencies, given A(exp(jw)) at FFT_ENC points from aks_to_M2().
 
 \*---------------------------------------------------------------------------*/
 
 void aks_to_H(
-              kiss_fft_cfg fft_fwd_cfg, 
 	      MODEL *model,	/* model parameters */
-	      float  aks[],	/* LPC's */
+	      COMP   Aw[],	/* LPC analysis filter spectrum */
 	      float  G,	        /* energy term */
-	      COMP   H[],	/* complex LPC spectral samples */
-	      int    order
+	      COMP   H[]	/* complex LPC spectral samples */
 )
 {
-  COMP  pw[FFT_ENC];	/* power spectrum (input) */
-  COMP  Pw[FFT_ENC];	/* power spectrum (output) */
   int   i,m;		/* loop variables */
   int   am,bm;		/* limits of current band */
   float r;		/* no. rads/bin */
@@ -69,18 +64,6 @@ void aks_to_H(
 
   r = TWO_PI/(FFT_ENC);
 
-  /* Determine DFT of A(exp(jw)) ------------------------------------------*/
-
-  for(i=0; i<FFT_ENC; i++) {
-    pw[i].real = 0.0;
-    pw[i].imag = 0.0;
-  }
-
-  for(i=0; i<=order; i++)
-    pw[i].real = aks[i];
-
-  kiss_fft(fft_fwd_cfg, (kiss_fft_cpx *)pw, (kiss_fft_cpx *)Pw);
-
   /* Sample magnitude and phase at harmonics */
 
   for(m=1; m<=model->L; m++) {
@@ -90,10 +73,10 @@ void aks_to_H(
 
     Em = 0.0;
     for(i=am; i<bm; i++)
-      Em += G/(Pw[i].real*Pw[i].real + Pw[i].imag*Pw[i].imag);
+      Em += G/(Aw[i].real*Aw[i].real + Aw[i].imag*Aw[i].imag);
     Am = sqrt(fabs(Em/(bm-am)));
 
-    phi_ = -atan2(Pw[b].imag,Pw[b].real);
+    phi_ = -atan2(Aw[b].imag,Aw[b].real);
     H[m].real = Am*cos(phi_);
     H[m].imag = Am*sin(phi_);
   }
@@ -191,11 +174,10 @@ void aks_to_H(
 \*---------------------------------------------------------------------------*/
 
 void phase_synth_zero_order(
-    kiss_fft_cfg fft_fwd_cfg,     
     MODEL *model,
-    float  aks[],
+    COMP   Aw[],                /* LPC spectrum from aks_to_M2()   */
     float *ex_phase,            /* excitation phase of fundamental */
-    int    order
+    unsigned long *seed         /* codec2_rand() state             */
 )
 {
   int   m;
@@ -209,7 +191,7 @@ void phase_synth_zero_order(
   int   b;
 
   G = 1.0;
-  aks_to_H(fft_fwd_cfg, model, aks, G, H, order);
+  aks_to_H(model, Aw, G, H);
 
   /* 
      Update excitation fundamental phase track, this sets the position
@@ -253,7 +235,7 @@ void phase_synth_zero_order(
 	   phase is not needed in the unvoiced case, but no harm in
 	   keeping it.
         */
-	float phi = TWO_PI*(float)rand()/RAND_MAX;
+	float phi = TWO_PI*(float)codec2_rand(seed)/CODEC2_RAND_MAX;
         Ex[m].real = cos(phi);
 	Ex[m].imag = sin(phi);
     }
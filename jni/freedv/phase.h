@@ -28,12 +28,11 @@
 #ifndef __PHASE__
 #define __PHASE__
 
-#include "kiss_fft.h"
+#include "comp.h"
 
-void phase_synth_zero_order(kiss_fft_cfg fft_dec_cfg, 
-			    MODEL *model, 
-			    float aks[], 
+void phase_synth_zero_order(MODEL *model, 
+			    COMP Aw[], 
                             float *ex_phase, 
-			    int order);
+			    unsigned long *seed);
 
 #endif
@@ -99,7 +99,8 @@
 
 void postfilter(
   MODEL *model,
-  float *bg_est
+  float *bg_est,
+  unsigned long *seed
 )	
 {
   int   m, uv;
@@ -129,7 +130,7 @@ void postfilter(
   if (model->voiced)
       for(m=1; m<=model->L; m++)
 	  if (20.0*log10(model->A[m]) < (*bg_est + BG_MARGIN)) {
-	      model->phi[m] = TWO_PI*(float)rand()/RAND_MAX;
+	      model->phi[m] = TWO_PI*(float)codec2_rand(seed)/CODEC2_RAND_MAX;
 	      uv++;
 	  }
 
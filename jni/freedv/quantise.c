@@ -36,7 +36,7 @@
 #include "quantise.h"
 #include "lpc.h"
 #include "lsp.h"
-#include "kiss_fft.h"
+#include "vec.h"
 
 #define LSP_DELTA1 0.01         /* grid spacing for LSP root searches */
 
@@ -84,6 +84,133 @@ void quantise_init()
 {
 }
 
+/*---------------------------------------------------------------------------*\
+
+  lsp_vq_split
+
+  Sorts index[0..n-1] into leaves of LSP_VQ_LEAF nearby codebook
+  entries, splitting at the median of the dimension with the largest
+  range until the leaves are small enough (a k-d tree).  n must be a
+  power of two.
+
+\*---------------------------------------------------------------------------*/
+
+static void lsp_vq_split(short index[], int n, const float cb[], int k)
+{
+    int   i, j, d;
+    short t;
+    float lo, hi, range;
+
+    if (n <= LSP_VQ_LEAF)
+	return;
+
+    d = 0; range = -1.0;
+    for(j=0; j<k; j++) {
+	lo = hi = cb[index[0]*k+j];
+	for(i=1; i<n; i++) {
+	    if (cb[index[i]*k+j] < lo) lo = cb[index[i]*k+j];
+	    if (cb[index[i]*k+j] > hi) hi = cb[index[i]*k+j];
+	}
+	if (hi - lo > range) {
+	    range = hi - lo;
+	    d = j;
+	}
+    }
+
+    /* insertion sort on dimension d, only run at init */
+
+    for(i=1; i<n; i++) {
+	t = index[i];
+	for(j=i; j>0 && cb[index[j-1]*k+d] > cb[t*k+d]; j--)
+	    index[j] = index[j-1];
+	index[j] = t;
+    }
+
+    lsp_vq_split(index, n/2, cb, k);
+    lsp_vq_split(&index[n/2], n/2, cb, k);
+}
+
+/*---------------------------------------------------------------------------*\
+
+  lsp_vq_init
+
+  Builds the search trees for the lsp_cbjvm[] codebooks used by
+  encode_lsps_vq().  Setting vq->exhaustive afterwards makes
+  encode_lsps_vq() search every entry instead, as a reference for
+  checks.
+
+\*---------------------------------------------------------------------------*/
+
+void lsp_vq_init(LSP_VQ *vq)
+{
+    LSP_VQ_TREE *tree;
+    float       *cbt[3], c;
+    int          s, i, j, k, l;
+
+    vq->exhaustive = 0;
+    cbt[0] = vq->cb1; cbt[1] = vq->cb2; cbt[2] = vq->cb3;
+    for(s=0; s<3; s++) {
+	tree = &vq->tree[s];
+	tree->k = k = lsp_cbjvm[s].k;
+	assert(lsp_cbjvm[s].m == LSP_VQ_M);
+	assert(k == (s ? LPC_ORD/2 : LPC_ORD));
+
+	for(i=0; i<LSP_VQ_M; i++)
+	    tree->index[i] = i;
+	lsp_vq_split(tree->index, LSP_VQ_M, lsp_cbjvm[s].cb, k);
+
+	/* leaf l holds entries l*LSP_VQ_LEAF.., stored dimension-major */
+
+	for(l=0; l<LSP_VQ_LEAVES; l++)
+	    for(j=0; j<k; j++) {
+		tree->lo[j*LSP_VQ_LEAVES+l] = 1E32;
+		tree->hi[j*LSP_VQ_LEAVES+l] = -1E32;
+		for(i=0; i<LSP_VQ_LEAF; i++) {
+		    c = lsp_cbjvm[s].cb[tree->index[l*LSP_VQ_LEAF+i]*k+j];
+		    cbt[s][(l*k + j)*LSP_VQ_LEAF + i] = c;
+		    if (c < tree->lo[j*LSP_VQ_LEAVES+l]) tree->lo[j*LSP_VQ_LEAVES+l] = c;
+		    if (c > tree->hi[j*LSP_VQ_LEAVES+l]) tree->hi[j*LSP_VQ_LEAVES+l] = c;
+		}
+	    }
+    }
+}
+
+/*---------------------------------------------------------------------------*\
+
+  lsp_vq_nearest
+
+  Returns the index of the entry of a lsp_vq_init() codebook nearest
+  x[] (weighted by w[] if not NULL).  Searches the leaf whose bounding
+  box is closest first, then only the leaves whose bounding boxes are
+  no further away than the best entry so far.  Returns the same index
+  as an exhaustive search.
+
+\*---------------------------------------------------------------------------*/
+
+static int lsp_vq_nearest(const LSP_VQ_TREE *tree, const float cbt[], float x[], float w[])
+{
+    float bnd[LSP_VQ_LEAVES], min_dist;
+    int   l, first, nearest, k;
+
+    k = tree->k;
+    vec_box_dist(bnd, tree->lo, tree->hi, LSP_VQ_LEAVES, x, w, k);
+    first = 0;
+    for(l=1; l<LSP_VQ_LEAVES; l++)
+	if (bnd[l] < bnd[first])
+	    first = l;
+
+    min_dist = 1E32;
+    nearest = 0;
+    vec_nearest_update(&cbt[first*k*LSP_VQ_LEAF], LSP_VQ_LEAF, x, w, k,
+		       &tree->index[first*LSP_VQ_LEAF], &min_dist, &nearest);
+    for(l=0; l<LSP_VQ_LEAVES; l++)
+	if ((l != first) && (bnd[l] <= min_dist))
+	    vec_nearest_update(&cbt[l*k*LSP_VQ_LEAF], LSP_VQ_LEAF, x, w, k,
+			       &tree->index[l*LSP_VQ_LEAF], &min_dist, &nearest);
+
+    return nearest;
+}
+
 /*---------------------------------------------------------------------------*\
 
   quantise
@@ -336,8 +463,6 @@ void lspjnd_quantise(float lsps[], float lsps_[], int order)
     //printf("\n");
 }
 
-void compute_weights(const float *x, float *w, int ndim);
-
 /*---------------------------------------------------------------------------*\
 									      
   lspdt_quantise
@@ -453,7 +578,7 @@ int find_nearest(const float *codebook, int nb_entries, float *x, int ndim)
   for (i=0;i<nb_entries;i++)
   {
     float dist=0;
-    for (j=0;j<ndim;j++)
+    for (j=0;j<ndim && dist<min_dist;j++)
       dist += (x[j]-codebook[i*ndim+j])*(x[j]-codebook[i*ndim+j]);
     if (dist<min_dist)
     {
@@ -473,7 +598,7 @@ int find_nearest_weighted(const float *codebook, int nb_entries, float *x, const
   for (i=0;i<nb_entries;i++)
   {
     float dist=0;
-    for (j=0;j<ndim;j++)
+    for (j=0;j<ndim && dist<min_dist;j++)
       dist += w[j]*(x[j]-codebook[i*ndim+j])*(x[j]-codebook[i*ndim+j]);
     if (dist<min_dist)
     {
@@ -525,6 +650,7 @@ void lspjvm_quantise(float *x, float *xq, int ndim)
 }
 
 #define MBEST_STAGES 4
+#define MBEST_MAX_M  256          /* largest lsp_cbvqanssi[] stage          */
 
 struct MBEST_LIST {
     int   index[MBEST_STAGES];    /* index of each stage that lead us to this error */
@@ -533,36 +659,20 @@ struct MBEST_LIST {
 
 struct MBEST {
     int                entries;   /* number of entries in mbest list   */
-    struct MBEST_LIST *list;
+    struct MBEST_LIST  list[MBEST_MAX];
 };
 
 
-static struct MBEST *mbest_create(int entries) {
+static void mbest_init(struct MBEST *mbest, int entries) {
     int           i,j;
-    struct MBEST *mbest;
-
-    assert(entries > 0);
-    mbest = (struct MBEST *)malloc(sizeof(struct MBEST));
-    assert(mbest != NULL);
 
+    assert((entries > 0) && (entries <= MBEST_MAX));
     mbest->entries = entries;
-    mbest->list = (struct MBEST_LIST *)malloc(entries*sizeof(struct MBEST_LIST));
-    assert(mbest->list != NULL);
-
     for(i=0; i<mbest->entries; i++) {
 	for(j=0; j<MBEST_STAGES; j++)
 	    mbest->list[i].index[j] = 0;
 	mbest->list[i].error = 1E32;
     }
-
-    return mbest;
-}
-
-
-static void mbest_destroy(struct MBEST *mbest) {
-    assert(mbest != NULL);
-    free(mbest->list);
-    free(mbest);
 }
 
 
@@ -572,28 +682,28 @@ static void mbest_destroy(struct MBEST *mbest) {
 
   Insert the results of a vector to codebook entry comparison. The
   list is ordered in order or error, so those entries with the
-  smallest error will be first on the list.
+  smallest error will be first on the list.  Errors no better than the
+  last entry are rejected with one compare, otherwise the entry is
+  shifted in from the end of the list, after any equal errors.
 
 \*---------------------------------------------------------------------------*/
 
 static void mbest_insert(struct MBEST *mbest, int index[], float error) {
-    int                i, j, found;
+    int                i, j;
     struct MBEST_LIST *list    = mbest->list;
-    int                entries = mbest->entries;
-
-    found = 0;
-    for(i=0; i<entries && !found; i++)
-	if (error < list[i].error) {
-	    found = 1;
-	    for(j=entries-1; j>i; j--)
-		list[j] = list[j-1];
-	    for(j=0; j<MBEST_STAGES; j++)
-		list[i].index[j] = index[j];
-	    list[i].error = error;
-	}
+
+    i = mbest->entries-1;
+    if (!(error < list[i].error))
+	return;
+    for(; i>0 && error < list[i-1].error; i--)
+	list[i] = list[i-1];
+    for(j=0; j<MBEST_STAGES; j++)
+	list[i].index[j] = index[j];
+    list[i].error = error;
 }
 
 
+#ifdef DUMP
 static void mbest_print(char title[], struct MBEST *mbest) {
     int i,j;
     
@@ -604,6 +714,7 @@ static void mbest_print(char title[], struct MBEST *mbest) {
 	printf(" %f\n", mbest->list[i].error);
     }
 }
+#endif
 
 
 /*---------------------------------------------------------------------------*\
@@ -625,18 +736,14 @@ static void mbest_search(
 		  int           index[] /* indexes that lead us here     */
 ) 
 {
-   float   e;
-   int     i,j;
-   float   diff;
+   float   e[MBEST_MAX_M];
+   int     j;
 
+   assert(m <= MBEST_MAX_M);
+   vec_wdist(e, cb, m, vec, w, k);
    for(j=0; j<m; j++) {
-	e = 0.0;
-	for(i=0; i<k; i++) {
-	    diff = cb[j*k+i]-vec[i];
-	    e += pow(diff*w[i],2.0);
-	}
 	index[0] = j;
-	mbest_insert(mbest, index, e);
+	mbest_insert(mbest, index, e[j]);
    }
 }
 
@@ -651,14 +758,14 @@ void lspanssi_quantise(float *x, float *xq, int ndim, int mbest_entries)
   const float *codebook2 = lsp_cbvqanssi[1].cb;
   const float *codebook3 = lsp_cbvqanssi[2].cb;
   const float *codebook4 = lsp_cbvqanssi[3].cb;
-  struct MBEST *mbest_stage1, *mbest_stage2, *mbest_stage3, *mbest_stage4;
+  struct MBEST mbest_stage1, mbest_stage2, mbest_stage3, mbest_stage4;
   float target[LPC_ORD];
   int   index[MBEST_STAGES];
 
-  mbest_stage1 = mbest_create(mbest_entries);
-  mbest_stage2 = mbest_create(mbest_entries);
-  mbest_stage3 = mbest_create(mbest_entries);
-  mbest_stage4 = mbest_create(mbest_entries);
+  mbest_init(&mbest_stage1, mbest_entries);
+  mbest_init(&mbest_stage2, mbest_entries);
+  mbest_init(&mbest_stage3, mbest_entries);
+  mbest_init(&mbest_stage4, mbest_entries);
   for(i=0; i<MBEST_STAGES; i++)
       index[i] = 0;
   
@@ -670,53 +777,56 @@ void lspanssi_quantise(float *x, float *xq, int ndim, int mbest_entries)
 
   /* Stage 1 */
 
-  mbest_search(codebook1, x, w, ndim, lsp_cbvqanssi[0].m, mbest_stage1, index);
-  mbest_print("Stage 1:", mbest_stage1);
+  mbest_search(codebook1, x, w, ndim, lsp_cbvqanssi[0].m, &mbest_stage1, index);
+  #ifdef DUMP
+  mbest_print("Stage 1:", &mbest_stage1);
+  #endif
 
   /* Stage 2 */
 
   for (j=0; j<mbest_entries; j++) {
-      index[1] = n1 = mbest_stage1->list[j].index[0];
+      index[1] = n1 = mbest_stage1.list[j].index[0];
       for(i=0; i<ndim; i++)
 	  target[i] = x[i] - codebook1[ndim*n1+i];
-      mbest_search(codebook2, target, w, ndim, lsp_cbvqanssi[1].m, mbest_stage2, index);      
+      mbest_search(codebook2, target, w, ndim, lsp_cbvqanssi[1].m, &mbest_stage2, index);      
   }
-  mbest_print("Stage 2:", mbest_stage2);
+  #ifdef DUMP
+  mbest_print("Stage 2:", &mbest_stage2);
+  #endif
 
   /* Stage 3 */
 
   for (j=0; j<mbest_entries; j++) {
-      index[2] = n1 = mbest_stage2->list[j].index[1];
-      index[1] = n2 = mbest_stage2->list[j].index[0];
+      index[2] = n1 = mbest_stage2.list[j].index[1];
+      index[1] = n2 = mbest_stage2.list[j].index[0];
       for(i=0; i<ndim; i++)
 	  target[i] = x[i] - codebook1[ndim*n1+i] - codebook2[ndim*n2+i];
-      mbest_search(codebook3, target, w, ndim, lsp_cbvqanssi[2].m, mbest_stage3, index);      
+      mbest_search(codebook3, target, w, ndim, lsp_cbvqanssi[2].m, &mbest_stage3, index);      
   }
-  mbest_print("Stage 3:", mbest_stage3);
+  #ifdef DUMP
+  mbest_print("Stage 3:", &mbest_stage3);
+  #endif
 
   /* Stage 4 */
 
   for (j=0; j<mbest_entries; j++) {
-      index[3] = n1 = mbest_stage3->list[j].index[2];
-      index[2] = n2 = mbest_stage3->list[j].index[1];
-      index[1] = n3 = mbest_stage3->list[j].index[0];
+      index[3] = n1 = mbest_stage3.list[j].index[2];
+      index[2] = n2 = mbest_stage3.list[j].index[1];
+      index[1] = n3 = mbest_stage3.list[j].index[0];
       for(i=0; i<ndim; i++)
 	  target[i] = x[i] - codebook1[ndim*n1+i] - codebook2[ndim*n2+i] - codebook3[ndim*n3+i];
-      mbest_search(codebook4, target, w, ndim, lsp_cbvqanssi[3].m, mbest_stage4, index);      
+      mbest_search(codebook4, target, w, ndim, lsp_cbvqanssi[3].m, &mbest_stage4, index);      
   }
-  mbest_print("Stage 4:", mbest_stage4);
+  #ifdef DUMP
+  mbest_print("Stage 4:", &mbest_stage4);
+  #endif
 
-  n1 = mbest_stage4->list[0].index[3];
-  n2 = mbest_stage4->list[0].index[2];
-  n3 = mbest_stage4->list[0].index[1];
-  n4 = mbest_stage4->list[0].index[0];
+  n1 = mbest_stage4.list[0].index[3];
+  n2 = mbest_stage4.list[0].index[2];
+  n3 = mbest_stage4.list[0].index[1];
+  n4 = mbest_stage4.list[0].index[0];
   for (i=0;i<ndim;i++)
       xq[i] = codebook1[ndim*n1+i] + codebook2[ndim*n2+i] + codebook3[ndim*n3+i] + codebook4[ndim*n4+i];
-
-  mbest_destroy(mbest_stage1);
-  mbest_destroy(mbest_stage2);
-  mbest_destroy(mbest_stage3);
-  mbest_destroy(mbest_stage4);
 }
 
 int check_lsp_order(float lsp[], int lpc_order)
@@ -872,6 +982,96 @@ float lpc_model_amplitudes(
 }
 #endif
 
+/*---------------------------------------------------------------------------*\
+                                                                         
+   lpc_spectrum_init()
+   lpc_spectrum()
+
+   Evaluates the LPC analysis filter A(exp(jw)) at the FFT_ENC bins.
+   Only the first order+1 of the FFT_ENC inputs are non-zero, so
+   instead of a full FFT the bins are split into LPC_SPEC_R
+   interleaved sets k = r + LPC_SPEC_R*q.  Each set is a LPC_SPEC_N
+   point DFT of ak[n]*exp(-j*2*pi*n*r/FFT_ENC), which is about a
+   quarter of the work of the full FFT.  ak[] is real, so sets past
+   LPC_SPEC_R/2 come from conjugate symmetry.
+
+\*---------------------------------------------------------------------------*/
+
+void lpc_spectrum_init(LPC_SPEC *spec)
+{
+    int r, n;
+
+    for(r=0; r<=LPC_SPEC_R/2; r++)
+	for(n=0; n<LPC_SPEC_N; n++) {
+	    spec->tw[r][n].real = cos(TWO_PI*n*r/FFT_ENC);
+	    spec->tw[r][n].imag = -sin(TWO_PI*n*r/FFT_ENC);
+	}
+    for(n=0; n<LPC_SPEC_N; n++) {
+	spec->w16[n].real = cos(TWO_PI*n/LPC_SPEC_N);
+	spec->w16[n].imag = -sin(TWO_PI*n/LPC_SPEC_N);
+    }
+}
+
+/* 4 point DFT of x[0], x[s], x[2s], x[3s] in place */
+
+static void dft4(COMP x[], int s)
+{
+    COMP t0, t1, t2, t3;
+
+    t0.real = x[0].real + x[2*s].real;   t0.imag = x[0].imag + x[2*s].imag;
+    t1.real = x[0].real - x[2*s].real;   t1.imag = x[0].imag - x[2*s].imag;
+    t2.real = x[s].real + x[3*s].real;   t2.imag = x[s].imag + x[3*s].imag;
+    t3.real = x[s].real - x[3*s].real;   t3.imag = x[s].imag - x[3*s].imag;
+
+    x[0].real   = t0.real + t2.real;     x[0].imag   = t0.imag + t2.imag;
+    x[2*s].real = t0.real - t2.real;     x[2*s].imag = t0.imag - t2.imag;
+    x[s].real   = t1.real + t3.imag;     x[s].imag   = t1.imag - t3.real;
+    x[3*s].real = t1.real - t3.imag;     x[3*s].imag = t1.imag + t3.real;
+}
+
+void lpc_spectrum(LPC_SPEC *spec, COMP A[], float ak[], int order)
+{
+    COMP  x[LPC_SPEC_N];
+    COMP *tw, w;
+    float re;
+    int   r, n, n2, q1, q2, k;
+
+    assert(order < LPC_SPEC_N);
+
+    for(r=0; r<=LPC_SPEC_R/2; r++) {
+	tw = spec->tw[r];
+	for(n=0; n<=order; n++) {
+	    x[n].real = ak[n]*tw[n].real;
+	    x[n].imag = ak[n]*tw[n].imag;
+	}
+	for(; n<LPC_SPEC_N; n++)
+	    x[n].real = x[n].imag = 0.0;
+
+	/* 16 point DFT as 4x4, n = 4*n1 + n2 in, q = q1 + 4*q2 out */
+
+	for(n2=0; n2<4; n2++)
+	    dft4(&x[n2], 4);
+	for(n2=1; n2<4; n2++)
+	    for(q1=1; q1<4; q1++) {
+		w = spec->w16[n2*q1];
+		re = x[4*q1+n2].real*w.real - x[4*q1+n2].imag*w.imag;
+		x[4*q1+n2].imag = x[4*q1+n2].real*w.imag + x[4*q1+n2].imag*w.real;
+		x[4*q1+n2].real = re;
+	    }
+	for(q1=0; q1<4; q1++) {
+	    dft4(&x[4*q1], 1);
+	    for(q2=0; q2<4; q2++)
+		A[r + LPC_SPEC_R*(q1 + 4*q2)] = x[4*q1+q2];
+	}
+    }
+
+    for(k=1; k<FFT_ENC; k++)
+	if ((k % LPC_SPEC_R) > LPC_SPEC_R/2) {
+	    A[k].real = A[FFT_ENC-k].real;
+	    A[k].imag = -A[FFT_ENC-k].imag;
+	}
+}
+
 /*---------------------------------------------------------------------------*\
                                                                          
    lpc_post_filter()
@@ -887,26 +1087,26 @@ float lpc_model_amplitudes(
    I used the Octave simulation lpcpf.m to get an understaing of the
    algorithm.
 
-   Requires two more FFTs which is significantly more MIPs.  However
-   it should be possible to implement this more efficiently in the
-   time domain.  Just not sure how to handle relative time delays
-   between the synthesis stage and updating these coeffs.  A smaller
-   FFT size might also be accetable to save CPU.  
+   Requires one more transform, of the weighting filter, which is
+   significantly more MIPs.  However it should be possible to
+   implement this more efficiently in the time domain.  Just not sure
+   how to handle relative time delays between the synthesis stage and
+   updating these coeffs.  A smaller FFT size might also be accetable
+   to save CPU.
 
    TODO:
    [ ] sync var names between Octave and C version
    [ ] doc gain normalisation
-   [ ] I think the first FFT is not rqd as we do the same
+   [X] I think the first FFT is not rqd as we do the same
        thing in aks_to_M2().
 
 \*---------------------------------------------------------------------------*/
 
-void lpc_post_filter(kiss_fft_cfg fft_fwd_cfg, MODEL *model, COMP Pw[], float ak[], 
+void lpc_post_filter(LPC_SPEC *spec, MODEL *model, COMP Pw[], COMP Aw[], float ak[], 
                      int order, int dump, float beta, float gamma, int bass_boost)
 {
     int   i;
-    COMP  x[FFT_ENC];   /* input to FFTs                */
-    COMP  Aw[FFT_ENC];  /* LPC analysis filter spectrum */	
+    float x[LPC_MAX+1]; /* weighting filter coeffs      */
     COMP  Ww[FFT_ENC];  /* weighting spectrum           */
     float Rw[FFT_ENC];  /* R = WA                       */
     float e_before, e_after, gain;
@@ -915,36 +1115,17 @@ void lpc_post_filter(kiss_fft_cfg fft_fwd_cfg, MODEL *model, COMP Pw[], float ak
     float range, thresh, r, w;
     int   m, bin;
 
-    /* Determine LPC inverse filter spectrum 1/A(exp(jw)) -----------*/
-
-    /* we actually want the synthesis filter A(exp(jw)) but the
-       inverse (analysis) filter is easier to find as it's FIR, we
-       just use the inverse of 1/A to get the synthesis filter
+    /* Aw[] is the LPC inverse filter spectrum 1/A(exp(jw)) from
+       aks_to_M2().  We actually want the synthesis filter A(exp(jw))
+       but the inverse (analysis) filter is easier to find as it's
+       FIR, we just use the inverse of 1/A to get the synthesis filter
        A(exp(jw)) */
 
-    for(i=0; i<FFT_ENC; i++) {
-	x[i].real = 0.0;
-	x[i].imag = 0.0; 
-    }
-    
-    for(i=0; i<=order; i++)
-	x[i].real = ak[i];
-    kiss_fft(fft_fwd_cfg, (kiss_fft_cpx *)x, (kiss_fft_cpx *)Aw);
-
-    for(i=0; i<FFT_ENC/2; i++) {
-	Aw[i].real = 1.0/sqrt(Aw[i].real*Aw[i].real + Aw[i].imag*Aw[i].imag);
-    }
-
     /* Determine weighting filter spectrum W(exp(jw)) ---------------*/
 
-    for(i=0; i<FFT_ENC; i++) {
-	x[i].real = 0.0;
-	x[i].imag = 0.0; 
-    }
-    
     for(i=0; i<=order; i++)
-	x[i].real = ak[i] * pow(gamma, (float)i);
-    kiss_fft(fft_fwd_cfg, (kiss_fft_cpx *)x, (kiss_fft_cpx *)Ww);
+	x[i] = ak[i] * pow(gamma, (float)i);
+    lpc_spectrum(spec, Ww, x, order);
 
     for(i=0; i<FFT_ENC/2; i++) {
 	Ww[i].real = sqrt(Ww[i].real*Ww[i].real + Ww[i].imag*Ww[i].imag);
@@ -954,7 +1135,7 @@ void lpc_post_filter(kiss_fft_cfg fft_fwd_cfg, MODEL *model, COMP Pw[], float ak
 
     max_Rw = 0.0; min_Rw = 1E32;
     for(i=0; i<FFT_ENC/2; i++) {
-	Rw[i] = Ww[i].real * Aw[i].real;
+	Rw[i] = Ww[i].real / sqrt(Aw[i].real*Aw[i].real + Aw[i].imag*Aw[i].imag);
 	if (Rw[i] > max_Rw)
 	    max_Rw = Rw[i];
 	if (Rw[i] < min_Rw)
@@ -1013,10 +1194,13 @@ void lpc_post_filter(kiss_fft_cfg fft_fwd_cfg, MODEL *model, COMP Pw[], float ak
    samples.  This function determines A(m) from the average energy per    
    band using an FFT.                                                     
                                                                         
+   If Aw is not NULL the LPC spectrum A(exp(jw)) is returned in it, so
+   the phase model can use it without another transform.
+
 \*---------------------------------------------------------------------------*/
 
 void aks_to_M2(
-  kiss_fft_cfg  fft_fwd_cfg, 
+  LPC_SPEC     *spec, 
   float         ak[],	     /* LPC's */
   int           order,
   MODEL        *model,	     /* sinusoidal model parameters for this frame */
@@ -1027,10 +1211,11 @@ void aks_to_M2(
   int           pf,          /* true to LPC post filter */
   int           bass_boost,  /* enable LPC filter 0-1khz 3dB boost */
   float         beta,
-  float         gamma        /* LPC post filter parameters */
+  float         gamma,       /* LPC post filter parameters */
+  COMP          Aw[]         /* FFT_ENC samples of A(exp(jw)) out, or NULL */
 )
 {
-  COMP pw[FFT_ENC];	/* input to FFT for power spectrum */
+  COMP Aw_[FFT_ENC];	/* A(exp(jw)) if the caller doesn't want it */
   COMP Pw[FFT_ENC];	/* output power spectrum */
   int i,m;		/* loop variables */
   int am,bm;		/* limits of current band */
@@ -1043,22 +1228,24 @@ void aks_to_M2(
 
   /* Determine DFT of A(exp(jw)) --------------------------------------------*/
 
-  for(i=0; i<FFT_ENC; i++) {
-    pw[i].real = 0.0;
-    pw[i].imag = 0.0; 
-  }
-
-  for(i=0; i<=order; i++)
-    pw[i].real = ak[i];
-  kiss_fft(fft_fwd_cfg, (kiss_fft_cpx *)pw, (kiss_fft_cpx *)Pw);
+  if (Aw == NULL)
+      Aw = Aw_;
+  lpc_spectrum(spec, Aw, ak, order);
 
   /* Determine power spectrum P(w) = E/(A(exp(jw))^2 ------------------------*/
 
   for(i=0; i<FFT_ENC/2; i++)
-    Pw[i].real = E/(Pw[i].real*Pw[i].real + Pw[i].imag*Pw[i].imag);
+    Pw[i].real = E/(Aw[i].real*Aw[i].real + Aw[i].imag*Aw[i].imag);
+
+  /* Only the band of the top harmonic reaches past FFT_ENC/2.  Those
+     bins have always been left holding A(exp(jw)) rather than P(w),
+     which keeps the top harmonic low, so keep that behaviour */
+
+  for(; i<FFT_ENC; i++)
+    Pw[i] = Aw[i];
 
   if (pf)
-      lpc_post_filter(fft_fwd_cfg, model, Pw, ak, order, dump, beta, gamma, bass_boost);
+      lpc_post_filter(spec, model, Pw, Aw, ak, order, dump, beta, gamma, bass_boost);
 
   #ifdef DUMP
   if (dump) 
@@ -1547,20 +1734,19 @@ void decode_lsps_diff_time(
   AUTHOR......: David Rowe			      
   DATE CREATED: 15 Feb 2012
 
-  Multi-stage VQ LSP quantiser developed by Jean-Marc Valin.
+  Multi-stage VQ LSP quantiser developed by Jean-Marc Valin.  vq holds
+  the codebooks from lsp_vq_init().
 
 \*---------------------------------------------------------------------------*/
 
-void encode_lsps_vq(int *indexes, float *x, float *xq, int ndim)
+void encode_lsps_vq(LSP_VQ *vq, int *indexes, float *x, float *xq, int ndim)
 {
   int i, n1, n2, n3;
   float err[LPC_ORD], err2[LPC_ORD], err3[LPC_ORD];
   float w[LPC_ORD], w2[LPC_ORD], w3[LPC_ORD];
   const float *codebook1 = lsp_cbjvm[0].cb;
-  const float *codebook2 = lsp_cbjvm[1].cb;
-  const float *codebook3 = lsp_cbjvm[2].cb;
 
-  assert(ndim <= LPC_ORD);
+  assert(ndim == LPC_ORD);
 
   w[0] = MIN(x[0], x[1]-x[0]);
   for (i=1;i<ndim-1;i++)
@@ -1569,7 +1755,10 @@ void encode_lsps_vq(int *indexes, float *x, float *xq, int ndim)
   
   compute_weights(x, w, ndim);
   
-  n1 = find_nearest(codebook1, lsp_cbjvm[0].m, x, ndim);
+  if (vq->exhaustive)
+    n1 = find_nearest(codebook1, LSP_VQ_M, x, ndim);
+  else
+    n1 = lsp_vq_nearest(&vq->tree[0], vq->cb1, x, NULL);
   
   for (i=0;i<ndim;i++)
   {
@@ -1583,8 +1772,13 @@ void encode_lsps_vq(int *indexes, float *x, float *xq, int ndim)
     w2[i] = w[2*i];  
     w3[i] = w[2*i+1];
   }
-  n2 = find_nearest_weighted(codebook2, lsp_cbjvm[1].m, err2, w2, ndim/2);
-  n3 = find_nearest_weighted(codebook3, lsp_cbjvm[2].m, err3, w3, ndim/2);
+  if (vq->exhaustive) {
+    n2 = find_nearest_weighted(lsp_cbjvm[1].cb, LSP_VQ_M, err2, w2, ndim/2);
+    n3 = find_nearest_weighted(lsp_cbjvm[2].cb, LSP_VQ_M, err3, w3, ndim/2);
+  } else {
+    n2 = lsp_vq_nearest(&vq->tree[1], vq->cb2, err2, w2);
+    n3 = lsp_vq_nearest(&vq->tree[2], vq->cb3, err3, w3);
+  }
   
   indexes[0] = n1;
   indexes[1] = n2;
@@ -1812,7 +2006,7 @@ float decode_energy(int index)
 
 \*---------------------------------------------------------------------------*/
 
-float decode_amplitudes(kiss_fft_cfg  fft_fwd_cfg, 
+float decode_amplitudes(LPC_SPEC *spec, 
 			MODEL *model, 
 			float  ak[],
 		        int    lsp_indexes[], 
@@ -26,7 +26,7 @@
 #ifndef __QUANTISE__
 #define __QUANTISE__
 
-#include "kiss_fft.h"
+#include "comp.h"
 
 #define WO_BITS     7
 #define WO_LEVELS   (1<<WO_BITS)
@@ -52,12 +52,51 @@
 #define LPCPF_GAMMA 0.5
 #define LPCPF_BETA  0.2
 
+#define MBEST_MAX   16  /* max mbest_entries for lspanssi_quantise() */
+
+#define LPC_SPEC_N  16                   /* DFT size, max LPC order + 1      */
+#define LPC_SPEC_R  (FFT_ENC/LPC_SPEC_N) /* interleaved DFTs making up A(w)  */
+
+/* Twiddles for lpc_spectrum() */
+
+typedef struct {
+    COMP tw[LPC_SPEC_R/2+1][LPC_SPEC_N]; /* exp(-j*2*pi*n*r/FFT_ENC)         */
+    COMP w16[LPC_SPEC_N];                /* exp(-j*2*pi*n/LPC_SPEC_N)        */
+} LPC_SPEC;
+
+#define LSP_VQ_M      512                  /* entries in each lsp_cbjvm[] stage */
+#define LSP_VQ_LEAF   16                   /* entries per leaf of the search tree */
+#define LSP_VQ_LEAVES (LSP_VQ_M/LSP_VQ_LEAF)
+
+/* lsp_cbjvm[] codebooks arranged for lsp_vq_nearest().  Each stage is
+   split by a k-d tree into leaves of nearby entries, each leaf stored
+   dimension-major with its bounding box, so a search can skip leaves
+   that can't hold the nearest entry */
+
+typedef struct {
+    int   k;                               /* vector dimension                 */
+    float lo[LPC_ORD*LSP_VQ_LEAVES];       /* leaf bounding boxes, dim-major   */
+    float hi[LPC_ORD*LSP_VQ_LEAVES];
+    short index[LSP_VQ_M];                 /* codebook index of each entry     */
+} LSP_VQ_TREE;
+
+typedef struct {
+    LSP_VQ_TREE tree[3];
+    float cb1[LPC_ORD*LSP_VQ_M];           /* stage 1, all LSPs                */
+    float cb2[LPC_ORD/2*LSP_VQ_M];         /* stage 2, even LSPs               */
+    float cb3[LPC_ORD/2*LSP_VQ_M];         /* stage 3, odd LSPs                */
+    int   exhaustive;                      /* search lsp_cbjvm[] entry by entry */
+} LSP_VQ;
+
 void quantise_init();
+void lsp_vq_init(LSP_VQ *vq);
 float lpc_model_amplitudes(float Sn[], float w[], MODEL *model, int order,
 			   int lsp,float ak[]);
-void aks_to_M2(kiss_fft_cfg fft_fwd_cfg, float ak[], int order, MODEL *model, 
+void lpc_spectrum_init(LPC_SPEC *spec);
+void lpc_spectrum(LPC_SPEC *spec, COMP A[], float ak[], int order);
+void aks_to_M2(LPC_SPEC *spec, float ak[], int order, MODEL *model, 
 	       float E, float *snr, int dump, int sim_pf, 
-               int pf, int bass_boost, float beta, float gamma);
+               int pf, int bass_boost, float beta, float gamma, COMP Aw[]);
 
 int   encode_Wo(float Wo);
 float decode_Wo(int index);
@@ -78,10 +117,13 @@ void decode_lsps_diff_time(float lsp_[],
 			   float lsp__prev[],
 			   int order);
 
-void encode_lsps_vq(int *indexes, float *x, float *xq, int ndim);
+void encode_lsps_vq(LSP_VQ *vq, int *indexes, float *x, float *xq, int ndim);
 void decode_lsps_vq(int *indexes, float *xq, int ndim);
 
 long quantise(const float * cb, float vec[], float w[], int k, int m, float *se);
+void compute_weights(const float *x, float *w, int ndim);
+int find_nearest(const float *codebook, int nb_entries, float *x, int ndim);
+int find_nearest_weighted(const float *codebook, int nb_entries, float *x, const float *w, int ndim);
 void lspvq_quantise(float lsp[], float lsp_[], int order); 
 void lspjnd_quantise(float lsp[], float lsp_[], int order);
 void lspdt_quantise(float lsps[], float lsps_[], float lsps__prev[], int mode);
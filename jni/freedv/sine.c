@@ -34,10 +34,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <assert.h>
 
 #include "defines.h"
 #include "sine.h"
-#include "kiss_fft.h"
+#include "kiss_fftr.h"
+#include "vec.h"
 
 #define HPF_BETA 0.125
 
@@ -47,7 +49,7 @@
                                                                              
 \*---------------------------------------------------------------------------*/
 
-void hs_pitch_refinement(MODEL *model, COMP Sw[], float pmin, float pmax, 
+void hs_pitch_refinement(MODEL *model, float Pw[], float pmin, float pmax, 
 			 float pstep);
 
 /*---------------------------------------------------------------------------*\
@@ -66,10 +68,10 @@ void hs_pitch_refinement(MODEL *model, COMP Sw[], float pmin, float pmax,
 
 \*---------------------------------------------------------------------------*/
 
-void make_analysis_window(kiss_fft_cfg fft_fwd_cfg, float w[], COMP W[])
+void make_analysis_window(kiss_fftr_cfg fft_fwd_cfg, float w[], COMP W[])
 {
   float m;
-  COMP  wshift[FFT_ENC];
+  float wshift[FFT_ENC];
   COMP  temp;
   int   i,j;
 
@@ -123,16 +125,18 @@ void make_analysis_window(kiss_fft_cfg fft_fwd_cfg, float w[], COMP W[])
        NW/2              NW/2
   */
 
-  for(i=0; i<FFT_ENC; i++) {
-    wshift[i].real = 0.0;
-    wshift[i].imag = 0.0;
-  }
+  for(i=0; i<FFT_ENC; i++)
+    wshift[i] = 0.0;
   for(i=0; i<NW/2; i++)
-    wshift[i].real = w[i+M/2];
+    wshift[i] = w[i+M/2];
   for(i=FFT_ENC-NW/2,j=M/2-NW/2; i<FFT_ENC; i++,j++)
-   wshift[i].real = w[j];
+   wshift[i] = w[j];
 
-  kiss_fft(fft_fwd_cfg, (kiss_fft_cpx *)wshift, (kiss_fft_cpx *)W);
+  kiss_fftr(fft_fwd_cfg, wshift, (kiss_fft_cpx *)W);
+  for(i=1; i<FFT_ENC/2; i++) {
+    W[FFT_ENC-i].real = W[i].real;
+    W[FFT_ENC-i].imag = -W[i].imag;
+  }
 
   /* 
       Re-arrange W[] to be symmetrical about FFT_ENC/2.  Makes later 
@@ -199,15 +203,13 @@ float hpf(float x, float states[])
 
 \*---------------------------------------------------------------------------*/
 
-void dft_speech(kiss_fft_cfg fft_fwd_cfg, COMP Sw[], float Sn[], float w[])
+void dft_speech(kiss_fftr_cfg fft_fwd_cfg, COMP Sw[], float Sn[], float w[])
 {
-  int  i;
-  COMP sw[FFT_ENC];
+  int   i;
+  float sw[FFT_ENC];
 
-  for(i=0; i<FFT_ENC; i++) {
-    sw[i].real = 0.0;
-    sw[i].imag = 0.0;
-  }
+  for(i=0; i<FFT_ENC; i++)
+    sw[i] = 0.0;
 
   /* Centre analysis window on time axis, we need to arrange input
      to FFT this way to make FFT phases correct */
@@ -215,14 +217,79 @@ void dft_speech(kiss_fft_cfg fft_fwd_cfg, COMP Sw[], float Sn[], float w[])
   /* move 2nd half to start of FFT input vector */
 
   for(i=0; i<NW/2; i++)
-    sw[i].real = Sn[i+M/2]*w[i+M/2];
+    sw[i] = Sn[i+M/2]*w[i+M/2];
 
   /* move 1st half to end of FFT input vector */
 
   for(i=0; i<NW/2; i++)
-    sw[FFT_ENC-NW/2+i].real = Sn[i+M/2-NW/2]*w[i+M/2-NW/2];
+    sw[FFT_ENC-NW/2+i] = Sn[i+M/2-NW/2]*w[i+M/2-NW/2];
+
+  /* Only the first half comes out of the real FFT.  The top
+     harmonic can reach a few bins past FFT_ENC/2, so the rest is
+     filled in from conjugate symmetry */
+
+  kiss_fftr(fft_fwd_cfg, sw, (kiss_fft_cpx *)Sw);
+  for(i=1; i<FFT_ENC/2; i++) {
+    Sw[FFT_ENC-i].real = Sw[i].real;
+    Sw[FFT_ENC-i].imag = -Sw[i].imag;
+  }
+}
+
+/*---------------------------------------------------------------------------*\
+                                                                     
+  FUNCTION....: harm_map_power
 
-  kiss_fft(fft_fwd_cfg, (kiss_fft_cpx *)sw, (kiss_fft_cpx *)Sw);
+  Fills in the energy of each DFT bin of Sw[], which the pitch
+  refinement and amplitude estimation read many times per frame.
+
+\*---------------------------------------------------------------------------*/
+
+void harm_map_power(HARM_MAP *hm, COMP Sw[])
+{
+  int i;
+
+  for(i=0; i<=FFT_ENC/2; i++)
+    hm->Pw[i] = Sw[i].real*Sw[i].real + Sw[i].imag*Sw[i].imag;
+  for(i=1; i<FFT_ENC/2; i++)
+    hm->Pw[FFT_ENC-i] = hm->Pw[i];
+  hm->L = 0;
+}
+
+/*---------------------------------------------------------------------------*\
+                                                                     
+  FUNCTION....: harm_map_bands
+
+  Works out the harmonic centre bins and band limits for the refined
+  pitch in model.  Expressions are the same as the ones previously
+  repeated in estimate_amplitudes() and est_voicing_mbe(), evaluated
+  once per harmonic.  Band m ends where band m+1 starts, so only the
+  edges are stored.  The arguments are never negative, so a cast
+  stands in for floor() and ceil() is a cast plus a compare.
+
+\*---------------------------------------------------------------------------*/
+
+void harm_map_bands(HARM_MAP *hm, MODEL *model)
+{
+  int    m;
+  float  r = TWO_PI/FFT_ENC;	/* number of rads/bin */
+  double x;
+
+  assert(model->L <= MAX_AMP);
+  hm->L = model->L;
+
+  for(m=1; m<=model->L; m++)
+    hm->b[m] = m*model->Wo/r + 0.5;
+  for(m=1; m<=model->L+1; m++)
+    hm->edge[m] = (m - 0.5)*model->Wo/r + 0.5;
+
+  for(m=1; m<=model->L/4+1; m++) {
+    x = (m - 0.5)*model->Wo*FFT_ENC/TWO_PI;
+    hm->vedge[m] = x;
+    if (hm->vedge[m] < x)
+      hm->vedge[m]++;
+  }
+  for(m=1; m<=model->L/4; m++)
+    hm->vc[m] = m*model->Wo*FFT_ENC/TWO_PI;
 }
 
 /*---------------------------------------------------------------------------*\
@@ -236,7 +303,7 @@ void dft_speech(kiss_fft_cfg fft_fwd_cfg, COMP Sw[], float Sn[], float w[])
 
 \*---------------------------------------------------------------------------*/
 
-void two_stage_pitch_refinement(MODEL *model, COMP Sw[])
+void two_stage_pitch_refinement(MODEL *model, HARM_MAP *hm)
 {
   float pmin,pmax,pstep;	/* pitch refinment minimum, maximum and step */ 
 
@@ -245,14 +312,14 @@ void two_stage_pitch_refinement(MODEL *model, COMP Sw[])
   pmax = TWO_PI/model->Wo + 5;
   pmin = TWO_PI/model->Wo - 5;
   pstep = 1.0;
-  hs_pitch_refinement(model,Sw,pmin,pmax,pstep);
+  hs_pitch_refinement(model,hm->Pw,pmin,pmax,pstep);
   
   /* Fine refinement */
   
   pmax = TWO_PI/model->Wo + 1;
   pmin = TWO_PI/model->Wo - 1;
   pstep = 0.25;
-  hs_pitch_refinement(model,Sw,pmin,pmax,pstep);
+  hs_pitch_refinement(model,hm->Pw,pmin,pmax,pstep);
   
   /* Limit range */
   
@@ -272,21 +339,25 @@ void two_stage_pitch_refinement(MODEL *model, COMP Sw[])
 									  
  Harmonic sum pitch refinement function.			   
 									    
+ Pw     energy of each DFT bin
  pmin   pitch search range minimum	    
  pmax	pitch search range maximum	    
  step   pitch search step size		    
  model	current pitch estimate in model.Wo  
 									    
  model 	refined pitch estimate in model.Wo  
+
+ The harmonic sums for four candidate pitches are found at once with
+ vec_harm_energy(), which rounds harmonics to bins in float rather
+ than double, so is not strictly bit exact with the original.
 									     
 \*---------------------------------------------------------------------------*/
 
-void hs_pitch_refinement(MODEL *model, COMP Sw[], float pmin, float pmax, float pstep)
+void hs_pitch_refinement(MODEL *model, float Pw[], float pmin, float pmax, float pstep)
 {
-  int m;		/* loop variable */
-  int b;		/* bin for current harmonic centre */
-  float E;		/* energy for current pitch*/
-  float Wo;		/* current "test" fundamental freq. */
+  int k,n;		/* loop variables */
+  float E[4];		/* energy for each "test" fundamental */
+  float Wo[4];		/* current "test" fundamental freqs. */
   float Wom;		/* Wo that maximises E */
   float Em;		/* mamimum energy */
   float r;		/* number of rads/bin */
@@ -301,23 +372,22 @@ void hs_pitch_refinement(MODEL *model, COMP Sw[], float pmin, float pmax, float
   
   /* Determine harmonic sum for a range of Wo values */
 
-  for(p=pmin; p<=pmax; p+=pstep) {
-    E = 0.0;
-    Wo = TWO_PI/p;
-
-    /* Sum harmonic magnitudes */
+  p = pmin;
+  while(p <= pmax) {
+    for(n=0; n<4 && p<=pmax; n++, p+=pstep)
+      Wo[n] = TWO_PI/p;
+    for(k=n; k<4; k++)
+      Wo[k] = Wo[0];
 
-    for(m=1; m<=model->L; m++) {
-      b = floor(m*Wo/r + 0.5);
-      E += Sw[b].real*Sw[b].real + Sw[b].imag*Sw[b].imag;
-    }  
+    vec_harm_energy(E, Pw, Wo, r, model->L);
 
     /* Compare to see if this is a maximum */
     
-    if (E > Em) {
-      Em = E;
-      Wom = Wo;
-    }
+    for(k=0; k<n; k++)
+      if (E[k] > Em) {
+	Em = E[k];
+	Wom = Wo[k];
+      }
   }
 
   model->Wo = Wom;
@@ -329,38 +399,27 @@ void hs_pitch_refinement(MODEL *model, COMP Sw[], float pmin, float pmax, float
   AUTHOR......: David Rowe		
   DATE CREATED: 27/5/94			       
 									      
-  Estimates the complex amplitudes of the harmonics.    
+  Estimates the complex amplitudes of the harmonics, using the band
+  limits in hm for the current model.
 									      
 \*---------------------------------------------------------------------------*/
 
-void estimate_amplitudes(MODEL *model, COMP Sw[], COMP W[])
+void estimate_amplitudes(MODEL *model, COMP Sw[], HARM_MAP *hm)
 {
   int   i,m;		/* loop variables */
-  int   am,bm;		/* bounds of current harmonic */
   int   b;		/* DFT bin of centre of current harmonic */
   float den;		/* denominator of amplitude expression */
-  float r;		/* number of rads/bin */
-  int   offset;
-  COMP  Am;
 
-  r = TWO_PI/FFT_ENC;
+  assert(hm->L == model->L);
 
   for(m=1; m<=model->L; m++) {
-    den = 0.0;
-    am = floor((m - 0.5)*model->Wo/r + 0.5);
-    bm = floor((m + 0.5)*model->Wo/r + 0.5);
-    b = floor(m*model->Wo/r + 0.5);
+    b = hm->b[m];
 
     /* Estimate ampltude of harmonic */
 
     den = 0.0;
-    Am.real = Am.imag = 0.0;
-    for(i=am; i<bm; i++) {
-      den += Sw[i].real*Sw[i].real + Sw[i].imag*Sw[i].imag;
-      offset = i + FFT_ENC/2 - floor(m*model->Wo/r + 0.5);
-      Am.real += Sw[i].real*W[offset].real;
-      Am.imag += Sw[i].imag*W[offset].real;
-    }
+    for(i=hm->edge[m]; i<hm->edge[m+1]; i++)
+      den += hm->Pw[i];
 
     model->A[m] = sqrt(den);
 
@@ -385,6 +444,7 @@ float est_voicing_mbe(
     MODEL *model,
     COMP   Sw[],
     COMP   W[],
+    HARM_MAP *hm,         /* band limits for model                 */
     COMP   Sw_[],         /* DFT of all voiced synthesised signal  */
                           /* useful for debugging/dump file        */
     COMP   Ew[],          /* DFT of error                          */
@@ -395,7 +455,6 @@ float est_voicing_mbe(
     int   offset;         /* centers Hw[] about current harmonic */
     float den;            /* denominator of Am expression */
     float error;          /* accumulated error between original and synthesised */
-    float Wo;            
     float sig, snr;
     float elow, ehigh, eratio;
     float dF0, sixty;
@@ -411,7 +470,7 @@ float est_voicing_mbe(
 	Ew[i].imag = 0.0;
     }
 
-    Wo = model->Wo;
+    assert(hm->L == model->L);
     error = 1E-4;
 
     /* Just test across the harmonics in the first 1000 Hz (L/4) */
@@ -420,13 +479,13 @@ float est_voicing_mbe(
 	Am.real = 0.0;
 	Am.imag = 0.0;
 	den = 0.0;
-	al = ceil((l - 0.5)*Wo*FFT_ENC/TWO_PI);
-	bl = ceil((l + 0.5)*Wo*FFT_ENC/TWO_PI);
+	al = hm->vedge[l];
+	bl = hm->vedge[l+1];
 
 	/* Estimate amplitude of harmonic assuming harmonic is totally voiced */
 
 	for(m=al; m<bl; m++) {
-	    offset = FFT_ENC/2 + m - l*Wo*FFT_ENC/TWO_PI + 0.5;
+	    offset = FFT_ENC/2 + m - hm->vc[l] + 0.5;
 	    Am.real += Sw[m].real*W[offset].real + Sw[m].imag*W[offset].imag;
 	    Am.imag += Sw[m].imag*W[offset].real - Sw[m].real*W[offset].imag;
 	    den += W[offset].real*W[offset].real + W[offset].imag*W[offset].imag;
@@ -438,7 +497,7 @@ float est_voicing_mbe(
         /* Determine error between estimated harmonic and original */
 
         for(m=al; m<bl; m++) {
-	    offset = FFT_ENC/2 + m - l*Wo*FFT_ENC/TWO_PI + 0.5;
+	    offset = FFT_ENC/2 + m - hm->vc[l] + 0.5;
 	    Sw_[m].real = Am.real*W[offset].real - Am.imag*W[offset].imag;
 	    Sw_[m].imag = Am.real*W[offset].imag + Am.imag*W[offset].real;
 	    Ew[m].real = Sw[m].real - Sw_[m].real;
@@ -557,7 +616,7 @@ void make_synthesis_window(float Pn[])
 \*---------------------------------------------------------------------------*/
 
 void synthesise(
-  kiss_fft_cfg fft_inv_cfg, 
+  kiss_fftr_cfg fft_inv_cfg, 
   float  Sn_[],		/* time domain synthesised signal              */
   MODEL *model,		/* ptr to model parameters for this frame      */
   float  Pn[],		/* time domain Parzen window                   */
@@ -565,8 +624,8 @@ void synthesise(
 )
 {
     int   i,l,j,b;	/* loop variables */
-    COMP  Sw_[FFT_DEC];	/* DFT of synthesised signal */
-    COMP  sw_[FFT_DEC];	/* synthesised signal */
+    COMP  Sw_[FFT_DEC/2+1]; /* DFT of synthesised signal, positive freqs */
+    float sw_[FFT_DEC];	/* synthesised signal */
 
     if (shift) {
 	/* Update memories */
@@ -577,7 +636,7 @@ void synthesise(
 	Sn_[N-1] = 0.0;
     }
 
-    for(i=0; i<FFT_DEC; i++) {
+    for(i=0; i<=FFT_DEC/2; i++) {
 	Sw_[i].real = 0.0;
 	Sw_[i].imag = 0.0;
     }
@@ -608,13 +667,12 @@ void synthesise(
 	}
 	Sw_[b].real = model->A[l]*cos(model->phi[l]);
 	Sw_[b].imag = model->A[l]*sin(model->phi[l]);
-	Sw_[FFT_DEC-b].real = Sw_[b].real;
-	Sw_[FFT_DEC-b].imag = -Sw_[b].imag;
     }
 
-    /* Perform inverse DFT */
+    /* Perform inverse DFT, the negative frequencies are implied by
+       the real output so only half the spectrum is set up */
 
-    kiss_fft(fft_inv_cfg, (kiss_fft_cpx *)Sw_, (kiss_fft_cpx *)sw_);
+    kiss_fftri(fft_inv_cfg, (kiss_fft_cpx *)Sw_, sw_);
 #else
     /*
        Direct time domain synthesis using the cos() function.  Works
@@ -623,26 +681,130 @@ void synthesise(
        could be simplified as we don't need to synthesise where Pn[]
        is zero.
     */
+    for(i=0; i<FFT_DEC; i++)
+	sw_[i] = 0.0;
     for(l=1; l<=model->L; l++) {
 	for(i=0,j=-N+1; i<N-1; i++,j++) {
-	    Sw_[FFT_DEC-N+1+i].real += 2.0*model->A[l]*cos(j*model->Wo*l + model->phi[l]);
+	    sw_[FFT_DEC-N+1+i] += 2.0*model->A[l]*cos(j*model->Wo*l + model->phi[l]);
 	}
  	for(i=N-1,j=0; i<2*N; i++,j++)
-	    Sw_[j].real += 2.0*model->A[l]*cos(j*model->Wo*l + model->phi[l]);
+	    sw_[j] += 2.0*model->A[l]*cos(j*model->Wo*l + model->phi[l]);
     }	
 #endif
 
     /* Overlap add to previous samples */
 
     for(i=0; i<N-1; i++) {
-	Sn_[i] += sw_[FFT_DEC-N+1+i].real*Pn[i];
+	Sn_[i] += sw_[FFT_DEC-N+1+i]*Pn[i];
     }
 
     if (shift)
 	for(i=N-1,j=0; i<2*N; i++,j++)
-	    Sn_[i] = sw_[j].real*Pn[i];
+	    Sn_[i] = sw_[j]*Pn[i];
     else
 	for(i=N-1,j=0; i<2*N; i++,j++)
-	    Sn_[i] += sw_[j].real*Pn[i];
+	    Sn_[i] += sw_[j]*Pn[i];
 }
 
+
+/*---------------------------------------------------------------------------*\
+                                                       
+  FUNCTION....: make_osc_table	     
+
+  Init function for synthesise_osc(), cos_tab[k] = cos(2*pi*k/FFT_DEC).
+
+\*---------------------------------------------------------------------------*/
+
+void make_osc_table(float cos_tab[])
+{
+    int i;
+
+    for(i=0; i<FFT_DEC; i++)
+	cos_tab[i] = cos(TWO_PI*i/FFT_DEC);
+}
+
+/*---------------------------------------------------------------------------*\
+                                                                             
+  FUNCTION....: synthesise_osc 			      
+									      
+  Alternative to synthesise() that skips the FFT_DEC point inverse
+  FFT.  Each harmonic drives a second order recursive oscillator
+
+    y[n] = 2cos(w)y[n-1] - y[n-2]
+
+  that only generates the 2N samples the overlap-add needs.  The
+  harmonics are kept on the same FFT_DEC bin grid as synthesise(), so
+  the two produce the same signal apart from float rounding.  Cheapest
+  for small L (high pitched speakers), about the same as the FFT at
+  L=MAX_AMP.
+									      
+\*---------------------------------------------------------------------------*/
+
+void synthesise_osc(
+  float  cos_tab[],	/* from make_osc_table()                       */
+  float  Sn_[],		/* time domain synthesised signal              */
+  MODEL *model,		/* ptr to model parameters for this frame      */
+  float  Pn[],		/* time domain Parzen window                   */
+  int    shift          /* flag used to handle transition frames       */
+)
+{
+    int   i,l,b,prev_b,nh;
+    float c[MAX_AMP], y1[MAX_AMP], y2[MAX_AMP]; /* oscillator coeffs and states */
+    float sw_[2*N];	/* synthesised signal, n = -(N-1)..N           */
+    float re,im;
+    unsigned int k;
+
+    if (shift) {
+	/* Update memories */
+
+	for(i=0; i<N-1; i++) {
+	    Sn_[i] = Sn_[i+N];
+	}
+	Sn_[N-1] = 0.0;
+    }
+
+    /* Set up one oscillator per occupied bin.  As in synthesise(), when
+       two harmonics round to the same bin the last one wins.  The states
+       are the outputs at n = -N and n = -(N+1), so the first sample out
+       of the oscillator is n = -(N-1).  Bin phase rotations come from
+       cos_tab[], indexes are taken mod FFT_DEC, and sin(x) is
+       cos(x - pi/2). */
+
+    nh = 0;
+    prev_b = -1;
+    for(l=1; l<=model->L; l++) {
+	b = floor(l*model->Wo*FFT_DEC/TWO_PI + 0.5);
+	if (b > ((FFT_DEC/2)-1)) {
+		b = (FFT_DEC/2)-1;
+	}
+	if (b == prev_b)
+	    nh--;
+	prev_b = b;
+
+	re = 2.0*model->A[l]*cosf(model->phi[l]);
+	im = 2.0*model->A[l]*sinf(model->phi[l]);
+	c[nh] = 2.0*cos_tab[b];
+	k = -N*b;
+	y1[nh] = re*cos_tab[k & (FFT_DEC-1)] - im*cos_tab[(k - FFT_DEC/4) & (FFT_DEC-1)];
+	k -= b;
+	y2[nh] = re*cos_tab[k & (FFT_DEC-1)] - im*cos_tab[(k - FFT_DEC/4) & (FFT_DEC-1)];
+	nh++;
+    }
+    for(; nh & 15; nh++)
+	c[nh] = y1[nh] = y2[nh] = 0.0;
+
+    vec_resonate(sw_, 2*N, c, y1, y2, nh);
+
+    /* Overlap add to previous samples */
+
+    for(i=0; i<N-1; i++) {
+	Sn_[i] += sw_[i]*Pn[i];
+    }
+
+    if (shift)
+	for(i=N-1; i<2*N; i++)
+	    Sn_[i] = sw_[i]*Pn[i];
+    else
+	for(i=N-1; i<2*N; i++)
+	    Sn_[i] += sw_[i]*Pn[i];
+}
@@ -30,16 +30,34 @@
 
 #include "defines.h"
 #include "comp.h"
-#include "kiss_fft.h"
-
-void make_analysis_window(kiss_fft_cfg fft_fwd_cfg, float w[], COMP W[]);
+#include "kiss_fftr.h"
+
+/* Per frame cache of the spectrum energies and harmonic band limits
+   shared by the analysis functions below.  harm_map_power() fills
+   Pw[] once Sw[] is known, harm_map_bands() the band limits once the
+   pitch has been refined. */
+
+typedef struct {
+    float  Pw[FFT_ENC];        /* |Sw[k]|^2                                  */
+    int    L;                  /* harmonics covered by the bands below      */
+    short  b[MAX_AMP+1];       /* centre bin of each harmonic               */
+    short  edge[MAX_AMP+2];    /* harmonic m covers bins edge[m]..edge[m+1]-1 */
+    short  vedge[MAX_AMP/4+2]; /* same for est_voicing_mbe(), first L/4     */
+    double vc[MAX_AMP/4+1];    /* centre of those harmonics in bins         */
+} HARM_MAP;
+
+void make_analysis_window(kiss_fftr_cfg fft_fwd_cfg, float w[], COMP W[]);
 float hpf(float x, float states[]);
-void dft_speech(kiss_fft_cfg fft_fwd_cfg, COMP Sw[], float Sn[], float w[]);
-void two_stage_pitch_refinement(MODEL *model, COMP Sw[]);
-void estimate_amplitudes(MODEL *model, COMP Sw[], COMP W[]);
-float est_voicing_mbe(MODEL *model, COMP Sw[], COMP W[], COMP Sw_[],COMP Ew[], 
+void dft_speech(kiss_fftr_cfg fft_fwd_cfg, COMP Sw[], float Sn[], float w[]);
+void harm_map_power(HARM_MAP *hm, COMP Sw[]);
+void harm_map_bands(HARM_MAP *hm, MODEL *model);
+void two_stage_pitch_refinement(MODEL *model, HARM_MAP *hm);
+void estimate_amplitudes(MODEL *model, COMP Sw[], HARM_MAP *hm);
+float est_voicing_mbe(MODEL *model, COMP Sw[], COMP W[], HARM_MAP *hm, COMP Sw_[],COMP Ew[], 
 		      float prev_Wo);
 void make_synthesis_window(float Pn[]);
-void synthesise(kiss_fft_cfg fft_inv_cfg, float Sn_[], MODEL *model, float Pn[], int shift);
+void synthesise(kiss_fftr_cfg fft_inv_cfg, float Sn_[], MODEL *model, float Pn[], int shift);
+void make_osc_table(float cos_tab[]);
+void synthesise_osc(float cos_tab[], float Sn_[], MODEL *model, float Pn[], int shift);
 
 #endif
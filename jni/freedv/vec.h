@@ -0,0 +1,543 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: vec.h
+
+  Small vector kernels shared by the modem and codec inner loops.  SSE
+  or NEON is used when the compiler targets it (x86-64 always has SSE,
+  armeabi-v7a needs -mfpu=neon), otherwise a plain C version with four
+  independent accumulators that compilers can still pipeline.
+
+  Summation order differs from a simple left to right loop, so results
+  can differ from the scalar code in the last bit or so.
+
+\*---------------------------------------------------------------------------*/
+
+#ifndef __VEC__
+#define __VEC__
+
+#include <math.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VEC_NEON
+#endif
+
+/* returns sum of a[i]*b[i], i=0..n-1 */
+
+static inline float vec_dot(const float a[], const float b[], int n)
+{
+    int   i;
+    float acc;
+
+#if defined(__SSE__)
+    __m128 sum = _mm_setzero_ps();
+    float  lanes[4];
+
+    for(i=0; i+4<=n; i+=4)
+	sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i])));
+    _mm_storeu_ps(lanes, sum);
+    acc = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(VEC_NEON)
+    float32x4_t sum = vdupq_n_f32(0.0);
+    float32x2_t s2;
+
+    for(i=0; i+4<=n; i+=4)
+	sum = vmlaq_f32(sum, vld1q_f32(&a[i]), vld1q_f32(&b[i]));
+    s2 = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    acc = vget_lane_f32(vpadd_f32(s2, s2), 0);
+#else
+    float acc0 = 0.0, acc1 = 0.0, acc2 = 0.0, acc3 = 0.0;
+
+    for(i=0; i+4<=n; i+=4) {
+	acc0 += a[i]*b[i];
+	acc1 += a[i+1]*b[i+1];
+	acc2 += a[i+2]*b[i+2];
+	acc3 += a[i+3]*b[i+3];
+    }
+    acc = (acc0 + acc1) + (acc2 + acc3);
+#endif
+
+    for(; i<n; i++)
+	acc += a[i]*b[i];
+
+    return acc;
+}
+
+/* acc[i] += a*b[i], i=0..n-1 */
+
+static inline void vec_mac(float acc[], float a, const float b[], int n)
+{
+    int i = 0;
+
+#if defined(__SSE__)
+    __m128 va = _mm_set1_ps(a);
+
+    for(; i+4<=n; i+=4)
+	_mm_storeu_ps(&acc[i], _mm_add_ps(_mm_loadu_ps(&acc[i]), _mm_mul_ps(va, _mm_loadu_ps(&b[i]))));
+#elif defined(VEC_NEON)
+    for(; i+4<=n; i+=4)
+	vst1q_f32(&acc[i], vmlaq_n_f32(vld1q_f32(&acc[i]), vld1q_f32(&b[i]), a));
+#endif
+
+    for(; i<n; i++)
+	acc[i] += a*b[i];
+}
+
+/* Steps n complex oscillators by one sample, ph *= f, then mixes x
+   down by each of them, out = x*conj(ph).  Real and imag parts are in
+   separate arrays, n must be a multiple of 4 */
+
+static inline void vec_osc_mix(float ph_re[], float ph_im[], const float f_re[], const float f_im[],
+			       float x_re, float x_im, float out_re[], float out_im[], int n)
+{
+    int i;
+
+#if defined(__SSE__)
+    __m128 xr = _mm_set1_ps(x_re), xi = _mm_set1_ps(x_im);
+    __m128 pr, pi, fr, fi, nr, ni;
+
+    for(i=0; i<n; i+=4) {
+	pr = _mm_loadu_ps(&ph_re[i]); pi = _mm_loadu_ps(&ph_im[i]);
+	fr = _mm_loadu_ps(&f_re[i]);  fi = _mm_loadu_ps(&f_im[i]);
+	nr = _mm_sub_ps(_mm_mul_ps(pr, fr), _mm_mul_ps(pi, fi));
+	ni = _mm_add_ps(_mm_mul_ps(pr, fi), _mm_mul_ps(pi, fr));
+	_mm_storeu_ps(&ph_re[i], nr); _mm_storeu_ps(&ph_im[i], ni);
+	_mm_storeu_ps(&out_re[i], _mm_add_ps(_mm_mul_ps(xr, nr), _mm_mul_ps(xi, ni)));
+	_mm_storeu_ps(&out_im[i], _mm_sub_ps(_mm_mul_ps(xi, nr), _mm_mul_ps(xr, ni)));
+    }
+#elif defined(VEC_NEON)
+    float32x4_t pr, pi, fr, fi, nr, ni;
+
+    for(i=0; i<n; i+=4) {
+	pr = vld1q_f32(&ph_re[i]); pi = vld1q_f32(&ph_im[i]);
+	fr = vld1q_f32(&f_re[i]);  fi = vld1q_f32(&f_im[i]);
+	nr = vmlsq_f32(vmulq_f32(pr, fr), pi, fi);
+	ni = vmlaq_f32(vmulq_f32(pr, fi), pi, fr);
+	vst1q_f32(&ph_re[i], nr); vst1q_f32(&ph_im[i], ni);
+	vst1q_f32(&out_re[i], vmlaq_n_f32(vmulq_n_f32(nr, x_re), ni, x_im));
+	vst1q_f32(&out_im[i], vmlsq_n_f32(vmulq_n_f32(nr, x_im), ni, x_re));
+    }
+#else
+    float nr, ni;
+
+    for(i=0; i<n; i++) {
+	nr = ph_re[i]*f_re[i] - ph_im[i]*f_im[i];
+	ni = ph_re[i]*f_im[i] + ph_im[i]*f_re[i];
+	ph_re[i] = nr; ph_im[i] = ni;
+	out_re[i] = x_re*nr + x_im*ni;
+	out_im[i] = x_im*nr - x_re*ni;
+    }
+#endif
+}
+
+/* Runs n second order resonators y = c*y1 - y2 for nsamp samples and
+   writes the sum of their outputs to out[].  y1[] and y2[] hold the
+   last two outputs of each resonator and are updated.  n must be a
+   multiple of 16 (pad unused resonators with zeros) and nsamp a
+   multiple of 4 */
+
+static inline void vec_resonate(float out[], int nsamp, const float c[], float y1[], float y2[], int n)
+{
+    int i, h;
+
+    for(i=0; i<nsamp; i++)
+	out[i] = 0.0;
+
+#if defined(__SSE__)
+    /* 16 resonators at a time, each advanced two samples per step with
+
+         y[n]   = c*y[n-1] - y[n-2]
+         y[n+1] = (c*c-1)*y[n-1] - c*y[n-2]
+
+       so the two outputs don't wait on each other */
+
+    __m128 c0, c1, c2, c3, d0, d1, d2, d3, a0, a1, a2, a3, b0, b1, b2, b3, t0, t1, t2, t3, s0, s1, s2, s3;
+    const __m128 one = _mm_set1_ps(1.0);
+
+#define VEC_RESONATE_STEP(s, r)						\
+    t0 = _mm_sub_ps(_mm_mul_ps(c0, a0), b0);				\
+    t1 = _mm_sub_ps(_mm_mul_ps(c1, a1), b1);				\
+    t2 = _mm_sub_ps(_mm_mul_ps(c2, a2), b2);				\
+    t3 = _mm_sub_ps(_mm_mul_ps(c3, a3), b3);				\
+    s = _mm_add_ps(_mm_add_ps(t0, t1), _mm_add_ps(t2, t3));		\
+    a0 = _mm_sub_ps(_mm_mul_ps(d0, a0), _mm_mul_ps(c0, b0)); b0 = t0;	\
+    a1 = _mm_sub_ps(_mm_mul_ps(d1, a1), _mm_mul_ps(c1, b1)); b1 = t1;	\
+    a2 = _mm_sub_ps(_mm_mul_ps(d2, a2), _mm_mul_ps(c2, b2)); b2 = t2;	\
+    a3 = _mm_sub_ps(_mm_mul_ps(d3, a3), _mm_mul_ps(c3, b3)); b3 = t3;	\
+    r = _mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(a2, a3))
+
+    for(h=0; h<n; h+=16) {
+	c0 = _mm_loadu_ps(&c[h]);    c1 = _mm_loadu_ps(&c[h+4]);
+	c2 = _mm_loadu_ps(&c[h+8]);  c3 = _mm_loadu_ps(&c[h+12]);
+	d0 = _mm_sub_ps(_mm_mul_ps(c0, c0), one); d1 = _mm_sub_ps(_mm_mul_ps(c1, c1), one);
+	d2 = _mm_sub_ps(_mm_mul_ps(c2, c2), one); d3 = _mm_sub_ps(_mm_mul_ps(c3, c3), one);
+	a0 = _mm_loadu_ps(&y1[h]);   a1 = _mm_loadu_ps(&y1[h+4]);
+	a2 = _mm_loadu_ps(&y1[h+8]); a3 = _mm_loadu_ps(&y1[h+12]);
+	b0 = _mm_loadu_ps(&y2[h]);   b1 = _mm_loadu_ps(&y2[h+4]);
+	b2 = _mm_loadu_ps(&y2[h+8]); b3 = _mm_loadu_ps(&y2[h+12]);
+	for(i=0; i<nsamp; i+=4) {
+	    VEC_RESONATE_STEP(s0, s1);
+	    VEC_RESONATE_STEP(s2, s3);
+	    _MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+	    s0 = _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3));
+	    _mm_storeu_ps(&out[i], _mm_add_ps(_mm_loadu_ps(&out[i]), s0));
+	}
+	_mm_storeu_ps(&y1[h], a0);   _mm_storeu_ps(&y1[h+4], a1);
+	_mm_storeu_ps(&y1[h+8], a2); _mm_storeu_ps(&y1[h+12], a3);
+	_mm_storeu_ps(&y2[h], b0);   _mm_storeu_ps(&y2[h+4], b1);
+	_mm_storeu_ps(&y2[h+8], b2); _mm_storeu_ps(&y2[h+12], b3);
+    }
+#undef VEC_RESONATE_STEP
+#elif defined(VEC_NEON)
+    float32x4_t c0, c1, c2, c3, d0, d1, d2, d3, a0, a1, a2, a3, b0, b1, b2, b3, t0, t1, t2, t3, s0, s1, s2, s3;
+    float32x2_t r0, r1;
+
+#define VEC_RESONATE_STEP(s, r)						\
+    t0 = vsubq_f32(vmulq_f32(c0, a0), b0);				\
+    t1 = vsubq_f32(vmulq_f32(c1, a1), b1);				\
+    t2 = vsubq_f32(vmulq_f32(c2, a2), b2);				\
+    t3 = vsubq_f32(vmulq_f32(c3, a3), b3);				\
+    s = vaddq_f32(vaddq_f32(t0, t1), vaddq_f32(t2, t3));		\
+    a0 = vmlsq_f32(vmulq_f32(d0, a0), c0, b0); b0 = t0;		\
+    a1 = vmlsq_f32(vmulq_f32(d1, a1), c1, b1); b1 = t1;		\
+    a2 = vmlsq_f32(vmulq_f32(d2, a2), c2, b2); b2 = t2;		\
+    a3 = vmlsq_f32(vmulq_f32(d3, a3), c3, b3); b3 = t3;		\
+    r = vaddq_f32(vaddq_f32(a0, a1), vaddq_f32(a2, a3))
+
+    for(h=0; h<n; h+=16) {
+	c0 = vld1q_f32(&c[h]);    c1 = vld1q_f32(&c[h+4]);
+	c2 = vld1q_f32(&c[h+8]);  c3 = vld1q_f32(&c[h+12]);
+	d0 = vsubq_f32(vmulq_f32(c0, c0), vdupq_n_f32(1.0f)); d1 = vsubq_f32(vmulq_f32(c1, c1), vdupq_n_f32(1.0f));
+	d2 = vsubq_f32(vmulq_f32(c2, c2), vdupq_n_f32(1.0f)); d3 = vsubq_f32(vmulq_f32(c3, c3), vdupq_n_f32(1.0f));
+	a0 = vld1q_f32(&y1[h]);   a1 = vld1q_f32(&y1[h+4]);
+	a2 = vld1q_f32(&y1[h+8]); a3 = vld1q_f32(&y1[h+12]);
+	b0 = vld1q_f32(&y2[h]);   b1 = vld1q_f32(&y2[h+4]);
+	b2 = vld1q_f32(&y2[h+8]); b3 = vld1q_f32(&y2[h+12]);
+	for(i=0; i<nsamp; i+=4) {
+	    VEC_RESONATE_STEP(s0, s1);
+	    VEC_RESONATE_STEP(s2, s3);
+	    r0 = vpadd_f32(vpadd_f32(vget_low_f32(s0), vget_high_f32(s0)),
+			   vpadd_f32(vget_low_f32(s1), vget_high_f32(s1)));
+	    r1 = vpadd_f32(vpadd_f32(vget_low_f32(s2), vget_high_f32(s2)),
+			   vpadd_f32(vget_low_f32(s3), vget_high_f32(s3)));
+	    vst1q_f32(&out[i], vaddq_f32(vld1q_f32(&out[i]), vcombine_f32(r0, r1)));
+	}
+	vst1q_f32(&y1[h], a0);   vst1q_f32(&y1[h+4], a1);
+	vst1q_f32(&y1[h+8], a2); vst1q_f32(&y1[h+12], a3);
+	vst1q_f32(&y2[h], b0);   vst1q_f32(&y2[h+4], b1);
+	vst1q_f32(&y2[h+8], b2); vst1q_f32(&y2[h+12], b3);
+    }
+#undef VEC_RESONATE_STEP
+#else
+    float t, acc0, acc1, acc2, acc3;
+
+    for(i=0; i<nsamp; i++) {
+	acc0 = acc1 = acc2 = acc3 = 0.0;
+	for(h=0; h<n; h+=4) {
+	    t = c[h]*y1[h] - y2[h];       y2[h] = y1[h];     y1[h] = t;     acc0 += t;
+	    t = c[h+1]*y1[h+1] - y2[h+1]; y2[h+1] = y1[h+1]; y1[h+1] = t;   acc1 += t;
+	    t = c[h+2]*y1[h+2] - y2[h+2]; y2[h+2] = y1[h+2]; y1[h+2] = t;   acc2 += t;
+	    t = c[h+3]*y1[h+3] - y2[h+3]; y2[h+3] = y1[h+3]; y1[h+3] = t;   acc3 += t;
+	}
+	out[i] = (acc0 + acc1) + (acc2 + acc3);
+    }
+#endif
+}
+
+/* Scales n complex values to unit magnitude with one reciprocal square
+   root each.  n must be a multiple of 4 */
+
+static inline void vec_normalise(float re[], float im[], int n)
+{
+    int i;
+
+#if defined(__SSE__)
+    __m128 r, m, g, mag2;
+
+    for(i=0; i<n; i+=4) {
+	r = _mm_loadu_ps(&re[i]); m = _mm_loadu_ps(&im[i]);
+	mag2 = _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(m, m));
+	/* estimate is good to 12 bits, one Newton step takes it to ~23 */
+	g = _mm_rsqrt_ps(mag2);
+	g = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5), g),
+		       _mm_sub_ps(_mm_set1_ps(3.0), _mm_mul_ps(mag2, _mm_mul_ps(g, g))));
+	_mm_storeu_ps(&re[i], _mm_mul_ps(r, g)); _mm_storeu_ps(&im[i], _mm_mul_ps(m, g));
+    }
+#elif defined(VEC_NEON)
+    float32x4_t r, m, g, mag2;
+
+    for(i=0; i<n; i+=4) {
+	r = vld1q_f32(&re[i]); m = vld1q_f32(&im[i]);
+	mag2 = vmlaq_f32(vmulq_f32(r, r), m, m);
+	g = vrsqrteq_f32(mag2);
+	g = vmulq_f32(g, vrsqrtsq_f32(vmulq_f32(mag2, g), g));
+	g = vmulq_f32(g, vrsqrtsq_f32(vmulq_f32(mag2, g), g));
+	vst1q_f32(&re[i], vmulq_f32(r, g)); vst1q_f32(&im[i], vmulq_f32(m, g));
+    }
+#else
+    float g;
+
+    for(i=0; i<n; i++) {
+	g = 1.0/sqrtf(re[i]*re[i] + im[i]*im[i]);
+	re[i] *= g;
+	im[i] *= g;
+    }
+#endif
+}
+
+/* dist[j] = sum of (w[i]*(cb[j*k+i]-x[i]))^2, i=0..k-1, for each of the
+   m entries of the row-major codebook cb[] */
+
+static inline void vec_wdist(float dist[], const float cb[], int m, const float x[], const float w[], int k)
+{
+    int   i, j;
+    float acc, d;
+
+#if defined(__SSE__)
+    __m128 sum, e;
+    float  lanes[4];
+
+    for(j=0; j<m; j++, cb += k) {
+	sum = _mm_setzero_ps();
+	for(i=0; i+4<=k; i+=4) {
+	    e = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&cb[i]), _mm_loadu_ps(&x[i])), _mm_loadu_ps(&w[i]));
+	    sum = _mm_add_ps(sum, _mm_mul_ps(e, e));
+	}
+	_mm_storeu_ps(lanes, sum);
+	acc = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	for(; i<k; i++) {
+	    d = (cb[i] - x[i])*w[i];
+	    acc += d*d;
+	}
+	dist[j] = acc;
+    }
+#elif defined(VEC_NEON)
+    float32x4_t sum, e;
+    float32x2_t s2;
+
+    for(j=0; j<m; j++, cb += k) {
+	sum = vdupq_n_f32(0.0);
+	for(i=0; i+4<=k; i+=4) {
+	    e = vmulq_f32(vsubq_f32(vld1q_f32(&cb[i]), vld1q_f32(&x[i])), vld1q_f32(&w[i]));
+	    sum = vmlaq_f32(sum, e, e);
+	}
+	s2 = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+	acc = vget_lane_f32(vpadd_f32(s2, s2), 0);
+	for(; i<k; i++) {
+	    d = (cb[i] - x[i])*w[i];
+	    acc += d*d;
+	}
+	dist[j] = acc;
+    }
+#else
+    for(j=0; j<m; j++, cb += k) {
+	acc = 0.0;
+	for(i=0; i<k; i++) {
+	    d = (cb[i] - x[i])*w[i];
+	    acc += d*d;
+	}
+	dist[j] = acc;
+    }
+#endif
+}
+
+/* Searches m codebook entries for the one nearest x[], the smallest
+   sum of w[j]*(x[j]-c[j])^2 (w[] may be NULL for an unweighted
+   search), updating *min_dist and *nearest if it beats them.  cbt[]
+   holds the entries dimension-major, cbt[j*m+i] is element j of entry
+   i, so four entries are compared per step.  index[] gives the
+   codebook index of each entry, with ties going to the lowest index;
+   if NULL, entry i is index i and ties go to the first found, as in a
+   plain scalar search.  Each entry's distance is summed in the same
+   order as the scalar search, so results are the same.  A block of
+   entries is dropped half way through if its partial distances all
+   rule it out.  m must be a multiple of 4. */
+
+static inline void vec_nearest_update(const float cbt[], int m, const float x[], const float w[], int ndim,
+				      const short index[], float *min_dist, int *nearest)
+{
+    int   i, j, l, n;
+    float dist[4];
+
+#if defined(__SSE__)
+    __m128 acc, d, out;
+
+    for(i=0; i<m; i+=4) {
+	acc = _mm_setzero_ps();
+	for(j=0; j<ndim; j++) {
+	    d = _mm_sub_ps(_mm_set1_ps(x[j]), _mm_loadu_ps(&cbt[j*m+i]));
+	    if (w)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(w[j]), d), d));
+	    else
+		acc = _mm_add_ps(acc, _mm_mul_ps(d, d));
+	    if (j == ndim/2) {
+		out = index ? _mm_cmple_ps(acc, _mm_set1_ps(*min_dist)) : _mm_cmplt_ps(acc, _mm_set1_ps(*min_dist));
+		if (!_mm_movemask_ps(out))
+		    break;
+	    }
+	}
+	if (j < ndim)
+	    continue;
+	_mm_storeu_ps(dist, acc);
+#elif defined(VEC_NEON)
+    float32x4_t acc, d;
+    uint32x4_t  out;
+    uint32x2_t  any;
+
+    for(i=0; i<m; i+=4) {
+	acc = vdupq_n_f32(0.0f);
+	for(j=0; j<ndim; j++) {
+	    d = vsubq_f32(vdupq_n_f32(x[j]), vld1q_f32(&cbt[j*m+i]));
+	    if (w)
+		acc = vaddq_f32(acc, vmulq_f32(vmulq_f32(vdupq_n_f32(w[j]), d), d));
+	    else
+		acc = vaddq_f32(acc, vmulq_f32(d, d));
+	    if (j == ndim/2) {
+		out = index ? vcleq_f32(acc, vdupq_n_f32(*min_dist)) : vcltq_f32(acc, vdupq_n_f32(*min_dist));
+		any = vorr_u32(vget_low_u32(out), vget_high_u32(out));
+		if (!(vget_lane_u32(any, 0) | vget_lane_u32(any, 1)))
+		    break;
+	    }
+	}
+	if (j < ndim)
+	    continue;
+	vst1q_f32(dist, acc);
+#else
+    for(i=0; i<m; i+=4) {
+	dist[0] = dist[1] = dist[2] = dist[3] = 0.0;
+	for(j=0; j<ndim; j++) {
+	    for(l=0; l<4; l++) {
+		float e = x[j] - cbt[j*m+i+l];
+		dist[l] += w ? w[j]*e*e : e*e;
+	    }
+	    if (j == ndim/2) {
+		for(l=0; l<4; l++)
+		    if (index ? dist[l] <= *min_dist : dist[l] < *min_dist)
+			break;
+		if (l == 4)
+		    break;
+	    }
+	}
+	if (j < ndim)
+	    continue;
+#endif
+	for(l=0; l<4; l++) {
+	    n = index ? index[i+l] : i+l;
+	    if ((dist[l] < *min_dist) || (index && (dist[l] == *min_dist) && (n < *nearest))) {
+		*min_dist = dist[l];
+		*nearest = n;
+	    }
+	}
+    }
+}
+
+/* Returns the index of the codebook entry nearest x[], see
+   vec_nearest_update() */
+
+static inline int vec_nearest(const float cbt[], int m, const float x[], const float w[], int ndim)
+{
+    float min_dist = 1e15;
+    int   nearest = 0;
+
+    vec_nearest_update(cbt, m, x, w, ndim, NULL, &min_dist, &nearest);
+
+    return nearest;
+}
+
+/* bnd[b] = sum of w[j]*e*e, e the distance from x[j] to the range
+   lo..hi of box b in dimension j (w[] may be NULL).  This is a lower
+   bound on vec_nearest_update()'s distance from x[] to any vector in
+   the box, including rounding.  lo[] and hi[] are dimension-major,
+   lo[j*n+b], n must be a multiple of 4 */
+
+static inline void vec_box_dist(float bnd[], const float lo[], const float hi[], int n, const float x[], const float w[], int k)
+{
+    int   b, j;
+
+#if defined(__SSE__)
+    __m128 acc, xj, e;
+
+    for(b=0; b<n; b+=4) {
+	acc = _mm_setzero_ps();
+	for(j=0; j<k; j++) {
+	    xj = _mm_set1_ps(x[j]);
+	    e = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&lo[j*n+b]), xj),
+				      _mm_sub_ps(xj, _mm_loadu_ps(&hi[j*n+b]))), _mm_setzero_ps());
+	    if (w)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(w[j]), e), e));
+	    else
+		acc = _mm_add_ps(acc, _mm_mul_ps(e, e));
+	}
+	_mm_storeu_ps(&bnd[b], acc);
+    }
+#elif defined(VEC_NEON)
+    float32x4_t acc, xj, e;
+
+    for(b=0; b<n; b+=4) {
+	acc = vdupq_n_f32(0.0f);
+	for(j=0; j<k; j++) {
+	    xj = vdupq_n_f32(x[j]);
+	    e = vmaxq_f32(vmaxq_f32(vsubq_f32(vld1q_f32(&lo[j*n+b]), xj),
+				    vsubq_f32(xj, vld1q_f32(&hi[j*n+b]))), vdupq_n_f32(0.0f));
+	    if (w)
+		acc = vaddq_f32(acc, vmulq_f32(vmulq_f32(vdupq_n_f32(w[j]), e), e));
+	    else
+		acc = vaddq_f32(acc, vmulq_f32(e, e));
+	}
+	vst1q_f32(&bnd[b], acc);
+    }
+#else
+    float e;
+
+    for(b=0; b<n; b++) {
+	bnd[b] = 0.0;
+	for(j=0; j<k; j++) {
+	    e = 0.0;
+	    if (x[j] < lo[j*n+b])
+		e = lo[j*n+b] - x[j];
+	    if (x[j] > hi[j*n+b])
+		e = x[j] - hi[j*n+b];
+	    bnd[b] += w ? w[j]*e*e : e*e;
+	}
+    }
+#endif
+}
+
+/* E[k] = sum of pw[(int)(m*Wo[k]/r + 0.5f)], m=1..L, for the four
+   fundamentals Wo[0..3].  Each lane adds its terms in order of m, so
+   the sums match that scalar loop exactly.  The bin is rounded in
+   float, where hs_pitch_refinement() used to take floor(m*Wo/r + 0.5)
+   in double, so when m*Wo/r is within a float rounding below a half
+   the two pick adjacent bins.  freedv_cli -c vec counts how often. */
+
+static inline void vec_harm_energy(float E[], const float pw[], const float Wo[], float r, int L)
+{
+    int   m;
+
+#if defined(__SSE__)
+    __m128 wo = _mm_loadu_ps(Wo), rr = _mm_set1_ps(r), half = _mm_set1_ps(0.5);
+    __m128 e = _mm_setzero_ps();
+    float  q[4];
+
+    for(m=1; m<=L; m++) {
+	_mm_storeu_ps(q, _mm_add_ps(_mm_div_ps(_mm_mul_ps(_mm_set1_ps((float)m), wo), rr), half));
+	e = _mm_add_ps(e, _mm_setr_ps(pw[(int)q[0]], pw[(int)q[1]], pw[(int)q[2]], pw[(int)q[3]]));
+    }
+    _mm_storeu_ps(E, e);
+#else
+    /* no NEON version, ARMv7 NEON has no exact divide */
+    float e0 = 0.0, e1 = 0.0, e2 = 0.0, e3 = 0.0;
+
+    for(m=1; m<=L; m++) {
+	e0 += pw[(int)(m*Wo[0]/r + 0.5f)];
+	e1 += pw[(int)(m*Wo[1]/r + 0.5f)];
+	e2 += pw[(int)(m*Wo[2]/r + 0.5f)];
+	e3 += pw[(int)(m*Wo[3]/r + 0.5f)];
+    }
+    E[0] = e0; E[1] = e1; E[2] = e2; E[3] = e3;
+#endif
+}
+
+#endif
@@ -0,0 +1,747 @@
+/*
+ *
+ * Kernel equivalence checks and micro-benchmarks
+ * Copyright 2012 Joel Stanley <joel@jms.id.au>
+ *
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freedv/fdmdv_internal.h"
+#include "freedv_check.h"
+#include "freedv_check_internal.h"
+#include "freedv_spectrum.h"
+
+struct check {
+    const char *name;
+    const char *desc;
+    int needs_capture;
+    int (*run)(const char *capture);
+};
+
+double check_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+float check_frand(unsigned *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return (*seed >> 8) / (float)(1 << 23) - 1.0;
+}
+
+void check_fill(float x[], int n, unsigned *seed) {
+    int i;
+
+    for (i = 0; i < n; i++)
+        x[i] = check_frand(seed);
+}
+
+volatile float check_sink;
+
+int check_report(const char *name, double t, double t_ref, int reps,
+        double err, double tol) {
+    int ok = err <= tol;
+
+    printf("  %-22s %9.1f ns  ref %9.1f ns  %5.2fx  err %.2g%s\n", name,
+            1e9 * t / reps, 1e9 * t_ref / reps, t_ref / t, err,
+            ok ? "" : "  FAIL");
+    return ok ? 0 : -1;
+}
+
+double check_max_diff(const float a[], const float b[], int n, double scale) {
+    double d = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (fabs(a[i] - b[i]) > d)
+            d = fabs(a[i] - b[i]);
+    return d / scale;
+}
+
+/*
+ * Reads a 48 kHz 16-bit stereo capture, brings it down to 8 kHz and
+ * returns it as demod input, scaled by 1/FDMDV_SCALE. ppm shifts the
+ * sample clock the way a transmitter's would, so a recording can be
+ * replayed with a clock offset. Sets *n to the number of samples.
+ */
+static COMP *load_modem(const char *path, float ppm, int *n) {
+    struct FDMDV_DOWNMIX *d;
+    struct FDMDV_CLOCK *c;
+    unsigned char *pcm;
+    short *s8k;
+    COMP *out;
+    long len;
+    int nbytes, n8k, used;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    rewind(f);
+    pcm = malloc(len);
+    s8k = malloc((len / 24 + 1) * sizeof(short));
+    out = malloc((len / 24 + 1) * 1.1 * sizeof(COMP));
+    d = fdmdv_downmix_create();
+    c = fdmdv_clock_create();
+    if (!pcm || !s8k || !out || !d || !c ||
+            fread(pcm, 1, len, f) != (size_t)len) {
+        fprintf(stderr, "%s: read failed\n", path);
+        free(out);
+        out = NULL;
+        goto done;
+    }
+
+    nbytes = len;
+    n8k = fdmdv_downmix_48_to_8(d, s8k, len / 24 + 1, pcm, &nbytes);
+    c->step = 1.0 + 1E-6 * ppm;
+    used = n8k;
+    *n = fdmdv_clock_resample(c, out, (len / 24 + 1) * 1.1, s8k, &used);
+
+done:
+    fclose(f);
+    fdmdv_clock_destroy(c);
+    fdmdv_downmix_destroy(d);
+    free(s8k);
+    free(pcm);
+    return out;
+}
+
+/*
+ * rx_filter() against the version that shifted its memory down after
+ * every output and convolved one tap at a time, at the three values
+ * nin takes. Both filter the same random baseband. The dot products
+ * sum in a different order, so the outputs only have to agree to float
+ * rounding.
+ */
+
+extern const float gt_alpha5_root[];
+
+#define RXF_FRAMES 4000
+#define RXF_BLOCKS 8
+
+static void rx_filter_ref(COMP rx_filt[NC+1][P+1],
+        COMP rx_baseband[NC+1][M+M/P], COMP mem[NC+1][NFILTER], int nin) {
+    int c, i, j, k, l;
+    int n = M / P;
+
+    for (i = 0, j = 0; i < nin; i += n, j++) {
+        for (c = 0; c < NC + 1; c++)
+            for (k = NFILTER - n, l = i; k < NFILTER; k++, l++)
+                mem[c][k] = rx_baseband[c][l];
+
+        for (c = 0; c < NC + 1; c++) {
+            rx_filt[c][j].real = 0.0;
+            rx_filt[c][j].imag = 0.0;
+            for (k = 0; k < NFILTER; k++) {
+                rx_filt[c][j].real += gt_alpha5_root[k] * mem[c][k].real;
+                rx_filt[c][j].imag += gt_alpha5_root[k] * mem[c][k].imag;
+            }
+        }
+
+        for (c = 0; c < NC + 1; c++)
+            for (k = 0, l = n; k < NFILTER - n; k++, l++)
+                mem[c][k] = mem[c][l];
+    }
+}
+
+static int check_rxfilter(const char *capture) {
+    static COMP bb[RXF_BLOCKS][NC+1][M+M/P], mem_ref[NC+1][NFILTER];
+    static struct FDMDV_RX_FILTER mem;
+    const int nins[] = { M - M / P, M, M + M / P };
+    COMP filt[NC+1][P+1], filt_ref[NC+1][P+1];
+    unsigned seed = 1;
+    double t, t_ref, t0, err, d, scale;
+    char name[32];
+    int i, c, j, frame, fails = 0;
+
+    printf("rxfilter: rx_filter() against shifting memory\n");
+    check_fill((float *)bb, sizeof(bb) / sizeof(float), &seed);
+
+    for (i = 0; i < 3; i++) {
+        memset(&mem, 0, sizeof(mem));
+        memset(mem_ref, 0, sizeof(mem_ref));
+        t = t_ref = err = 0;
+        for (frame = 0; frame < RXF_FRAMES; frame++) {
+            t0 = check_now();
+            rx_filter(filt, bb[frame % RXF_BLOCKS], &mem, nins[i]);
+            t += check_now() - t0;
+            t0 = check_now();
+            rx_filter_ref(filt_ref, bb[frame % RXF_BLOCKS], mem_ref,
+                    nins[i]);
+            t_ref += check_now() - t0;
+
+            for (c = 0; c < NC + 1; c++) {
+                for (scale = 1e-9, j = 0; j < 2 * nins[i] * P / M; j++)
+                    if (fabs(((float *)filt_ref[c])[j]) > scale)
+                        scale = fabs(((float *)filt_ref[c])[j]);
+                d = check_max_diff((float *)filt[c], (float *)filt_ref[c],
+                        2 * nins[i] * P / M, scale);
+                if (d > err)
+                    err = d;
+            }
+        }
+        snprintf(name, sizeof(name), "nin %d", nins[i]);
+        fails += check_report(name, t, t_ref, RXF_FRAMES, err, 1e-5);
+    }
+    return fails ? -1 : 0;
+}
+
+/*
+ * rx_est_timing() against the version that shifted its memories down
+ * every frame, which the ring buffers replaced. Both are fed the same
+ * filtered symbols from a demod front end running over the capture, as
+ * recorded and with the tx clock 1000 ppm either side so that nin
+ * steps to 120 and 200. Timing and symbols must be bit identical.
+ */
+
+static float est_timing_ref(COMP rx_symbols[], COMP rx_filt[NC+1][P+1],
+        COMP rx_baseband[NC+1][M+M/P], COMP filt_mem[NC+1][NT*P],
+        float env[], COMP bb_mem[NC+1][NFILTERTIMING], int nin) {
+    int c, i, j, k, adjust, s;
+    COMP x, phase, freq, t;
+    float rx_timing;
+
+    adjust = P - nin * P / M;
+    for (c = 0; c < NC + 1; c++)
+        for (i = 0, j = P - adjust; i < (NT - 1) * P + adjust; i++, j++)
+            filt_mem[c][i] = filt_mem[c][j];
+    for (c = 0; c < NC + 1; c++)
+        for (i = (NT - 1) * P + adjust, j = 0; i < NT * P; i++, j++)
+            filt_mem[c][i] = rx_filt[c][j];
+
+    for (i = 0; i < NT * P; i++) {
+        env[i] = 0.0;
+        for (c = 0; c < NC + 1; c++)
+            env[i] += (float)sqrt(pow(filt_mem[c][i].real, 2.0) +
+                    pow(filt_mem[c][i].imag, 2.0));
+    }
+
+    x.real = 0.0;
+    x.imag = 0.0;
+    freq.real = cos(2 * PI / P);
+    freq.imag = sin(2 * PI / P);
+    phase.real = 1.0;
+    phase.imag = 0.0;
+    for (i = 0; i < NT * P; i++) {
+        x.real += env[i] * phase.real;
+        x.imag += env[i] * phase.imag;
+        t.real = phase.real * freq.real - phase.imag * freq.imag;
+        t.imag = phase.real * freq.imag + phase.imag * freq.real;
+        phase = t;
+    }
+
+    rx_timing = atan2(x.imag, x.real) * M / (2 * PI) + M / 4;
+    if (rx_timing > M)
+        rx_timing -= M;
+    if (rx_timing < -M)
+        rx_timing += M;
+
+    for (c = 0; c < NC + 1; c++)
+        for (i = 0, j = nin; i < NFILTERTIMING - nin; i++, j++)
+            bb_mem[c][i] = bb_mem[c][j];
+    for (c = 0; c < NC + 1; c++)
+        for (i = NFILTERTIMING - nin, j = 0; i < NFILTERTIMING; i++, j++)
+            bb_mem[c][i] = rx_baseband[c][j];
+
+    s = round(rx_timing) + M;
+    for (c = 0; c < NC + 1; c++) {
+        rx_symbols[c].real = 0.0;
+        rx_symbols[c].imag = 0.0;
+        for (k = s, j = 0; k < s + NFILTER; k++, j++) {
+            rx_symbols[c].real += gt_alpha5_root[j] * bb_mem[c][k].real;
+            rx_symbols[c].imag += gt_alpha5_root[j] * bb_mem[c][k].imag;
+        }
+    }
+    return rx_timing;
+}
+
+static int check_timing(const char *capture) {
+    static COMP filt_mem[NC+1][NT*P], bb_mem[NC+1][NFILTERTIMING];
+    const float ppm[] = { 0, 1000, -1000 };
+    COMP fcorr[M+M/P], bb[NC+1][M+M/P], filt[NC+1][P+1];
+    COMP sym[NC+1], sym_ref[NC+1];
+    float env[NT*P], timing, timing_ref, foff;
+    struct FDMDV *g;
+    double t, t_ref, t0;
+    int i, n, pos, nin, frames, steps, wrong, fails = 0;
+    COMP *rx;
+
+    printf("timing: rx_est_timing() against shifting memories\n");
+    for (i = 0; i < 3; i++) {
+        rx = load_modem(capture, ppm[i], &n);
+        g = fdmdv_create();
+        if (!rx || !g) {
+            free(rx);
+            fdmdv_destroy(g);
+            return -1;
+        }
+        memset(filt_mem, 0, sizeof(filt_mem));
+        memset(bb_mem, 0, sizeof(bb_mem));
+
+        t = t_ref = 0;
+        frames = steps = wrong = 0;
+        for (pos = 0, nin = M; pos + nin <= n; pos += nin) {
+            foff = rx_est_freq_offset(g, &rx[pos], nin, 1);
+            fdmdv_freq_shift(fcorr, &rx[pos], -foff, &g->foff_rect,
+                    &g->foff_phase_rect, nin);
+            fdm_downconvert(bb, fcorr, &g->osc_rx, nin);
+            rx_filter(filt, bb, &g->rx_filter_memory, nin);
+
+            t0 = check_now();
+            timing = rx_est_timing(sym, filt, bb, &g->rx_timing_mem, env, nin);
+            t += check_now() - t0;
+            t0 = check_now();
+            timing_ref = est_timing_ref(sym_ref, filt, bb, filt_mem, env,
+                    bb_mem, nin);
+            t_ref += check_now() - t0;
+
+            if (memcmp(&timing, &timing_ref, sizeof(timing)) ||
+                    memcmp(sym, sym_ref, sizeof(sym)))
+                wrong++;
+            frames++;
+            steps += nin != M;
+
+            nin = M;
+            if (timing > 2 * M / P)
+                nin += M / P;
+            if (timing < 0)
+                nin -= M / P;
+        }
+        printf("  %+6.0f ppm: %d frames, %d nin steps, %d differ\n",
+                ppm[i], frames, steps, wrong);
+        fails += check_report("rx_est_timing", t, t_ref, frames, wrong, 0);
+        free(rx);
+        fdmdv_destroy(g);
+    }
+    return fails ? -1 : 0;
+}
+
+/*
+ * fdmdv_demod() per frame in each freq estimator state, against the
+ * coarse estimator it used before it decimated the pilot LPF and only
+ * ran the pilot DFTs in COARSE. The old estimator, rx_est_freq_offset()
+ * as fdmdv_demod() calls it and fdmdv_demod() itself each run on their
+ * own copy of the modem state, over noise, which keeps the demod in
+ * COARSE, and over the capture, which is mostly FINE. The demod with
+ * the old estimator is timed as fdmdv_demod() less the new estimator
+ * plus the old one. In COARSE the two estimates must be identical.
+ */
+
+#define DEMOD_NOISE_FRAMES 500
+
+extern const float pilot_coeff[];
+extern const float hanning[];
+
+static void lpf_peak_pick_ref(float *foff, float *max, COMP pilot_baseband[],
+        COMP pilot_lpf[], kiss_fft_cfg fft_pilot_cfg, COMP S[], int nin) {
+    int i, j, k, ix;
+    int mpilot = FS / (2 * 200);
+    COMP s[MPILOTFFT];
+    float mag, imax;
+
+    for (i = 0; i < NPILOTLPF - nin; i++)
+        pilot_lpf[i] = pilot_lpf[nin + i];
+    for (i = NPILOTLPF - nin, j = 0; i < NPILOTLPF; i++, j++) {
+        pilot_lpf[i].real = 0.0;
+        pilot_lpf[i].imag = 0.0;
+        for (k = 0; k < NPILOTCOEFF; k++) {
+            pilot_lpf[i].real += pilot_coeff[k] * pilot_baseband[j + k].real;
+            pilot_lpf[i].imag += pilot_coeff[k] * pilot_baseband[j + k].imag;
+        }
+    }
+
+    for (i = 0; i < MPILOTFFT; i++) {
+        s[i].real = 0.0;
+        s[i].imag = 0.0;
+    }
+    for (i = 0, j = 0; i < NPILOTLPF; i += mpilot, j++) {
+        s[j].real = hanning[i] * pilot_lpf[i].real;
+        s[j].imag = hanning[i] * pilot_lpf[i].imag;
+    }
+    kiss_fft(fft_pilot_cfg, (kiss_fft_cpx *)s, (kiss_fft_cpx *)S);
+
+    imax = 0.0;
+    ix = 0;
+    for (i = 0; i < MPILOTFFT; i++) {
+        mag = S[i].real * S[i].real + S[i].imag * S[i].imag;
+        if (mag > imax) {
+            imax = mag;
+            ix = i;
+        }
+    }
+    if (ix >= MPILOTFFT / 2)
+        *foff = (ix - MPILOTFFT) * 2.0 * 200.0 / MPILOTFFT;
+    else
+        *foff = ix * 2.0 * 200.0 / MPILOTFFT;
+    *max = imax;
+}
+
+static float est_freq_offset_ref(struct FDMDV *f, COMP rx_fdm[], int nin) {
+    COMP pilot, prev_pilot;
+    float foff1, foff2, max1, max2;
+    int i, j;
+
+    for (i = 0; i < NPILOTBASEBAND - nin; i++) {
+        f->pilot_baseband1[i] = f->pilot_baseband1[i + nin];
+        f->pilot_baseband2[i] = f->pilot_baseband2[i + nin];
+    }
+    for (i = 0, j = NPILOTBASEBAND - nin; i < nin; i++, j++) {
+        pilot = f->pilot_lut[f->pilot_lut_index];
+        if (++f->pilot_lut_index >= 4 * M)
+            f->pilot_lut_index = 0;
+        prev_pilot = f->pilot_lut[f->prev_pilot_lut_index];
+        if (++f->prev_pilot_lut_index >= 4 * M)
+            f->prev_pilot_lut_index = 0;
+
+        f->pilot_baseband1[j].real = rx_fdm[i].real * pilot.real +
+                rx_fdm[i].imag * pilot.imag;
+        f->pilot_baseband1[j].imag = rx_fdm[i].imag * pilot.real -
+                rx_fdm[i].real * pilot.imag;
+        f->pilot_baseband2[j].real = rx_fdm[i].real * prev_pilot.real +
+                rx_fdm[i].imag * prev_pilot.imag;
+        f->pilot_baseband2[j].imag = rx_fdm[i].imag * prev_pilot.real -
+                rx_fdm[i].real * prev_pilot.imag;
+    }
+
+    lpf_peak_pick_ref(&foff1, &max1, f->pilot_baseband1, f->pilot_lpf1,
+            f->fft_pilot_cfg, f->S1, nin);
+    lpf_peak_pick_ref(&foff2, &max2, f->pilot_baseband2, f->pilot_lpf2,
+            f->fft_pilot_cfg, f->S2, nin);
+    return max1 > max2 ? foff1 : foff2;
+}
+
+static int check_demod(const char *capture) {
+    const char *state_name[] = { "COARSE", "FINE" };
+    struct FDMDV *g, *g_est, *g_ref;
+    double t[2], t_est[2], t_ref[2], t0;
+    float foff, foff_ref;
+    int bits[FDMDV_BITS_PER_FRAME], sync_bit;
+    int pass, i, n, pos, nin, state, frames[2], wrong = 0, fails = 0;
+    unsigned seed = 1;
+    COMP *rx;
+    char name[32];
+
+    printf("demod: fdmdv_demod() against always running pilot DFTs\n");
+    memset(t, 0, sizeof(t));
+    memset(t_est, 0, sizeof(t_est));
+    memset(t_ref, 0, sizeof(t_ref));
+    memset(frames, 0, sizeof(frames));
+    g_est = malloc(sizeof(struct FDMDV));
+    g_ref = malloc(sizeof(struct FDMDV));
+    if (!g_est || !g_ref) {
+        free(g_est);
+        free(g_ref);
+        return -1;
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 0) {
+            n = DEMOD_NOISE_FRAMES * M;
+            rx = malloc((n + M / P) * sizeof(COMP));
+            for (i = 0; rx && i < n + M / P; i++) {
+                rx[i].real = 0.1 * check_frand(&seed);
+                rx[i].imag = 0.0;
+            }
+        } else {
+            rx = load_modem(capture, 0, &n);
+        }
+        g = fdmdv_create();
+        if (!rx || !g) {
+            free(rx);
+            fdmdv_destroy(g);
+            free(g_est);
+            free(g_ref);
+            return -1;
+        }
+        memcpy(g_est, g, sizeof(struct FDMDV));
+        memcpy(g_ref, g, sizeof(struct FDMDV));
+
+        for (pos = 0, nin = M; pos + nin <= n; pos += nin) {
+            state = g->coarse_fine == FINE;
+
+            t0 = check_now();
+            foff = rx_est_freq_offset(g_est, &rx[pos], nin, state == 0);
+            t_est[state] += check_now() - t0;
+            t0 = check_now();
+            foff_ref = est_freq_offset_ref(g_ref, &rx[pos], nin);
+            t_ref[state] += check_now() - t0;
+            if (state == 0 && memcmp(&foff, &foff_ref, sizeof(foff)))
+                wrong++;
+
+            t0 = check_now();
+            fdmdv_demod(g, bits, &sync_bit, &rx[pos], &nin);
+            t[state] += check_now() - t0;
+            frames[state]++;
+        }
+        free(rx);
+        fdmdv_destroy(g);
+    }
+    free(g_est);
+    free(g_ref);
+
+    printf("  %d COARSE frames, %d FINE, %d COARSE estimates differ\n",
+            frames[0], frames[1], wrong);
+    for (state = 0; state < 2; state++) {
+        if (!frames[state])
+            continue;
+        snprintf(name, sizeof(name), "estimator %s", state_name[state]);
+        fails += check_report(name, t_est[state], t_ref[state],
+                frames[state], state ? 0 : wrong, 0);
+        snprintf(name, sizeof(name), "fdmdv_demod %s", state_name[state]);
+        fails += check_report(name, t[state],
+                t[state] - t_est[state] + t_ref[state], frames[state],
+                state ? 0 : wrong, 0);
+    }
+    return fails ? -1 : 0;
+}
+
+/*
+ * kiss_fft with the vector radix 2 and 4 butterflies against the same
+ * transforms done with the scalar ones, at the sizes the codec, modem
+ * and spectrum use. The vector butterflies keep the scalar operation
+ * order, so with SSE the output must be bit identical; NEON may fuse a
+ * multiply-add, so there it only has to agree to float rounding.
+ */
+
+#define FFT_REPS 2000
+
+static int check_fft(const char *capture) {
+    static const int sizes[] = { 256, 512, 1024 };
+    kiss_fft_cpx in[1024], out[1024], out_ref[1024];
+    kiss_fft_cfg cfg;
+    unsigned seed = 1;
+    double t, t_ref, err, scale;
+    char name[32];
+    int i, j, inverse, rep, fails = 0;
+#if defined(__SSE__)
+    const double tol = 0;
+#else
+    const double tol = 1e-6;
+#endif
+
+    printf("fft: vector butterflies against scalar\n");
+    if (!kiss_fft_use_vec(1))
+        printf("  no vector butterflies in this build\n");
+    check_fill((float *)in, 2 * 1024, &seed);
+
+    for (i = 0; i < 3; i++) {
+        for (inverse = 0; inverse < 2; inverse++) {
+            cfg = kiss_fft_alloc(sizes[i], inverse, NULL, NULL);
+            if (!cfg)
+                return -1;
+
+            kiss_fft_use_vec(0);
+            kiss_fft(cfg, in, out_ref);
+            t_ref = check_now();
+            for (rep = 0; rep < FFT_REPS; rep++)
+                kiss_fft(cfg, in, out_ref);
+            t_ref = check_now() - t_ref;
+
+            kiss_fft_use_vec(1);
+            kiss_fft(cfg, in, out);
+            t = check_now();
+            for (rep = 0; rep < FFT_REPS; rep++)
+                kiss_fft(cfg, in, out);
+            t = check_now() - t;
+            KISS_FFT_FREE(cfg);
+
+            for (scale = 1e-9, j = 0; j < 2 * sizes[i]; j++)
+                if (fabs(((float *)out_ref)[j]) > scale)
+                    scale = fabs(((float *)out_ref)[j]);
+            err = check_max_diff((float *)out, (float *)out_ref,
+                    2 * sizes[i], scale);
+            snprintf(name, sizeof(name), "%s %d", inverse ? "inv" : "fwd",
+                    sizes[i]);
+            fails += check_report(name, t, t_ref, FFT_REPS, err, tol);
+        }
+    }
+    return fails ? -1 : 0;
+}
+
+/*
+ * The spectrum engine's triple buffer with a writer and a reader thread
+ * running flat out. Each frame the writer publishes is of a DC level
+ * set by its sequence number, held for the whole FFT window, so every
+ * bin of a frame can be checked against the sequence number the reader
+ * got with it. A torn frame or one handed over twice shows up as a bin
+ * from another frame or a sequence number that did not go up. The
+ * threads only overlap with more than one CPU.
+ */
+
+#define SPEC_FRAMES 50000
+#define SPEC_FPS 7                  /* Interval longer than the window. */
+#define SPEC_TOL_DB 0.001
+
+struct spec_stress {
+    struct freedv_spectrum *sp;
+    int interval;
+    int done;
+    double t_write;
+};
+
+/* DC level of frame seq, -40 to +20 dB. */
+static float spec_level(unsigned long seq) {
+    return 0.01 * (1 + seq % 997);
+}
+
+static void *spec_writer(void *arg) {
+    struct spec_stress *s = arg;
+    COMP in[FDMDV_NOM_SAMPLES_PER_FRAME];
+    unsigned long seq;
+    int i, n, left;
+    double t;
+
+    t = check_now();
+    for (seq = 1; seq <= SPEC_FRAMES; seq++) {
+        for (i = 0; i < FDMDV_NOM_SAMPLES_PER_FRAME; i++) {
+            in[i].real = spec_level(seq);
+            in[i].imag = 0.0;
+        }
+        for (left = s->interval; left > 0; left -= n) {
+            n = left < FDMDV_NOM_SAMPLES_PER_FRAME ? left :
+                    FDMDV_NOM_SAMPLES_PER_FRAME;
+            freedv_spectrum_write(s->sp, in, n);
+        }
+    }
+    s->t_write = check_now() - t;
+    __atomic_store_n(&s->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* 0 if mag_dB[] is frame seq: a Hann windowed DC level has all its
+ * power in bins 0 and 1, bin 1 a quarter of bin 0. The rest are at
+ * least 60 dB down, clear of the -120 dB floor. With beta 1.0 each
+ * frame is just its own FFT, so the only error is float rounding, far
+ * inside SPEC_TOL_DB, while every other frame's level is at least
+ * 0.008 dB away. */
+static int spec_frame_ok(const float mag_dB[], unsigned long seq) {
+    double level = 10 * log10((double)spec_level(seq) * spec_level(seq) +
+            1E-12);
+    int i;
+
+    if (fabs(mag_dB[0] - level) > SPEC_TOL_DB ||
+            fabs(mag_dB[1] - (level - 20 * log10(2.0))) > SPEC_TOL_DB)
+        return -1;
+    for (i = 2; i < FDMDV_NSPEC; i++)
+        if (mag_dB[i] > level - 60)
+            return -1;
+    return 0;
+}
+
+static int check_spectrum(const char *capture) {
+    struct spec_stress s;
+    pthread_t writer;
+    float mag_dB[FDMDV_NSPEC];
+    unsigned long seq, last = 0, reads = 0, empty = 0, torn = 0, order = 0;
+    int done;
+
+    printf("spectrum: triple buffer with concurrent writer and reader\n");
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2)
+        printf("  one CPU, the reader and writer only meet when preempted\n");
+    memset(&s, 0, sizeof(s));
+    s.sp = freedv_spectrum_create(SPEC_FPS, 1.0);
+    if (!s.sp)
+        return -1;
+    s.interval = 8000 / SPEC_FPS;
+    if (pthread_create(&writer, NULL, spec_writer, &s)) {
+        freedv_spectrum_destroy(s.sp);
+        return -1;
+    }
+
+    do {
+        done = __atomic_load_n(&s.done, __ATOMIC_ACQUIRE);
+        seq = freedv_spectrum_read(s.sp, mag_dB);
+        if (!seq) {
+            empty++;
+            continue;
+        }
+        reads++;
+        if (seq <= last)
+            order++;
+        last = seq;
+        if (spec_frame_ok(mag_dB, seq) < 0)
+            torn++;
+    } while (!done || seq);
+    pthread_join(writer, NULL);
+    freedv_spectrum_destroy(s.sp);
+
+    printf("  %d frames written, %.1f us each; %lu read, %lu empty polls\n",
+            SPEC_FRAMES, 1e6 * s.t_write / SPEC_FRAMES, reads, empty);
+    printf("  last frame read %lu, %lu out of order, %lu torn%s\n", last,
+            order, torn, (last != SPEC_FRAMES || order || torn) ?
+            "  FAIL" : "");
+    return (last != SPEC_FRAMES || order || torn) ? -1 : 0;
+}
+
+static const struct check checks[] = {
+    { "vec", "vec.h kernels against their scalar loops", 0, check_vec },
+    { "rxfilter", "rx_filter() against the shifting version", 0,
+        check_rxfilter },
+    { "timing", "rx_est_timing() against the shifting version", 1,
+        check_timing },
+    { "demod", "fdmdv_demod() per frame in COARSE and FINE", 1,
+        check_demod },
+    { "fft", "kiss_fft vector butterflies against scalar", 0, check_fft },
+    { "vq", "k-d tree LSP VQ search against exhaustive", 0, check_vq },
+    { "synth", "oscillator against FFT speech synthesis", 0, check_synth },
+    { "codec", "codec2 frames with kiss_fftr against complex FFTs", 0,
+        check_codec },
+    { "decbatch", "codec2_decode_batch() against per frame decoding", 0,
+        check_decbatch },
+    { "encode", "codec2_encode() with k-d tree against exhaustive VQ", 0,
+        check_encode },
+    { "nlp", "nlp() pitch estimator against three pass front end", 0,
+        check_nlp },
+    { "analysis", "analyse_one_frame() against per stage band limits", 0,
+        check_analysis },
+    { "spectrum", "spectrum triple buffer under a writer and a reader", 0,
+        check_spectrum },
+};
+
+#define NCHECKS ((int)(sizeof(checks) / sizeof(checks[0])))
+
+void freedv_check_list(FILE *f) {
+    int i;
+
+    for (i = 0; i < NCHECKS; i++)
+        fprintf(f, "  %-10s %s%s\n", checks[i].name, checks[i].desc,
+                checks[i].needs_capture ? " (needs -s capture.raw)" : "");
+}
+
+int freedv_check_run(const char *name, const char *capture) {
+    int all = !strcmp(name, "all");
+    int i, ran = 0, failed = 0;
+
+    for (i = 0; i < NCHECKS; i++) {
+        if (!all && strcmp(name, checks[i].name))
+            continue;
+        ran++;
+        if (checks[i].needs_capture && !capture) {
+            printf("%s: skipped, no capture\n", checks[i].name);
+            continue;
+        }
+        if (checks[i].run(capture) < 0) {
+            printf("%s: FAIL\n", checks[i].name);
+            failed++;
+        } else {
+            printf("%s: PASS\n", checks[i].name);
+        }
+    }
+    if (!ran) {
+        fprintf(stderr, "No check called %s, one of:\n", name);
+        freedv_check_list(stderr);
+        return -1;
+    }
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,25 @@
+#ifndef FREEDV_CHECK_H
+#define FREEDV_CHECK_H
+
+#include <stdio.h>
+
+/*
+ * Equivalence checks and micro-benchmarks for the optimised modem and
+ * codec kernels, run by freedv_cli -c. Each check runs a kernel and a
+ * plain reference version of it on the same input, prints how long
+ * each took and how far apart they were, and fails if they disagree by
+ * more than the kernel allows. Timings only mean something in an
+ * optimised build.
+ *
+ * capture is a 48 kHz 16-bit stereo recording for the checks that need
+ * modem audio. It may be NULL, those checks are then skipped.
+ */
+
+/* Runs the named check, or every check for "all". Returns 0 if all
+ * passed, -1 if any failed or name is not a check. */
+int freedv_check_run(const char *name, const char *capture);
+
+/* Lists the checks and what each covers. */
+void freedv_check_list(FILE *f);
+
+#endif
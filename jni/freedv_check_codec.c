@@ -0,0 +1,1172 @@
+/*
+ *
+ * Codec kernel equivalence checks and micro-benchmarks
+ * Copyright 2012 Joel Stanley <joel@jms.id.au>
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freedv/codec2.h"
+#include "freedv/defines.h"
+#include "freedv/nlp.h"
+#include "freedv/quantise.h"
+#include "freedv/sine.h"
+#include "freedv/vec.h"
+#include "freedv/codec2_internal.h"
+#include "freedv_check_internal.h"
+
+/*
+ * vec.h against the scalar loops it replaced, on vectors the size the
+ * modem and codec use. Sums are reassociated across lanes so only need
+ * to agree to float rounding; the searches must pick the same entry.
+ */
+
+#define VEC_N 160                   /* One modem frame at 8 kHz. */
+#define VEC_REPS 20000
+#define VEC_NRES 48                 /* Resonators, a multiple of 16. */
+#define VEC_CB 512                  /* Codebook entries. */
+#define VEC_K 10                    /* LSP order. */
+#define VEC_WO 1000                 /* Pitch candidates for harm_energy. */
+
+static float dot_ref(const float a[], const float b[], int n) {
+    float acc = 0.0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        acc += a[i] * b[i];
+    return acc;
+}
+
+static void osc_mix_ref(float ph_re[], float ph_im[], const float f_re[],
+        const float f_im[], float x_re, float x_im, float out_re[],
+        float out_im[], int n) {
+    float nr, ni;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        nr = ph_re[i] * f_re[i] - ph_im[i] * f_im[i];
+        ni = ph_re[i] * f_im[i] + ph_im[i] * f_re[i];
+        ph_re[i] = nr;
+        ph_im[i] = ni;
+        out_re[i] = x_re * nr + x_im * ni;
+        out_im[i] = x_im * nr - x_re * ni;
+    }
+}
+
+static void resonate_ref(float out[], int nsamp, const float c[], float y1[],
+        float y2[], int n) {
+    float t;
+    int i, h;
+
+    for (i = 0; i < nsamp; i++) {
+        out[i] = 0.0;
+        for (h = 0; h < n; h++) {
+            t = c[h] * y1[h] - y2[h];
+            y2[h] = y1[h];
+            y1[h] = t;
+            out[i] += t;
+        }
+    }
+}
+
+static void wdist_ref(float dist[], const float cb[], int m, const float x[],
+        const float w[], int k) {
+    float d;
+    int i, j;
+
+    for (j = 0; j < m; j++) {
+        dist[j] = 0.0;
+        for (i = 0; i < k; i++) {
+            d = (cb[j * k + i] - x[i]) * w[i];
+            dist[j] += d * d;
+        }
+    }
+}
+
+/* The search vec_nearest() stands in for, on a row-major codebook. */
+static int nearest_ref(const float cb[], int m, const float x[],
+        const float w[], int k) {
+    float dist, e, min_dist = 1e15;
+    int i, j, nearest = 0;
+
+    for (i = 0; i < m; i++) {
+        dist = 0.0;
+        for (j = 0; j < k; j++) {
+            e = x[j] - cb[i * k + j];
+            dist += w[j] * e * e;
+        }
+        if (dist < min_dist) {
+            min_dist = dist;
+            nearest = i;
+        }
+    }
+    return nearest;
+}
+
+static void box_dist_ref(float bnd[], const float lo[], const float hi[],
+        int n, const float x[], const float w[], int k) {
+    float e;
+    int b, j;
+
+    for (b = 0; b < n; b++) {
+        bnd[b] = 0.0;
+        for (j = 0; j < k; j++) {
+            e = 0.0;
+            if (x[j] < lo[j * n + b])
+                e = lo[j * n + b] - x[j];
+            if (x[j] > hi[j * n + b])
+                e = x[j] - hi[j * n + b];
+            bnd[b] += w[j] * e * e;
+        }
+    }
+}
+
+/* hs_pitch_refinement()'s sum before vec_harm_energy(). The bin was
+ * rounded with floor() in double, the kernel rounds in float. */
+static float harm_energy_ref(const float pw[], float Wo, float r, int L) {
+    float e = 0.0;
+    int m;
+
+    for (m = 1; m <= L; m++)
+        e += pw[(int)floor(m * Wo / r + 0.5)];
+    return e;
+}
+
+int check_vec(const char *capture) {
+    static float a[VEC_N], b[VEC_N], acc[VEC_N], acc_ref[VEC_N];
+    static float ph_re[VEC_N], ph_im[VEC_N], f_re[VEC_N], f_im[VEC_N];
+    static float out_re[VEC_N], out_im[VEC_N], ref_re[VEC_N], ref_im[VEC_N];
+    static float c[VEC_NRES], y1[VEC_NRES], y2[VEC_NRES];
+    static float r1[VEC_NRES], r2[VEC_NRES], out[VEC_N], out_ref[VEC_N];
+    static float cb[VEC_CB * VEC_K], cbt[VEC_CB * VEC_K], lo[VEC_CB * VEC_K],
+            hi[VEC_CB * VEC_K], dist[VEC_CB], dist_ref[VEC_CB];
+    static float pw[FFT_ENC];
+    float x[VEC_K], w[VEC_K], Wo[4], E[4], r, scale, e_ref;
+    unsigned seed = 1;
+    double t, t_ref, err;
+    int i, j, rep, fails = 0, wrong, rounding;
+
+    printf("vec: kernels against scalar loops, n = %d\n", VEC_N);
+    check_fill(a, VEC_N, &seed);
+    check_fill(b, VEC_N, &seed);
+
+    /* vec_dot, error relative to the sum of |a[i]*b[i]|. */
+    t = check_now();
+    for (rep = 0; rep < VEC_REPS; rep++)
+        check_sink = vec_dot(a, b, VEC_N - (rep & 1));
+    t = check_now() - t;
+    t_ref = check_now();
+    for (rep = 0; rep < VEC_REPS; rep++)
+        check_sink = dot_ref(a, b, VEC_N - (rep & 1));
+    t_ref = check_now() - t_ref;
+    for (scale = 0, i = 0; i < VEC_N; i++)
+        scale += fabs(a[i] * b[i]);
+    err = fabs(vec_dot(a, b, VEC_N) - dot_ref(a, b, VEC_N)) / scale;
+    fails += check_report("vec_dot", t, t_ref, VEC_REPS, err, 1e-6);
+
+    /* vec_mac, relative to the largest accumulator. */
+    memset(acc, 0, sizeof(acc));
+    t = check_now();
+    for (rep = 0; rep < VEC_REPS; rep++)
+        vec_mac(acc, a[rep % VEC_N], b, VEC_N);
+    t = check_now() - t;
+    memset(acc_ref, 0, sizeof(acc_ref));
+    t_ref = check_now();
+    for (rep = 0; rep < VEC_REPS; rep++)
+        for (i = 0; i < VEC_N; i++)
+            acc_ref[i] += a[rep % VEC_N] * b[i];
+    t_ref = check_now() - t_ref;
+    for (scale = 1e-9, i = 0; i < VEC_N; i++)
+        if (fabs(acc_ref[i]) > scale)
+            scale = fabs(acc_ref[i]);
+    fails += check_report("vec_mac", t, t_ref, VEC_REPS,
+            check_max_diff(acc, acc_ref, VEC_N, scale), 1e-6);
+
+    /* vec_osc_mix, VEC_N oscillators stepped and mixed once from the
+     * same phases, then each timed on its own copy. */
+    for (i = 0; i < VEC_N; i++) {
+        f_re[i] = cos(0.01 * i);
+        f_im[i] = sin(0.01 * i);
+        ph_re[i] = acc[i] = cos(0.1 * i);
+        ph_im[i] = acc_ref[i] = sin(0.1 * i);
+    }
+    vec_osc_mix(ph_re, ph_im, f_re, f_im, a[0], b[0], out_re, out_im, VEC_N);
+    osc_mix_ref(acc, acc_ref, f_re, f_im, a[0], b[0], ref_re, ref_im, VEC_N);
+    err = check_max_diff(out_re, ref_re, VEC_N, 1.0);
+    if (check_max_diff(out_im, ref_im, VEC_N, 1.0) > err)
+        err = check_max_diff(out_im, ref_im, VEC_N, 1.0);
+    t = check_now();
+    for (rep = 0; rep < VEC_REPS; rep++)
+        vec_osc_mix(ph_re, ph_im, f_re, f_im, a[rep % VEC_N], b[rep % VEC_N],
+                out_re, out_im, VEC_N);
+    t = check_now() - t;
+    t_ref = check_now();
+    for (rep = 0; rep < VEC_REPS; rep++)
+        osc_mix_ref(acc, acc_ref, f_re, f_im, a[rep % VEC_N], b[rep % VEC_N],
+                ref_re, ref_im, VEC_N);
+    t_ref = check_now() - t_ref;
+    fails += check_report("vec_osc_mix", t, t_ref, VEC_REPS, err, 1e-6);
+
+    /* vec_normalise, a reciprocal square root estimate plus refinement. */
+    check_fill(out_re, VEC_N, &seed);
+    check_fill(out_im, VEC_N, &seed);
+    t = check_now();
+    for (rep = 0; rep < VEC_REPS; rep++)
+        vec_normalise(out_re, out_im, VEC_N);
+    t = check_now() - t;
+    for (err = 0, i = 0; i < VEC_N; i++) {
+        double mag = sqrt(out_re[i] * out_re[i] + out_im[i] * out_im[i]);
+        if (fabs(mag - 1.0) > err)
+            err = fabs(mag - 1.0);
+    }
+    t_ref = check_now();
+    for (rep = 0; rep < VEC_REPS; rep++)
+        for (i = 0; i < VEC_N; i++) {
+            float g = 1.0 / sqrtf(out_re[i] * out_re[i] + out_im[i] * out_im[i]);
+            out_re[i] *= g;
+            out_im[i] *= g;
+        }
+    t_ref = check_now() - t_ref;
+    fails += check_report("vec_normalise", t, t_ref, VEC_REPS, err, 1e-6);
+
+    /* vec_resonate, VEC_NRES unit sines over a frame. The kernel takes
+     * two samples per step, so errors grow with the frame length; they
+     * are relative to the largest possible output. */
+    for (i = 0; i < VEC_NRES; i++) {
+        float wo = 0.05 + 3.0 * i / VEC_NRES;
+        c[i] = 2.0 * cos(wo);
+        y1[i] = r1[i] = sin(-wo);
+        y2[i] = r2[i] = sin(-2.0 * wo);
+    }
+    vec_resonate(out, VEC_N, c, y1, y2, VEC_NRES);
+    resonate_ref(out_ref, VEC_N, c, r1, r2, VEC_NRES);
+    err = check_max_diff(out, out_ref, VEC_N, VEC_NRES);
+    t = check_now();
+    for (rep = 0; rep < VEC_REPS; rep++)
+        vec_resonate(out, VEC_N, c, y1, y2, VEC_NRES);
+    t = check_now() - t;
+    t_ref = check_now();
+    for (rep = 0; rep < VEC_REPS; rep++)
+        resonate_ref(out_ref, VEC_N, c, r1, r2, VEC_NRES);
+    t_ref = check_now() - t_ref;
+    fails += check_report("vec_resonate", t, t_ref, VEC_REPS, err, 1e-5);
+
+    /* vec_wdist over a codebook, relative to the largest distance. */
+    check_fill(cb, VEC_CB * VEC_K, &seed);
+    check_fill(x, VEC_K, &seed);
+    for (i = 0; i < VEC_K; i++)
+        w[i] = 1.0 + check_frand(&seed) * 0.5;
+    t = check_now();
+    for (rep = 0; rep < VEC_REPS / 100; rep++)
+        vec_wdist(dist, cb, VEC_CB, x, w, VEC_K);
+    t = check_now() - t;
+    t_ref = check_now();
+    for (rep = 0; rep < VEC_REPS / 100; rep++)
+        wdist_ref(dist_ref, cb, VEC_CB, x, w, VEC_K);
+    t_ref = check_now() - t_ref;
+    for (scale = 0, i = 0; i < VEC_CB; i++)
+        if (dist_ref[i] > scale)
+            scale = dist_ref[i];
+    fails += check_report("vec_wdist", t, t_ref, VEC_REPS / 100,
+            check_max_diff(dist, dist_ref, VEC_CB, scale), 1e-6);
+
+    /* vec_nearest must pick the same entry as the scalar search, for
+     * every one of VEC_REPS/10 random targets. */
+    for (i = 0; i < VEC_CB; i++)
+        for (j = 0; j < VEC_K; j++)
+            cbt[j * VEC_CB + i] = cb[i * VEC_K + j];
+    wrong = 0;
+    t = t_ref = 0;
+    for (rep = 0; rep < VEC_REPS / 10; rep++) {
+        double t0;
+        int n, n_ref;
+        check_fill(x, VEC_K, &seed);
+        t0 = check_now();
+        n = vec_nearest(cbt, VEC_CB, x, w, VEC_K);
+        t += check_now() - t0;
+        t0 = check_now();
+        n_ref = nearest_ref(cb, VEC_CB, x, w, VEC_K);
+        t_ref += check_now() - t0;
+        wrong += n != n_ref;
+    }
+    fails += check_report("vec_nearest", t, t_ref, VEC_REPS / 10, wrong, 0);
+
+    /* vec_box_dist, boxes around random pairs of codebook entries. */
+    for (i = 0; i < VEC_CB * VEC_K; i++) {
+        lo[i] = fminf(cb[i], cbt[i]);
+        hi[i] = fmaxf(cb[i], cbt[i]);
+    }
+    t = check_now();
+    for (rep = 0; rep < VEC_REPS / 100; rep++)
+        vec_box_dist(dist, lo, hi, VEC_CB, x, w, VEC_K);
+    t = check_now() - t;
+    t_ref = check_now();
+    for (rep = 0; rep < VEC_REPS / 100; rep++)
+        box_dist_ref(dist_ref, lo, hi, VEC_CB, x, w, VEC_K);
+    t_ref = check_now() - t_ref;
+    for (scale = 1e-9, i = 0; i < VEC_CB; i++)
+        if (dist_ref[i] > scale)
+            scale = dist_ref[i];
+    fails += check_report("vec_box_dist", t, t_ref, VEC_REPS / 100,
+            check_max_diff(dist, dist_ref, VEC_CB, scale), 1e-6);
+
+    /* vec_harm_energy over the pitch range hs_pitch_refinement()
+     * searches. Its bins are rounded in float where the old code used
+     * floor() in double, so a sum can land one bin over when m*Wo/r is
+     * within a float rounding of a half. Those are counted, not failed;
+     * any other difference fails. */
+    for (i = 0; i < FFT_ENC; i++)
+        pw[i] = check_frand(&seed) + 1.0;
+    r = TWO_PI / FFT_ENC;
+    wrong = rounding = 0;
+    t = t_ref = 0;
+    for (i = 0; i < VEC_WO; i += 4) {
+        double t0;
+        int L = PI / (TWO_PI / (P_MIN + i * (P_MAX - P_MIN) / (float)VEC_WO));
+        for (j = 0; j < 4; j++)
+            Wo[j] = TWO_PI / (P_MIN + (i + j) * (P_MAX - P_MIN) / (float)VEC_WO);
+        t0 = check_now();
+        vec_harm_energy(E, pw, Wo, r, L);
+        t += check_now() - t0;
+        t0 = check_now();
+        for (j = 0; j < 4; j++) {
+            e_ref = harm_energy_ref(pw, Wo[j], r, L);
+            if (E[j] != e_ref) {
+                float e = 0.0;
+                int m;
+                for (m = 1; m <= L; m++)
+                    e += pw[(int)(m * Wo[j] / r + 0.5f)];
+                if (E[j] == e)
+                    rounding++;
+                else
+                    wrong++;
+            }
+        }
+        t_ref += check_now() - t0;
+    }
+    fails += check_report("vec_harm_energy", t, t_ref, VEC_WO / 4, wrong, 0);
+    printf("  %d of %d harmonic sums differ from double rounding\n",
+            rounding, VEC_WO);
+
+    return fails ? -1 : 0;
+}
+
+/*
+ * encode_lsps_vq()'s k-d tree search against the exhaustive
+ * find_nearest() and find_nearest_weighted() it replaced, stage by
+ * stage, over random LSP vectors and codebook entries with noise added.
+ * The tree sums distances in a different order, so it may only pick a
+ * different entry when the two are the same distance apart to float
+ * rounding.
+ */
+
+#define VQ_N 200000                 /* Vectors in the corpus. */
+#define VQ_TIE 1e-5                 /* Relative distance counted as a tie. */
+
+/* Sorted LSPs, half drawn uniformly from (0, pi), half stage 1 entries
+ * moved by up to +-0.05 rad. */
+static void vq_corpus(float x[], int n, unsigned *seed) {
+    const float *cb = lsp_cbjvm[0].cb;
+    float t;
+    int v, i, j, e;
+
+    for (v = 0; v < n; v++, x += LPC_ORD) {
+        if (v & 1) {
+            e = (int)((check_frand(seed) + 1.0) * 0.5 * LSP_VQ_M) % LSP_VQ_M;
+            for (i = 0; i < LPC_ORD; i++)
+                x[i] = cb[e * LPC_ORD + i] + 0.05 * check_frand(seed);
+        } else {
+            for (i = 0; i < LPC_ORD; i++)
+                x[i] = (check_frand(seed) + 1.0) * 0.5 * PI;
+        }
+        for (i = 1; i < LPC_ORD; i++)
+            for (j = i; j > 0 && x[j] < x[j - 1]; j--) {
+                t = x[j];
+                x[j] = x[j - 1];
+                x[j - 1] = t;
+            }
+        for (i = 0; i < LPC_ORD; i++) {
+            if (x[i] < 0.001)
+                x[i] = 0.001;
+            if (x[i] > PI - 0.001)
+                x[i] = PI - 0.001;
+        }
+    }
+}
+
+static double vq_dist(const float cb[], int e, const float x[],
+        const float w[], int k) {
+    double d = 0.0, t;
+    int i;
+
+    for (i = 0; i < k; i++) {
+        t = x[i] - cb[e * k + i];
+        d += (w ? w[i] : 1.0) * t * t;
+    }
+    return d;
+}
+
+/* Returns 1 if entry n is further from x than entry n_ref, 0 if they
+ * are the same entry or tie. */
+static int vq_differs(const float cb[], int n, int n_ref, const float x[],
+        const float w[], int k, int *ties) {
+    double d, d_ref;
+
+    if (n == n_ref)
+        return 0;
+    d = vq_dist(cb, n, x, w, k);
+    d_ref = vq_dist(cb, n_ref, x, w, k);
+    if (d <= d_ref * (1.0 + VQ_TIE)) {
+        (*ties)++;
+        return 0;
+    }
+    return 1;
+}
+
+int check_vq(const char *capture) {
+    static LSP_VQ vq;
+    float *x, xq[LPC_ORD], w[LPC_ORD], err2[LPC_ORD / 2], err3[LPC_ORD / 2];
+    float w2[LPC_ORD / 2], w3[LPC_ORD / 2];
+    int *idx, *idx_ref, v, i, k, ties = 0, fails = 0;
+    unsigned seed = 1;
+    double t, t_ref;
+
+    printf("vq: k-d tree LSP VQ search against exhaustive\n");
+    x = malloc(VQ_N * LPC_ORD * sizeof(float));
+    idx = malloc(VQ_N * 3 * sizeof(int));
+    idx_ref = malloc(VQ_N * 3 * sizeof(int));
+    if (!x || !idx || !idx_ref) {
+        free(x);
+        free(idx);
+        free(idx_ref);
+        return -1;
+    }
+    lsp_vq_init(&vq);
+    vq_corpus(x, VQ_N, &seed);
+    k = LPC_ORD / 2;
+
+    t = check_now();
+    for (v = 0; v < VQ_N; v++)
+        encode_lsps_vq(&vq, &idx[3 * v], &x[v * LPC_ORD], xq, LPC_ORD);
+    t = check_now() - t;
+
+    /* Stages 2 and 3 search the error left by the tree's stage 1 entry,
+     * so a tie there doesn't throw the later stages off. */
+    t_ref = check_now();
+    for (v = 0; v < VQ_N; v++) {
+        compute_weights(&x[v * LPC_ORD], w, LPC_ORD);
+        idx_ref[3 * v] = find_nearest(lsp_cbjvm[0].cb, LSP_VQ_M,
+                &x[v * LPC_ORD], LPC_ORD);
+        for (i = 0; i < k; i++) {
+            err2[i] = x[v * LPC_ORD + 2 * i] -
+                    lsp_cbjvm[0].cb[idx[3 * v] * LPC_ORD + 2 * i];
+            err3[i] = x[v * LPC_ORD + 2 * i + 1] -
+                    lsp_cbjvm[0].cb[idx[3 * v] * LPC_ORD + 2 * i + 1];
+            w2[i] = w[2 * i];
+            w3[i] = w[2 * i + 1];
+        }
+        idx_ref[3 * v + 1] = find_nearest_weighted(lsp_cbjvm[1].cb, LSP_VQ_M,
+                err2, w2, k);
+        idx_ref[3 * v + 2] = find_nearest_weighted(lsp_cbjvm[2].cb, LSP_VQ_M,
+                err3, w3, k);
+
+        fails += vq_differs(lsp_cbjvm[0].cb, idx[3 * v], idx_ref[3 * v],
+                &x[v * LPC_ORD], NULL, LPC_ORD, &ties);
+        fails += vq_differs(lsp_cbjvm[1].cb, idx[3 * v + 1],
+                idx_ref[3 * v + 1], err2, w2, k, &ties);
+        fails += vq_differs(lsp_cbjvm[2].cb, idx[3 * v + 2],
+                idx_ref[3 * v + 2], err3, w3, k, &ties);
+    }
+    t_ref = check_now() - t_ref;
+
+    printf("  %d vectors, %d searches picked a tied entry\n", VQ_N, ties);
+    fails = check_report("encode_lsps_vq", t, t_ref, VQ_N, fails, 0);
+    free(x);
+    free(idx);
+    free(idx_ref);
+    return fails;
+}
+
+/*
+ * synthesise_osc() against synthesise(). A speech-like test signal is
+ * encoded in each mode and decoded once with each synthesiser, and the
+ * oscillator output must stay within SYNTH_MIN_SNR dB of the FFT output.
+ * Both synthesisers are also timed per call on frames of 10 to 79
+ * harmonics.
+ */
+
+#define SYNTH_SECS 10
+#define SYNTH_MIN_SNR 60.0
+#define SYNTH_REPS 20000
+
+/* A pulse train through three formant resonators, pitch gliding
+ * between 80 and 250 Hz, with every fifth 200 ms unvoiced noise. */
+static void make_speech(short s[], int n) {
+    static const float fc[3] = { 500, 1500, 2500 }, bw[3] = { 80, 120, 160 };
+    float y1[3] = { 0 }, y2[3] = { 0 }, a1[3], a2[3];
+    float phase = 0, x, y, f0;
+    unsigned seed = 1;
+    int i, k;
+
+    for (k = 0; k < 3; k++) {
+        float r = exp(-PI * bw[k] / 8000);
+        a1[k] = 2 * r * cos(TWO_PI * fc[k] / 8000);
+        a2[k] = -r * r;
+    }
+    for (i = 0; i < n; i++) {
+        f0 = 165 + 85 * sin(TWO_PI * i / (8000 * 1.7));
+        phase += f0 / 8000;
+        if ((i / 1600) % 5 == 4) {
+            x = 0.3 * check_frand(&seed);
+        } else {
+            x = phase >= 1.0;
+        }
+        if (phase >= 1.0)
+            phase -= 1.0;
+        for (k = 0; k < 3; k++) {
+            y = x + a1[k] * y1[k] + a2[k] * y2[k];
+            y2[k] = y1[k];
+            y1[k] = y;
+            x = y;
+        }
+        s[i] = 300 * x * (0.6 + 0.4 * sin(TWO_PI * i / 8000 * 3));
+    }
+}
+
+int check_synth(const char *capture) {
+    static const char *modes[] = { "3200", "2400", "1400", "1200" };
+    static const int L[] = { 10, 20, 40, 60, 79 };
+    static float Pn[2 * N], cos_tab[FFT_DEC], Sn_[2 * N], Sn_ref[2 * N];
+    struct CODEC2 *enc, *dec, *dec_osc;
+    kiss_fftr_cfg cfg;
+    unsigned char bits[8];
+    short *speech, out[320], out_osc[320];
+    double sig, noise, snr, err, t, t_ref;
+    unsigned seed = 1;
+    int mode, nsam, i, j, maxdiff, rep, fails = 0;
+    MODEL model;
+    char name[32];
+
+    printf("synth: oscillator against FFT synthesis\n");
+    speech = malloc(SYNTH_SECS * 8000 * sizeof(short));
+    if (!speech)
+        return -1;
+    make_speech(speech, SYNTH_SECS * 8000);
+
+    for (mode = 0; mode < 4; mode++) {
+        enc = codec2_create(mode);
+        dec = codec2_create(mode);
+        dec_osc = codec2_create(mode);
+        if (!enc || !dec || !dec_osc) {
+            free(speech);
+            return -1;
+        }
+        codec2_set_synthesis(dec_osc, CODEC2_SYNTH_OSC);
+        nsam = codec2_samples_per_frame(enc);
+
+        sig = noise = 0;
+        maxdiff = 0;
+        t = t_ref = 0;
+        for (i = 0; i + nsam <= SYNTH_SECS * 8000; i += nsam) {
+            double t0;
+            codec2_encode(enc, bits, &speech[i]);
+            t0 = check_now();
+            codec2_decode(dec, out, bits);
+            t_ref += check_now() - t0;
+            t0 = check_now();
+            codec2_decode(dec_osc, out_osc, bits);
+            t += check_now() - t0;
+            for (j = 0; j < nsam; j++) {
+                sig += (double)out[j] * out[j];
+                noise += (double)(out_osc[j] - out[j]) * (out_osc[j] - out[j]);
+                if (abs(out_osc[j] - out[j]) > maxdiff)
+                    maxdiff = abs(out_osc[j] - out[j]);
+            }
+        }
+        snr = noise ? 10 * log10(sig / noise) : 999;
+        printf("  %s: SNR %.1f dB, max difference %d%s\n", modes[mode], snr,
+                maxdiff, snr < SYNTH_MIN_SNR ? "  FAIL" : "");
+        fails += snr < SYNTH_MIN_SNR;
+        snprintf(name, sizeof(name), "decode %s", modes[mode]);
+        check_report(name, t, t_ref, i / nsam, 0, 0);
+        codec2_destroy(enc);
+        codec2_destroy(dec);
+        codec2_destroy(dec_osc);
+    }
+    free(speech);
+
+    /* One frame at a time, error relative to the largest FFT sample. */
+    cfg = kiss_fftr_alloc(FFT_DEC, 1, NULL, NULL);
+    if (!cfg)
+        return -1;
+    make_synthesis_window(Pn);
+    make_osc_table(cos_tab);
+    for (i = 0; i < 5; i++) {
+        model.L = L[i];
+        model.Wo = PI / (L[i] + 0.5);
+        model.voiced = 1;
+        for (j = 1; j <= L[i]; j++) {
+            model.A[j] = 1000 * (1.1 + check_frand(&seed));
+            model.phi[j] = PI * check_frand(&seed);
+        }
+        memset(Sn_, 0, sizeof(Sn_));
+        memset(Sn_ref, 0, sizeof(Sn_ref));
+        synthesise_osc(cos_tab, Sn_, &model, Pn, 0);
+        synthesise(cfg, Sn_ref, &model, Pn, 0);
+        for (err = 1e-9, j = 0; j < 2 * N; j++)
+            if (fabs(Sn_ref[j]) > err)
+                err = fabs(Sn_ref[j]);
+        err = check_max_diff(Sn_, Sn_ref, 2 * N, err);
+
+        t = check_now();
+        for (rep = 0; rep < SYNTH_REPS; rep++)
+            synthesise_osc(cos_tab, Sn_, &model, Pn, 1);
+        t = check_now() - t;
+        t_ref = check_now();
+        for (rep = 0; rep < SYNTH_REPS; rep++)
+            synthesise(cfg, Sn_ref, &model, Pn, 1);
+        t_ref = check_now() - t_ref;
+        snprintf(name, sizeof(name), "synthesise L=%d", L[i]);
+        fails += check_report(name, t, t_ref, SYNTH_REPS, err, 1e-4);
+    }
+    KISS_FFT_FREE(cfg);
+    return fails ? -1 : 0;
+}
+
+/*
+ * codec2_encode() and codec2_decode() per frame, with the real FFTs
+ * done by kiss_fftr against the full length complex FFTs they replaced,
+ * on the same synthetic speech as the synth check. Encoded bits must be
+ * identical; decoded speech may differ by one LSB from float rounding.
+ */
+
+#define CODEC_SECS 10
+
+int check_codec(const char *capture) {
+    static const char *modes[] = { "3200", "2400", "1400", "1200" };
+    struct CODEC2 *c2, *c2_ref;
+    unsigned char bits[8], bits_ref[8];
+    short *speech, out[320], out_ref[320];
+    double t_enc, t_enc_ref, t_dec, t_dec_ref, t0;
+    int mode, nsam, nbytes, i, j, frames, wrong, maxdiff, fails = 0;
+    char name[32];
+
+    printf("codec: kiss_fftr against complex FFTs\n");
+    speech = malloc(CODEC_SECS * 8000 * sizeof(short));
+    if (!speech)
+        return -1;
+    make_speech(speech, CODEC_SECS * 8000);
+
+    for (mode = 0; mode < 4; mode++) {
+        c2 = codec2_create(mode);
+        c2_ref = codec2_create(mode);
+        if (!c2 || !c2_ref) {
+            if (c2)
+                codec2_destroy(c2);
+            if (c2_ref)
+                codec2_destroy(c2_ref);
+            free(speech);
+            return -1;
+        }
+        nsam = codec2_samples_per_frame(c2);
+        nbytes = (codec2_bits_per_frame(c2) + 7) / 8;
+
+        t_enc = t_enc_ref = t_dec = t_dec_ref = 0;
+        frames = wrong = maxdiff = 0;
+        for (i = 0; i + nsam <= CODEC_SECS * 8000; i += nsam) {
+            kiss_fftr_use_complex(1);
+            t0 = check_now();
+            codec2_encode(c2_ref, bits_ref, &speech[i]);
+            t_enc_ref += check_now() - t0;
+            t0 = check_now();
+            codec2_decode(c2_ref, out_ref, bits_ref);
+            t_dec_ref += check_now() - t0;
+
+            kiss_fftr_use_complex(0);
+            t0 = check_now();
+            codec2_encode(c2, bits, &speech[i]);
+            t_enc += check_now() - t0;
+            t0 = check_now();
+            codec2_decode(c2, out, bits);
+            t_dec += check_now() - t0;
+
+            wrong += memcmp(bits, bits_ref, nbytes) != 0;
+            for (j = 0; j < nsam; j++)
+                if (abs(out[j] - out_ref[j]) > maxdiff)
+                    maxdiff = abs(out[j] - out_ref[j]);
+            frames++;
+        }
+        snprintf(name, sizeof(name), "encode %s", modes[mode]);
+        fails += check_report(name, t_enc, t_enc_ref, frames, wrong, 0);
+        snprintf(name, sizeof(name), "decode %s", modes[mode]);
+        fails += check_report(name, t_dec, t_dec_ref, frames, maxdiff, 1);
+        codec2_destroy(c2);
+        codec2_destroy(c2_ref);
+    }
+    free(speech);
+    return fails ? -1 : 0;
+}
+
+/*
+ * codec2_decode_batch() against codec2_decode() called once per frame,
+ * in frames per second, decoding the same bits DECBATCH_FRAMES frames
+ * at a time. The output must be identical.
+ */
+
+#define DECBATCH_FRAMES 50
+
+int check_decbatch(const char *capture) {
+    static const char *modes[] = { "3200", "2400", "1400", "1200" };
+    struct CODEC2 *c2, *c2_ref;
+    unsigned char *bits;
+    short *speech, *out, *out_ref;
+    double t, t_ref, t0;
+    int mode, nsam, nbytes, i, f, frames, wrong, fails = 0;
+    char name[32];
+
+    printf("decbatch: codec2_decode_batch() against codec2_decode()\n");
+    speech = malloc(CODEC_SECS * 8000 * sizeof(short));
+    out = malloc(CODEC_SECS * 8000 * sizeof(short));
+    out_ref = malloc(CODEC_SECS * 8000 * sizeof(short));
+    bits = malloc(CODEC_SECS * 8000);
+    if (!speech || !out || !out_ref || !bits) {
+        free(speech);
+        free(out);
+        free(out_ref);
+        free(bits);
+        return -1;
+    }
+    make_speech(speech, CODEC_SECS * 8000);
+
+    for (mode = 0; mode < 4; mode++) {
+        c2 = codec2_create(mode);
+        c2_ref = codec2_create(mode);
+        if (!c2 || !c2_ref) {
+            if (c2)
+                codec2_destroy(c2);
+            if (c2_ref)
+                codec2_destroy(c2_ref);
+            fails++;
+            break;
+        }
+        nsam = codec2_samples_per_frame(c2);
+        nbytes = (codec2_bits_per_frame(c2) + 7) / 8;
+        frames = CODEC_SECS * 8000 / nsam;
+        frames -= frames % DECBATCH_FRAMES;
+        for (f = 0; f < frames; f++)
+            codec2_encode(c2, &bits[f * nbytes], &speech[f * nsam]);
+
+        t = t_ref = 0;
+        for (f = 0; f < frames; f += DECBATCH_FRAMES) {
+            t0 = check_now();
+            codec2_decode_batch(c2, &out[f * nsam], &bits[f * nbytes],
+                    DECBATCH_FRAMES);
+            t += check_now() - t0;
+            t0 = check_now();
+            for (i = f; i < f + DECBATCH_FRAMES; i++)
+                codec2_decode(c2_ref, &out_ref[i * nsam], &bits[i * nbytes]);
+            t_ref += check_now() - t0;
+        }
+        wrong = memcmp(out, out_ref, frames * nsam * sizeof(short)) != 0;
+        printf("  %s: %.0f frames/s, per frame %.0f frames/s\n", modes[mode],
+                frames / t, frames / t_ref);
+        snprintf(name, sizeof(name), "decode %s", modes[mode]);
+        fails += check_report(name, t, t_ref, frames, wrong, 0);
+        codec2_destroy(c2);
+        codec2_destroy(c2_ref);
+    }
+    free(speech);
+    free(out);
+    free(out_ref);
+    free(bits);
+    return fails ? -1 : 0;
+}
+
+/*
+ * codec2_encode() in the two modes that share the codec2 analysis, 2400
+ * with its scalar LSP quantiser and 1200 with the lsp_cbjvm[] VQ, with
+ * encode_lsps_vq() searching the k-d tree against searching every
+ * entry. Encoded bits must be identical.
+ */
+
+int check_encode(const char *capture) {
+    static const int modes[] = { CODEC2_MODE_2400, CODEC2_MODE_1200 };
+    static const char *names[] = { "2400", "1200" };
+    struct CODEC2 *c2, *c2_ref;
+    unsigned char bits[8], bits_ref[8];
+    short *speech;
+    double t, t_ref, t0;
+    int m, nsam, nbytes, i, frames, wrong, fails = 0;
+    char name[32];
+
+    printf("encode: codec2_encode() with k-d tree against exhaustive VQ\n");
+    speech = malloc(CODEC_SECS * 8000 * sizeof(short));
+    if (!speech)
+        return -1;
+    make_speech(speech, CODEC_SECS * 8000);
+
+    for (m = 0; m < 2; m++) {
+        c2 = codec2_create(modes[m]);
+        c2_ref = codec2_create(modes[m]);
+        if (!c2 || !c2_ref) {
+            if (c2)
+                codec2_destroy(c2);
+            if (c2_ref)
+                codec2_destroy(c2_ref);
+            free(speech);
+            return -1;
+        }
+        c2_ref->lsp_vq.exhaustive = 1;
+        nsam = codec2_samples_per_frame(c2);
+        nbytes = (codec2_bits_per_frame(c2) + 7) / 8;
+
+        t = t_ref = 0;
+        frames = wrong = 0;
+        for (i = 0; i + nsam <= CODEC_SECS * 8000; i += nsam) {
+            t0 = check_now();
+            codec2_encode(c2, bits, &speech[i]);
+            t += check_now() - t0;
+            t0 = check_now();
+            codec2_encode(c2_ref, bits_ref, &speech[i]);
+            t_ref += check_now() - t0;
+            wrong += memcmp(bits, bits_ref, nbytes) != 0;
+            frames++;
+        }
+        printf("  %s: %.0f frames/s, exhaustive %.0f frames/s\n", names[m],
+                frames / t, frames / t_ref);
+        snprintf(name, sizeof(name), "encode %s", names[m]);
+        fails += check_report(name, t, t_ref, frames, wrong, 0);
+        codec2_destroy(c2);
+        codec2_destroy(c2_ref);
+    }
+    free(speech);
+    return fails ? -1 : 0;
+}
+
+/*
+ * nlp() against the version that squared, notched and FIR filtered in
+ * three passes, shifting the FIR memory down for every sample, and
+ * computed the DFT window on every call. Both see the same speech,
+ * shifted in N samples at a time as analyse_one_frame() does, and
+ * must return the same pitch.
+ */
+
+#define NLP_REF_COEFF 0.95
+#define NLP_REF_FFT 512
+#define NLP_REF_DEC 5
+#define NLP_REF_NTAP 48
+
+extern const float nlp_fir[];
+float post_process_sub_multiples(COMP Fw[], int pmin, int pmax, float gmax,
+        int gmax_bin, float *prev_Wo);
+
+struct nlp_ref {
+    float sq[M];
+    float mem_x, mem_y;
+    float mem_fir[NLP_REF_NTAP];
+    kiss_fftr_cfg fft_cfg;
+};
+
+static float nlp_ref(struct nlp_ref *nlp, float Sn[], int n, int m,
+        int pmin, int pmax, float *pitch, float *prev_Wo) {
+    float fw[NLP_REF_FFT], notch, gmax, best_f0;
+    COMP Fw[NLP_REF_FFT / 2 + 1];
+    int i, j, gmax_bin;
+
+    for (i = m - n; i < m; i++)
+        nlp->sq[i] = Sn[i] * Sn[i];
+
+    for (i = m - n; i < m; i++) {
+        notch = nlp->sq[i] - nlp->mem_x;
+        notch += NLP_REF_COEFF * nlp->mem_y;
+        nlp->mem_x = nlp->sq[i];
+        nlp->mem_y = notch;
+        nlp->sq[i] = notch + 1.0;
+    }
+
+    for (i = m - n; i < m; i++) {
+        for (j = 0; j < NLP_REF_NTAP - 1; j++)
+            nlp->mem_fir[j] = nlp->mem_fir[j + 1];
+        nlp->mem_fir[NLP_REF_NTAP - 1] = nlp->sq[i];
+
+        nlp->sq[i] = 0.0;
+        for (j = 0; j < NLP_REF_NTAP; j++)
+            nlp->sq[i] += nlp->mem_fir[j] * nlp_fir[j];
+    }
+
+    for (i = 0; i < NLP_REF_FFT; i++)
+        fw[i] = 0.0;
+    for (i = 0; i < m / NLP_REF_DEC; i++)
+        fw[i] = nlp->sq[i * NLP_REF_DEC] *
+                (0.5 - 0.5 * cos(2 * PI * i / (m / NLP_REF_DEC - 1)));
+
+    kiss_fftr(nlp->fft_cfg, fw, (kiss_fft_cpx *)Fw);
+    for (i = 0; i <= NLP_REF_FFT / 2; i++)
+        Fw[i].real = Fw[i].real * Fw[i].real + Fw[i].imag * Fw[i].imag;
+
+    gmax = 0.0;
+    gmax_bin = NLP_REF_FFT * NLP_REF_DEC / pmax;
+    for (i = NLP_REF_FFT * NLP_REF_DEC / pmax;
+            i <= NLP_REF_FFT * NLP_REF_DEC / pmin; i++) {
+        if (Fw[i].real > gmax) {
+            gmax = Fw[i].real;
+            gmax_bin = i;
+        }
+    }
+    best_f0 = post_process_sub_multiples(Fw, pmin, pmax, gmax, gmax_bin,
+            prev_Wo);
+
+    for (i = 0; i < m - n; i++)
+        nlp->sq[i] = nlp->sq[i + n];
+
+    *pitch = 8000.0 / best_f0;
+    return best_f0;
+}
+
+int check_nlp(const char *capture) {
+    static struct nlp_ref ref;
+    float Sn[M], pitch, pitch_ref, prev_Wo = 0, prev_Wo_ref = 0;
+    short *speech;
+    double t, t_ref, t0;
+    int i, j, frames, wrong;
+    void *st;
+
+    printf("nlp: nlp() against three pass front end\n");
+    speech = malloc(CODEC_SECS * 8000 * sizeof(short));
+    st = nlp_create(M);
+    memset(&ref, 0, sizeof(ref));
+    ref.fft_cfg = kiss_fftr_alloc(NLP_REF_FFT, 0, NULL, NULL);
+    if (!speech || !st || !ref.fft_cfg) {
+        free(speech);
+        if (st)
+            nlp_destroy(st);
+        KISS_FFT_FREE(ref.fft_cfg);
+        return -1;
+    }
+    make_speech(speech, CODEC_SECS * 8000);
+    memset(Sn, 0, sizeof(Sn));
+
+    t = t_ref = 0;
+    frames = wrong = 0;
+    for (i = 0; i + N <= CODEC_SECS * 8000; i += N) {
+        for (j = 0; j < M - N; j++)
+            Sn[j] = Sn[j + N];
+        for (j = 0; j < N; j++)
+            Sn[M - N + j] = speech[i + j];
+
+        t0 = check_now();
+        nlp(st, Sn, N, M, P_MIN, P_MAX, &pitch, NULL, NULL, &prev_Wo);
+        t += check_now() - t0;
+        t0 = check_now();
+        nlp_ref(&ref, Sn, N, M, P_MIN, P_MAX, &pitch_ref, &prev_Wo_ref);
+        t_ref += check_now() - t0;
+
+        wrong += pitch != pitch_ref;
+        prev_Wo = TWO_PI / pitch;
+        prev_Wo_ref = TWO_PI / pitch_ref;
+        frames++;
+    }
+    printf("  %d frames, %d pitch estimates differ\n", frames, wrong);
+    nlp_destroy(st);
+    KISS_FFT_FREE(ref.fft_cfg);
+    free(speech);
+    return check_report("nlp", t, t_ref, frames, wrong, 0);
+}
+
+/*
+ * analyse_one_frame() against the analysis stage before it shared a
+ * HARM_MAP: pitch refinement squaring Sw[] for every candidate, and
+ * amplitude and voicing estimation working out their own band limits
+ * with floor() and ceil(). Both use the same DFT and NLP, each codec
+ * instance keeping its own state, and the MODEL each frame must be
+ * byte identical.
+ */
+
+void analyse_one_frame(struct CODEC2 *c2, MODEL *model, short speech[]);
+
+static void hs_refine_ref(MODEL *model, COMP Sw[], float pmin, float pmax,
+        float pstep) {
+    float E, Wo, Wom, Em, r, p;
+    int m, b;
+
+    model->L = PI / model->Wo;
+    Wom = model->Wo;
+    Em = 0.0;
+    r = TWO_PI / FFT_ENC;
+    for (p = pmin; p <= pmax; p += pstep) {
+        E = 0.0;
+        Wo = TWO_PI / p;
+        for (m = 1; m <= model->L; m++) {
+            b = floor(m * Wo / r + 0.5);
+            E += Sw[b].real * Sw[b].real + Sw[b].imag * Sw[b].imag;
+        }
+        if (E > Em) {
+            Em = E;
+            Wom = Wo;
+        }
+    }
+    model->Wo = Wom;
+}
+
+static void amplitudes_ref(MODEL *model, COMP Sw[], COMP W[]) {
+    float den, r;
+    int i, m, am, bm, b, offset;
+    COMP Am;
+
+    r = TWO_PI / FFT_ENC;
+    for (m = 1; m <= model->L; m++) {
+        am = floor((m - 0.5) * model->Wo / r + 0.5);
+        bm = floor((m + 0.5) * model->Wo / r + 0.5);
+        b = floor(m * model->Wo / r + 0.5);
+        den = 0.0;
+        Am.real = Am.imag = 0.0;
+        for (i = am; i < bm; i++) {
+            den += Sw[i].real * Sw[i].real + Sw[i].imag * Sw[i].imag;
+            offset = i + FFT_ENC / 2 - floor(m * model->Wo / r + 0.5);
+            Am.real += Sw[i].real * W[offset].real;
+            Am.imag += Sw[i].imag * W[offset].real;
+        }
+        check_sink = Am.real + Am.imag;
+        model->A[m] = sqrt(den);
+        model->phi[m] = atan2(Sw[b].imag, Sw[b].real);
+    }
+}
+
+static void voicing_ref(MODEL *model, COMP Sw[], COMP W[], COMP Sw_[],
+        COMP Ew[]) {
+    float den, error, Wo, sig, snr, elow, ehigh, eratio;
+    int i, l, al, bl, m, offset;
+    COMP Am;
+
+    sig = 1E-4;
+    for (l = 1; l <= model->L / 4; l++)
+        sig += model->A[l] * model->A[l];
+    for (i = 0; i < FFT_ENC; i++) {
+        Sw_[i].real = Sw_[i].imag = 0.0;
+        Ew[i].real = Ew[i].imag = 0.0;
+    }
+
+    Wo = model->Wo;
+    error = 1E-4;
+    for (l = 1; l <= model->L / 4; l++) {
+        Am.real = Am.imag = 0.0;
+        den = 0.0;
+        al = ceil((l - 0.5) * Wo * FFT_ENC / TWO_PI);
+        bl = ceil((l + 0.5) * Wo * FFT_ENC / TWO_PI);
+        for (m = al; m < bl; m++) {
+            offset = FFT_ENC / 2 + m - l * Wo * FFT_ENC / TWO_PI + 0.5;
+            Am.real += Sw[m].real * W[offset].real +
+                    Sw[m].imag * W[offset].imag;
+            Am.imag += Sw[m].imag * W[offset].real -
+                    Sw[m].real * W[offset].imag;
+            den += W[offset].real * W[offset].real +
+                    W[offset].imag * W[offset].imag;
+        }
+        Am.real = Am.real / den;
+        Am.imag = Am.imag / den;
+        for (m = al; m < bl; m++) {
+            offset = FFT_ENC / 2 + m - l * Wo * FFT_ENC / TWO_PI + 0.5;
+            Sw_[m].real = Am.real * W[offset].real - Am.imag * W[offset].imag;
+            Sw_[m].imag = Am.real * W[offset].imag + Am.imag * W[offset].real;
+            Ew[m].real = Sw[m].real - Sw_[m].real;
+            Ew[m].imag = Sw[m].imag - Sw_[m].imag;
+            error += Ew[m].real * Ew[m].real;
+            error += Ew[m].imag * Ew[m].imag;
+        }
+    }
+
+    snr = 10.0 * log10(sig / error);
+    model->voiced = snr > V_THRESH;
+
+    elow = ehigh = 1E-4;
+    for (l = 1; l <= model->L / 2; l++)
+        elow += model->A[l] * model->A[l];
+    for (l = model->L / 2; l <= model->L; l++)
+        ehigh += model->A[l] * model->A[l];
+    eratio = 10.0 * log10(elow / ehigh);
+    if (model->voiced == 0 && eratio > 10.0)
+        model->voiced = 1;
+    if (model->voiced == 1) {
+        if (eratio < -10.0)
+            model->voiced = 0;
+        if (eratio < -4.0 && model->Wo <= 60.0 * TWO_PI / FS)
+            model->voiced = 0;
+    }
+}
+
+static void analyse_ref(struct CODEC2 *c2, MODEL *model, short speech[]) {
+    COMP Sw[FFT_ENC], Sw_[FFT_ENC], Ew[FFT_ENC];
+    float pitch;
+    int i;
+
+    for (i = 0; i < M - N; i++)
+        c2->Sn[i] = c2->Sn[i + N];
+    for (i = 0; i < N; i++)
+        c2->Sn[i + M - N] = speech[i];
+    dft_speech(c2->fft_fwd_cfg, Sw, c2->Sn, c2->w);
+
+    nlp(c2->nlp, c2->Sn, N, M, P_MIN, P_MAX, &pitch, Sw, c2->W,
+            &c2->prev_Wo_enc);
+    model->Wo = TWO_PI / pitch;
+    model->L = PI / model->Wo;
+
+    hs_refine_ref(model, Sw, TWO_PI / model->Wo - 5, TWO_PI / model->Wo + 5,
+            1.0);
+    hs_refine_ref(model, Sw, TWO_PI / model->Wo - 1, TWO_PI / model->Wo + 1,
+            0.25);
+    if (model->Wo < TWO_PI / P_MAX)
+        model->Wo = TWO_PI / P_MAX;
+    if (model->Wo > TWO_PI / P_MIN)
+        model->Wo = TWO_PI / P_MIN;
+    model->L = floor(PI / model->Wo);
+
+    amplitudes_ref(model, Sw, c2->W);
+    voicing_ref(model, Sw, c2->W, Sw_, Ew);
+    c2->prev_Wo_enc = model->Wo;
+}
+
+int check_analysis(const char *capture) {
+    struct CODEC2 *c2, *c2_ref;
+    MODEL model, model_ref;
+    short *speech;
+    double t, t_ref, t0;
+    int i, frames, wrong;
+
+    printf("analysis: analyse_one_frame() against per stage band limits\n");
+    speech = malloc(CODEC_SECS * 8000 * sizeof(short));
+    c2 = codec2_create(CODEC2_MODE_3200);
+    c2_ref = codec2_create(CODEC2_MODE_3200);
+    if (!speech || !c2 || !c2_ref) {
+        free(speech);
+        if (c2)
+            codec2_destroy(c2);
+        if (c2_ref)
+            codec2_destroy(c2_ref);
+        return -1;
+    }
+    make_speech(speech, CODEC_SECS * 8000);
+
+    t = t_ref = 0;
+    frames = wrong = 0;
+    for (i = 0; i + N <= CODEC_SECS * 8000; i += N) {
+        memset(&model, 0, sizeof(model));
+        memset(&model_ref, 0, sizeof(model_ref));
+        t0 = check_now();
+        analyse_one_frame(c2, &model, &speech[i]);
+        t += check_now() - t0;
+        t0 = check_now();
+        analyse_ref(c2_ref, &model_ref, &speech[i]);
+        t_ref += check_now() - t0;
+        wrong += memcmp(&model, &model_ref, sizeof(model)) != 0;
+        frames++;
+    }
+    printf("  %d frames, %d models differ\n", frames, wrong);
+    codec2_destroy(c2);
+    codec2_destroy(c2_ref);
+    free(speech);
+    return check_report("analyse_one_frame", t, t_ref, frames, wrong, 0);
+}
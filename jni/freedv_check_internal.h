@@ -0,0 +1,37 @@
+#ifndef FREEDV_CHECK_INTERNAL_H
+#define FREEDV_CHECK_INTERNAL_H
+
+/* Shared by the freedv_check*.c files. */
+
+double check_now(void);
+
+/* Uniform in [-1, 1), the same sequence on every run. */
+float check_frand(unsigned *seed);
+void check_fill(float x[], int n, unsigned *seed);
+
+/* Largest difference between a[] and b[], relative to scale. */
+double check_max_diff(const float a[], const float b[], int n, double scale);
+
+/* Stops the compiler throwing away results that are only timed. */
+extern volatile float check_sink;
+
+/*
+ * Prints one line of a check: the time per call of the kernel and the
+ * reference over reps calls, and err, how far the kernel was from the
+ * reference on whatever scale tol is given in. Returns -1 if err is
+ * over tol.
+ */
+int check_report(const char *name, double t, double t_ref, int reps,
+        double err, double tol);
+
+/* Codec checks, in freedv_check_codec.c. */
+int check_vec(const char *capture);
+int check_vq(const char *capture);
+int check_synth(const char *capture);
+int check_codec(const char *capture);
+int check_decbatch(const char *capture);
+int check_encode(const char *capture);
+int check_nlp(const char *capture);
+int check_analysis(const char *capture);
+
+#endif
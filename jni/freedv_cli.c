@@ -8,7 +8,9 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
@@ -16,61 +18,488 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/prctl.h>
+#include <time.h>
 #include <unistd.h>
 
-#include <libusb.h>
-
 #include "freedv_usb.h"
+#include "freedv_check.h"
 #include "freedv_decode.h"
+#include "freedv_pool.h"
+#include "freedv_spectrum.h"
+#include "freedv_wideband.h"
 
 #define UNUSED __attribute__((unused))
 
 #define MAX_EVENTS 8
 
+/* 48 kHz 16-bit stereo. */
+#define BYTES_PER_MS 192
+
 struct app_ctx {
     int quitfd;
     int audiofd;
     int logfd;
+    int speechfd;
     pthread_t usb_thread;
     pthread_t freedv_thread;
+    pthread_t spectrum_thread;
+    struct freedv_rx *rx;
+    struct freedv_spectrum *spectrum;
+    FILE *spectrum_file;
+    int done;                       /* Set once freedv_thread has exited. */
 };
 
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 #define SAMPLES_PER_FRAME 160
 static void *freedv_thread_entry(void *data) {
     struct app_ctx *ctx = (struct app_ctx *)data;
+    unsigned long overruns = 0;
+    size_t max_queued = 0;
+    double start = now();
+    struct usb_stats stats;
     fprintf(stderr, "freedv_thread started\n");
     prctl(PR_SET_NAME, "freedv_thread");
     while (1) {
-#if 0
-        uint8_t buf[1];
-        if (read(ctx->quitfd, buf, 1) != -EAGAIN) {
-            fprintf(stderr, "freedv_thread: exit due to quitfd\n");
-            break;
-        }
-#endif
-
-        /* Blocking read on the socket. */
+        /* Blocks until the USB callback has queued some audio. */
         uint16_t frame[SAMPLES_PER_FRAME];
-        int rc = read(ctx->audiofd, frame, SAMPLES_PER_FRAME*sizeof(uint16_t));
-        if (rc != -EAGAIN) {
-            fprintf(stderr, "freedv_thread: exit\n");
+        int rc = usb_read(frame, sizeof(frame));
+        if (rc <= 0) {
+            if (rc < 0)
+                fprintf(stderr, "freedv_thread: usb_read: %d\n", rc);
             break;
         }
-        fprintf(stderr, "Read %d bytes\n", rc);
-        rc = write(ctx->logfd, frame, sizeof(frame));
+        int nbytes = rc;
+        rc = write(ctx->audiofd, frame, nbytes);
         if (rc < 0) {
-            perror("freedv_thread: Write to logfd");
+            perror("freedv_thread: Write to audiofd");
+            break;
+        }
+
+        /* Straight from packet bytes to the modem at 8 kHz. */
+        short speech[2*SAMPLES_PER_FRAME];
+        int nspeech = freedv_rx_decode_48k_stereo(ctx->rx, speech,
+                2*SAMPLES_PER_FRAME, (uint8_t *)frame, nbytes);
+        if (ctx->speechfd >= 0 && nspeech > 0 &&
+                write(ctx->speechfd, speech, nspeech*sizeof(short)) < 0) {
+            perror("freedv_thread: Write to speechfd");
             break;
-       } else if (rc != sizeof(frame)) {
-           fprintf(stderr, "freedv_thread: Wrote %d, not %ld\n", rc,
-                   sizeof(frame));
-           break;
-       }
+        }
+
+        usb_get_stats(&stats);
+        if (stats.queued > max_queued)
+            max_queued = stats.queued;
+        if (stats.overruns != overruns) {
+            fprintf(stderr, "freedv_thread: %lu overruns (%lu bytes dropped)\n",
+                    stats.overruns, stats.dropped);
+            overruns = stats.overruns;
+        }
     }
+
+    usb_get_stats(&stats);
+    fprintf(stderr, "%llu bytes in %.2f s => %.0f bytes/sec, max queue %zu "
+            "bytes (%zu ms), %lu overruns, %lu packet errors\n",
+            stats.bytes, now() - start, stats.bytes / (now() - start),
+            max_queued, max_queued / BYTES_PER_MS, stats.overruns,
+            stats.packet_errors);
     fprintf(stderr, "freedv_thread exiting\n");
     return NULL;
 }
 
+/* Spectrum smoothing, as the GUI's waterfall uses. */
+#define SPECTRUM_BETA 0.1
+
+/* Writes each spectrum frame the demod publishes as a line of its
+ * sequence number and FDMDV_NSPEC bins in dB, until decoding stops. */
+static void *spectrum_thread_entry(void *data) {
+    struct app_ctx *ctx = (struct app_ctx *)data;
+    float mag_dB[FDMDV_NSPEC];
+    unsigned long seq;
+    int done, i;
+
+    prctl(PR_SET_NAME, "spectrum_thread");
+    do {
+        done = __atomic_load_n(&ctx->done, __ATOMIC_ACQUIRE);
+        seq = freedv_spectrum_read(ctx->spectrum, mag_dB);
+        if (!seq) {
+            usleep(1000000 / FREEDV_SPECTRUM_FPS / 4);
+            continue;
+        }
+        fprintf(ctx->spectrum_file, "%lu", seq);
+        for (i = 0; i < FDMDV_NSPEC; i++)
+            fprintf(ctx->spectrum_file, " %.1f", mag_dB[i]);
+        fprintf(ctx->spectrum_file, "\n");
+    } while (!done || seq);
+    return NULL;
+}
+
+/* 20 ms of 48 kHz 16-bit stereo, one modem frame. */
+#define LOAD_BLOCK (20 * BYTES_PER_MS)
+
+/* Reads a whole capture file, at least two blocks long. */
+static uint8_t *read_capture(const char *path, long *len) {
+    uint8_t *pcm;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    rewind(f);
+    pcm = malloc(*len);
+    if (!pcm || fread(pcm, 1, *len, f) != (size_t)*len) {
+        fprintf(stderr, "%s: read failed\n", path);
+        fclose(f);
+        free(pcm);
+        return NULL;
+    }
+    fclose(f);
+    if (*len < 2 * LOAD_BLOCK) {
+        fprintf(stderr, "%s: too short\n", path);
+        free(pcm);
+        return NULL;
+    }
+    return pcm;
+}
+
+/*
+ * Decode the capture in path on 1, 2, 4 ... max_channels channels at
+ * once through a worker pool with one thread per CPU, as fast as the
+ * pool will take it. Each channel starts at a different offset so the
+ * channels are not in lock step. Reports how many times real time the
+ * pool managed and the largest channel count it could keep up with.
+ */
+static int run_load(const char *path, int max_channels) {
+    struct freedv_pool_stats st;
+    struct freedv_pool *pool;
+    uint8_t *pcm;
+    long len, nblocks, blk;
+    int nthreads, nchannels, ch, saturation = 0;
+    double start, secs, audio_secs, lat_avg, lat_max;
+    int max_depth;
+
+    pcm = read_capture(path, &len);
+    if (!pcm)
+        return -1;
+    nblocks = len / LOAD_BLOCK;
+    audio_secs = nblocks * 0.02;
+
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1)
+        nthreads = 1;
+    fprintf(stderr, "%.1f s of audio per channel, %d worker threads\n",
+            audio_secs, nthreads);
+
+    for (nchannels = 1; nchannels <= max_channels; nchannels *= 2) {
+        pool = freedv_pool_create(nthreads, nchannels, 0, LOAD_BLOCK,
+                NULL, NULL);
+        if (!pool) {
+            fprintf(stderr, "freedv_pool_create: %d channels failed\n",
+                    nchannels);
+            free(pcm);
+            return -1;
+        }
+
+        start = now();
+        for (blk = 0; blk < nblocks; blk++)
+            for (ch = 0; ch < nchannels; ch++)
+                freedv_pool_submit(pool, ch,
+                        &pcm[((blk + ch * 7) % nblocks) * LOAD_BLOCK],
+                        LOAD_BLOCK, 1);
+        freedv_pool_drain(pool);
+        secs = now() - start;
+
+        lat_avg = lat_max = 0;
+        max_depth = 0;
+        for (ch = 0; ch < nchannels; ch++) {
+            freedv_pool_get_stats(pool, ch, &st);
+            lat_avg += st.latency_avg_ms / nchannels;
+            if (st.latency_max_ms > lat_max)
+                lat_max = st.latency_max_ms;
+            if (st.max_depth > max_depth)
+                max_depth = st.max_depth;
+        }
+        freedv_pool_destroy(pool);
+
+        fprintf(stderr, "%4d channels: %7.1fx real time total, %6.2fx per "
+                "channel, latency avg %.1f max %.1f ms, max queue %d\n",
+                nchannels, nchannels * audio_secs / secs,
+                audio_secs / secs, lat_avg, lat_max, max_depth);
+        if (audio_secs / secs >= 1.0)
+            saturation = nchannels;
+    }
+    fprintf(stderr, "Keeps up with real time up to %d channels\n", saturation);
+    free(pcm);
+    return 0;
+}
+
+/* Runs the capture through a wideband receiver in LOAD_BLOCK pieces,
+ * returns the seconds taken. */
+static double time_wideband(struct freedv_wideband *wb, const uint8_t *pcm,
+        long len) {
+    double start = now();
+    long off;
+
+    for (off = 0; off + LOAD_BLOCK <= len; off += LOAD_BLOCK)
+        freedv_wideband_process_48k_stereo(wb, &pcm[off], LOAD_BLOCK);
+    return now() - start;
+}
+
+/*
+ * Decode every FreeDV signal in the capture in path with the wideband
+ * receiver and report what each sub-band found. The capture is also
+ * timed with pilot detection only and with every sub-band demodulated,
+ * which gives the cost of the channelizer and of one sub-band's demod,
+ * and so how many sub-bands one core can demodulate in real time.
+ */
+static int run_wideband(const char *path, int fast_acq) {
+    struct freedv_wideband_stats st;
+    struct freedv_wideband *wb[3];
+    const int flags[3] = { fast_acq, FREEDV_WB_SCAN, FREEDV_WB_ALL | fast_acq };
+    double secs[3], audio_secs, chan_load, sub_load;
+    uint8_t *pcm;
+    long len;
+    int i, k;
+
+    pcm = read_capture(path, &len);
+    if (!pcm)
+        return -1;
+    audio_secs = (len / LOAD_BLOCK) * 0.02;
+
+    for (i = 0; i < 3; i++) {
+        wb[i] = freedv_wideband_create(flags[i], NULL, NULL);
+        if (!wb[i]) {
+            fprintf(stderr, "freedv_wideband_create failed\n");
+            while (i--)
+                freedv_wideband_destroy(wb[i]);
+            free(pcm);
+            return -1;
+        }
+        secs[i] = time_wideband(wb[i], pcm, len);
+    }
+
+    fprintf(stderr, "%.1f s of audio, %d sub-bands %d Hz apart\n",
+            audio_secs, FDMDV_NSUB, FDMDV_SUB_HZ);
+    for (k = 0; k < FDMDV_NSUB; k++) {
+        freedv_wideband_get_stats(wb[0], k, &st);
+        if (!st.frames && !st.pilot)
+            continue;
+        fprintf(stderr, "sub-band %d: signal at %7.1f Hz, %lu frames, "
+                "%.0f%% in sync, SNR %.1f dB%s\n", k, st.fcentre,
+                st.frames, st.frames ? 100.0 * st.synced / st.frames : 0,
+                st.demod.snr_est, st.pilot ? "" : ", pilot lost");
+    }
+
+    chan_load = secs[1] / audio_secs;
+    sub_load = (secs[2] - secs[1]) / (FDMDV_NSUB * audio_secs);
+    fprintf(stderr, "As found: %.1fx real time. Channelizer and pilot "
+            "detection: %.2f%% of a core, each sub-band demod %.2f%%\n",
+            audio_secs / secs[0], 100 * chan_load, 100 * sub_load);
+    if (sub_load > 0)
+        fprintf(stderr, "One core demodulates %.0f sub-bands in real "
+                "time\n", (1 - chan_load) / sub_load);
+
+    for (i = 0; i < 3; i++)
+        freedv_wideband_destroy(wb[i]);
+    free(pcm);
+    return 0;
+}
+
+/* Cold starts per mode, and the longest a start may take, in frames. */
+#define ACQ_STARTS 50
+#define ACQ_MAX_FRAMES 150
+/* Noise only runs, each this many frames long. */
+#define ACQ_NOISE_RUNS 20
+#define ACQ_NOISE_FRAMES 300
+
+/* Gaussian noise, 2000 rms, on both channels of 48 kHz stereo. */
+static void make_noise(uint8_t *pcm, long len, unsigned seed) {
+    int16_t *s = (int16_t *)pcm;
+    double u1, u2, x;
+    long i;
+
+    for (i = 0; i + 1 < len / 2; i += 2) {
+        seed = seed * 1103515245 + 12345;
+        u1 = ((seed >> 8) + 1.0) / (1 << 24);
+        seed = seed * 1103515245 + 12345;
+        u2 = (seed >> 8) / (double)(1 << 24);
+        x = 2000 * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+        s[i] = s[i + 1] = x > 32767 ? 32767 : x < -32768 ? -32768 : x;
+    }
+}
+
+struct acq_result {
+    int fine;                       /* Frame fine tracking started, or -1. */
+    int sync;                       /* Frame audio was unmuted, or -1. */
+    int fine_locks;                 /* Times fine tracking started. */
+    int locks;                      /* Times sync was gained. */
+    int synced;                     /* Frames in sync. */
+};
+
+/* Runs nframes blocks of pcm through rx, starting at off and wrapping. */
+static void acq_run(struct freedv_rx *rx, const uint8_t *pcm, long len,
+        long off, int nframes, struct acq_result *res) {
+    short speech[2 * SAMPLES_PER_FRAME];
+    uint8_t block[LOAD_BLOCK];
+    struct FDMDV_STATS st;
+    int i, was = 0, is, was_fine = 0;
+    long n;
+
+    res->fine = res->sync = -1;
+    res->fine_locks = res->locks = res->synced = 0;
+    for (i = 0; i < nframes; i++) {
+        for (n = 0; n < LOAD_BLOCK; n++)
+            block[n] = pcm[(off + n) % len];
+        off = (off + LOAD_BLOCK) % len;
+        freedv_rx_decode_48k_stereo(rx, speech, 2 * SAMPLES_PER_FRAME,
+                block, LOAD_BLOCK);
+        freedv_rx_get_stats(rx, &st);
+        if (st.fest_coarse_fine && !was_fine) {
+            res->fine_locks++;
+            if (res->fine < 0)
+                res->fine = i;
+        }
+        was_fine = st.fest_coarse_fine;
+        is = freedv_rx_synced(rx);
+        if (is && !was) {
+            res->locks++;
+            if (res->sync < 0)
+                res->sync = i;
+        }
+        res->synced += is;
+        was = is;
+    }
+}
+
+static int cmp_int(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+/* Prints the mean, median and 90th percentile of n frame counts. */
+static void print_frames(const char *what, int frames[], int n) {
+    double sum = 0;
+    int i;
+
+    if (!n) {
+        fprintf(stderr, "  %s: never\n", what);
+        return;
+    }
+    qsort(frames, n, sizeof(int), cmp_int);
+    for (i = 0; i < n; i++)
+        sum += frames[i];
+    fprintf(stderr, "  %s: mean %.1f, median %d, 90%% %d frames\n", what,
+            sum / n, frames[n / 2], frames[n * 9 / 10]);
+}
+
+/*
+ * Time to sync from a cold start on the capture in path, with and
+ * without the demod's fast acquisition path. Reports the frames until
+ * the demod goes to fine tracking and until the audio is unmuted, which
+ * also waits for the SNR estimate to come up. Starts are spread over
+ * the capture, ACQ_MAX_FRAMES from its end if it is long enough, and
+ * off frame boundaries. A start that loses sync again before
+ * ACQ_MAX_FRAMES is counted as a failure. Then both run on noise
+ * alone, where every time sync is gained is a false lock.
+ */
+static int run_acquisition(const char *path) {
+    static const char *mode[2] = { "default", "fast acq" };
+    struct freedv_rx *rx;
+    struct acq_result res;
+    int fine[ACQ_STARTS], sync[ACQ_STARTS], nfine, nsync, nlost, i, a;
+    int false_fine, false_locks, max_locks, false_synced;
+    uint8_t *pcm, *noise;
+    long len, span, noise_len, off;
+    double start, secs;
+
+    pcm = read_capture(path, &len);
+    if (!pcm)
+        return -1;
+    noise_len = (long)ACQ_NOISE_FRAMES * LOAD_BLOCK;
+    noise = malloc(noise_len);
+    if (!noise) {
+        free(pcm);
+        return -1;
+    }
+    span = len - (long)ACQ_MAX_FRAMES * LOAD_BLOCK;
+    if (span < LOAD_BLOCK)
+        span = len;
+    fprintf(stderr, "%d cold starts on %.1f s of audio, %d runs of %d "
+            "frames of noise\n", ACQ_STARTS, (len / LOAD_BLOCK) * 0.02,
+            ACQ_NOISE_RUNS, ACQ_NOISE_FRAMES);
+
+    for (a = 0; a < 2; a++) {
+        nfine = nsync = nlost = 0;
+        secs = 0;
+        for (i = 0; i < ACQ_STARTS; i++) {
+            rx = freedv_rx_create();
+            if (!rx || freedv_rx_set_fast_acquisition(rx, a) < 0)
+                goto fail;
+            /* 37 samples further on each time, so starts fall at
+             * different points in a frame. */
+            off = (span / 4 / ACQ_STARTS * i + 37 * i) * 4 % len;
+            start = now();
+            acq_run(rx, pcm, len, off, ACQ_MAX_FRAMES, &res);
+            secs += now() - start;
+            if (res.fine >= 0)
+                fine[nfine++] = res.fine;
+            if (res.sync >= 0 && res.locks == 1 &&
+                    res.synced == ACQ_MAX_FRAMES - res.sync)
+                sync[nsync++] = res.sync;
+            else if (res.sync >= 0)
+                nlost++;
+            freedv_rx_destroy(rx);
+        }
+        fprintf(stderr, "%s: %d of %d starts synced, %d lost it again, "
+                "%.1f us/frame\n", mode[a], nsync, ACQ_STARTS, nlost,
+                1e6 * secs / ((double)ACQ_STARTS * ACQ_MAX_FRAMES));
+        print_frames("fine tracking", fine, nfine);
+        print_frames("unmuted", sync, nsync);
+
+        false_fine = false_locks = max_locks = false_synced = 0;
+        secs = 0;
+        for (i = 0; i < ACQ_NOISE_RUNS; i++) {
+            rx = freedv_rx_create();
+            if (!rx || freedv_rx_set_fast_acquisition(rx, a) < 0)
+                goto fail;
+            make_noise(noise, noise_len, i + 1);
+            start = now();
+            acq_run(rx, noise, noise_len, 0, ACQ_NOISE_FRAMES, &res);
+            secs += now() - start;
+            false_fine += res.fine_locks;
+            false_locks += res.locks;
+            false_synced += res.synced;
+            if (res.locks > max_locks)
+                max_locks = res.locks;
+            freedv_rx_destroy(rx);
+        }
+        fprintf(stderr, "  noise only, per %d frames: %.2f false fine "
+                "locks, %.2f false unmutes (max %d), %.2f%% of frames "
+                "unmuted, %.1f us/frame\n", ACQ_NOISE_FRAMES,
+                (double)false_fine / ACQ_NOISE_RUNS,
+                (double)false_locks / ACQ_NOISE_RUNS, max_locks,
+                100.0 * false_synced /
+                ((double)ACQ_NOISE_RUNS * ACQ_NOISE_FRAMES),
+                1e6 * secs / ((double)ACQ_NOISE_RUNS * ACQ_NOISE_FRAMES));
+    }
+    free(noise);
+    free(pcm);
+    return 0;
+
+fail:
+    fprintf(stderr, "freedv_rx_create failed\n");
+    freedv_rx_destroy(rx);
+    free(noise);
+    free(pcm);
+    return -1;
+}
+
 static void *usb_thread_entry(void *data) {
     struct app_ctx *ctx = (struct app_ctx *)data;
     fprintf(stderr, "usb_thread started\n");
@@ -83,21 +512,94 @@ static void *usb_thread_entry(void *data) {
             break;
         }
 #endif
-        /* Handle libusb event. This call is blocking. */
-        int rc = libusb_handle_events(NULL);
-        if (rc != LIBUSB_SUCCESS) {
-            fprintf(stderr, "libusb_handle_events: %s.\n", libusb_error_name(rc));
+        /* Handle USB events. This call is blocking. */
+        if (usb_process() < 0)
             break;
-        }
     }
-    fprintf(stderr, "usb_thread exiting");
+    fprintf(stderr, "usb_thread exiting\n");
     return NULL;
 }
 
 int main(int argc, char** argv) {
-    int rc;
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s [filename.raw]\n", argv[0]); 
+    int rc = -1, opt;
+    int num_transfers = USB_NUM_TRANSFERS;
+    int num_packets = USB_NUM_PACKETS;
+    const char *sim_file = NULL;
+    float sim_rate = 1.0, sim_loss = 0.0, sim_jitter = 0.0;
+    const char *speech_file = NULL;
+    const char *spectrum_file = NULL;
+    int load_channels = 0, wideband = 0, fast_acq = 0, acquisition = 0;
+    const char *check = NULL;
+
+    while ((opt = getopt(argc, argv, "t:p:s:r:l:j:o:f:b:wc:aq")) != -1) {
+        switch (opt) {
+        case 't':
+            num_transfers = atoi(optarg);
+            break;
+        case 'p':
+            num_packets = atoi(optarg);
+            break;
+        case 's':
+            sim_file = optarg;
+            break;
+        case 'r':
+            sim_rate = atof(optarg);
+            break;
+        case 'l':
+            sim_loss = atof(optarg) / 100;
+            break;
+        case 'j':
+            sim_jitter = atof(optarg);
+            break;
+        case 'o':
+            speech_file = optarg;
+            break;
+        case 'f':
+            spectrum_file = optarg;
+            break;
+        case 'b':
+            load_channels = atoi(optarg);
+            break;
+        case 'w':
+            wideband = 1;
+            break;
+        case 'c':
+            check = optarg;
+            break;
+        case 'a':
+            fast_acq = 1;
+            break;
+        case 'q':
+            acquisition = 1;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (load_channels > 0 && sim_file)
+        return run_load(sim_file, load_channels) < 0 ? EXIT_FAILURE : 0;
+    if (wideband && sim_file)
+        return run_wideband(sim_file, fast_acq ? FREEDV_WB_FAST_ACQ : 0) < 0 ?
+                EXIT_FAILURE : 0;
+    if (acquisition && sim_file)
+        return run_acquisition(sim_file) < 0 ? EXIT_FAILURE : 0;
+    if (check)
+        return freedv_check_run(check, sim_file) < 0 ? EXIT_FAILURE : 0;
+    if (optind != argc - 1) {
+usage:
+        fprintf(stderr, "usage: %s [-t transfers] [-p packets] "
+                "[-s replay.raw [-r rate] [-l loss%%] [-j jitter_ms]] [-o speech.raw] "
+                "[-f spectrum.txt] [-a] [filename.raw]\n"
+                "       %s -s replay.raw -b max_channels\n"
+                "       %s -s replay.raw -w [-a]\n"
+                "       %s -s replay.raw -q\n"
+                "       %s -c check|all [-s replay.raw]\n"
+                "  -f  write the demod input spectrum, a line per frame\n"
+                "  -a  fast acquisition: fine tracking a little sooner, audio no sooner,\n"
+                "      more CPU while out of sync\n"
+                "  -q  time to sync and false locks with and without -a\n",
+                argv[0], argv[0], argv[0], argv[0], argv[0]);
+        freedv_check_list(stderr);
         exit(EXIT_FAILURE);
     }
 
@@ -110,11 +612,28 @@ int main(int argc, char** argv) {
         goto out;
     }
     /* This was logfd. WTF was I thinking? */
-    ctx->audiofd = open(argv[1], O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    ctx->audiofd = open(argv[optind], O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
     if (ctx->audiofd < 0) {
-        perror(argv[1]);
+        perror(argv[optind]);
         return errno;
     }
+    ctx->speechfd = -1;
+    if (speech_file) {
+        ctx->speechfd = open(speech_file, O_WRONLY | O_CREAT | O_TRUNC,
+                S_IRUSR | S_IWUSR);
+        if (ctx->speechfd < 0) {
+            perror(speech_file);
+            return errno;
+        }
+    }
+
+    if (sim_file) {
+        rc = usb_use_simulator(sim_file, sim_rate, sim_loss, sim_jitter);
+        if (rc != 0) {
+            fprintf(stderr, "usb_use_simulator: %d\n", rc);
+            goto out;
+        }
+    }
 
     rc = usb_setup();
     if (rc != 0) {
@@ -122,18 +641,47 @@ int main(int argc, char** argv) {
         goto out;
     }
 
-    rc = usb_start_transfers(ctx->audiofd);
+    rc = usb_start_transfers(num_transfers, num_packets);
     if (rc != 0) {
         fprintf(stderr, "usb_start_transfers: %d\n" ,rc);
         goto out;
     }
 
-    rc = freedv_create();
-    if (rc == 0) {
-        fprintf(stderr, "freedv_create: %d\n" ,rc);
+    ctx->rx = freedv_rx_create();
+    if (!ctx->rx) {
+        fprintf(stderr, "freedv_rx_create failed\n");
+        rc = -1;
+        goto out;
+    }
+    if (fast_acq && freedv_rx_set_fast_acquisition(ctx->rx, 1) < 0) {
+        fprintf(stderr, "freedv_rx_set_fast_acquisition failed\n");
+        rc = -1;
         goto out;
     }
 
+    if (spectrum_file) {
+        ctx->spectrum_file = fopen(spectrum_file, "w");
+        if (!ctx->spectrum_file) {
+            perror(spectrum_file);
+            rc = -1;
+            goto out;
+        }
+        ctx->spectrum = freedv_spectrum_create(0, SPECTRUM_BETA);
+        if (!ctx->spectrum) {
+            fprintf(stderr, "freedv_spectrum_create failed\n");
+            rc = -1;
+            goto out;
+        }
+        freedv_rx_set_spectrum(ctx->rx, ctx->spectrum);
+        rc = pthread_create(&ctx->spectrum_thread, NULL,
+                spectrum_thread_entry, ctx);
+        if (rc != 0) {
+            fprintf(stderr, "pthread_create: spectrum_thread failed: %d\n",
+                    rc);
+            goto out;
+        }
+    }
+
     rc = pthread_create(&ctx->usb_thread, NULL, usb_thread_entry, ctx);
     if (rc < 0) {
         fprintf(stderr, "pthread_create: usb_thread failed: %d\n", rc);
@@ -146,10 +694,19 @@ int main(int argc, char** argv) {
         goto out;
     }
 
-    /* This code is designed to be run from within an Android app. */
-    while(1) {
-        pthread_yield();
+    /* Runs until the capture source stops. */
+    pthread_join(ctx->freedv_thread, NULL);
+    pthread_join(ctx->usb_thread, NULL);
+    if (ctx->spectrum) {
+        __atomic_store_n(&ctx->done, 1, __ATOMIC_RELEASE);
+        pthread_join(ctx->spectrum_thread, NULL);
+        fclose(ctx->spectrum_file);
+        freedv_rx_set_spectrum(ctx->rx, NULL);
+        freedv_spectrum_destroy(ctx->spectrum);
     }
+    freedv_rx_destroy(ctx->rx);
+    usb_exit();
+    return 0;
 
 out:
     fprintf(stderr, "Exiting\n");
@@ -157,5 +714,15 @@ out:
         pthread_kill(ctx->usb_thread, SIGKILL);
     if (ctx->freedv_thread)
         pthread_kill(ctx->freedv_thread, SIGKILL);
+    if (ctx->spectrum_thread) {
+        __atomic_store_n(&ctx->done, 1, __ATOMIC_RELEASE);
+        pthread_join(ctx->spectrum_thread, NULL);
+    }
+    if (ctx->spectrum_file)
+        fclose(ctx->spectrum_file);
+    if (ctx->spectrum)
+        freedv_spectrum_destroy(ctx->spectrum);
+    if (ctx->rx)
+        freedv_rx_destroy(ctx->rx);
     return rc;
 }
@@ -1,7 +1,50 @@
 #ifndef FREEDV_DECODE_H
 #define FREEDV_DECODE_H
 
-/* Setup is done once. */
+#include <stdint.h>
+
+#include "freedv/fdmdv.h"
+
+/*
+ * One FreeDV receiver. Contexts are independent, so each can be driven
+ * from its own thread, but a single context must not be used from two
+ * threads at once (see freedv_pool.h for scheduling many of them).
+ */
+struct freedv_rx;
+struct freedv_spectrum;
+
+struct freedv_rx *freedv_rx_create(void);
+void freedv_rx_destroy(struct freedv_rx *rx);
+
+/* Demodulate and decode raw 48 kHz 16-bit stereo capture. Returns the
+ * number of 8 kHz speech samples written to speech_out. */
+int freedv_rx_decode_48k_stereo(struct freedv_rx *rx, short speech_out[],
+        int max_speech, const uint8_t *pcm, int nbytes);
+
+/* Demodulate and decode FDMDV_NOM_SAMPLES_PER_FRAME 8 kHz samples.
+ * Returns the number of speech samples written to speech_out, at most
+ * FDMDV_NOM_SAMPLES_PER_FRAME. */
+int freedv_rx_decode(struct freedv_rx *rx, short speech_out[],
+        const short *input);
+
+/* Latest demod stats, and whether the decoder is in sync. */
+void freedv_rx_get_stats(struct freedv_rx *rx, struct FDMDV_STATS *stats);
+int freedv_rx_synced(struct freedv_rx *rx);
+
+/* Turn the demod's fast acquisition path on or off (see
+ * fdmdv_set_fast_acquisition()). Off by default. It gets to fine
+ * tracking sooner but not to audio, and costs CPU while out of sync.
+ * Returns 0, or -1 if it could not be enabled. */
+int freedv_rx_set_fast_acquisition(struct freedv_rx *rx, int enable);
+
+/* Feed the demod input to a spectrum engine, NULL to stop. The engine
+ * is not freed with the context, and is read from another thread (see
+ * freedv_spectrum.h). */
+void freedv_rx_set_spectrum(struct freedv_rx *rx, struct freedv_spectrum *sp);
+
+/* Single receiver API on a default context. Setup is done once. */
 int freedv_create(void);
+int freedv_decode_48k_stereo(short speech_out[], int max_speech,
+        const uint8_t *pcm, int nbytes);
 
 #endif
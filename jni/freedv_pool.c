@@ -0,0 +1,286 @@
+/*
+ *
+ * Worker pool decoding many FreeDV channels
+ * Copyright 2012 Joel Stanley <joel@jms.id.au>
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freedv_pool.h"
+
+/* 8 kHz speech per 48 kHz stereo byte, plus what a context can have
+ * buffered from earlier blocks (two codec frames). */
+#define SPEECH_PER_BYTE (1.0 / (4 * FDMDV_OS))
+#define SPEECH_BUFFERED (2 * 320)
+
+struct pool_block {
+    uint8_t *data;
+    int nbytes;
+    double submitted;
+};
+
+struct pool_channel {
+    struct freedv_rx *rx;
+    short *speech;                  /* Worker scratch for decoded speech. */
+
+    /* Protected by the pool lock. The block at head stays put while a
+     * worker decodes it; it is only released once the worker is done. */
+    struct pool_block *queue;
+    int head;
+    int count;
+    int scheduled;                  /* On the ready list or being decoded. */
+    int next;                       /* Ready list link, -1 at the tail. */
+    double latency_sum;
+    struct freedv_pool_stats stats;
+};
+
+struct freedv_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;            /* Ready list became non-empty, or quit. */
+    pthread_cond_t space;           /* A block was released. */
+    pthread_cond_t idle;            /* Nothing left outstanding. */
+    int ready_head, ready_tail;
+    int outstanding;
+    int quit;
+
+    int nchannels;
+    int queue_len;
+    int max_block;
+    struct pool_channel *chan;
+    int nthreads;
+    pthread_t *threads;
+    freedv_pool_speech_fn speech_fn;
+    void *arg;
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Called with the lock held. Channels go to the back of the list, so
+ * busy channels take turns with each other. */
+static void make_ready(struct freedv_pool *pool, int channel) {
+    pool->chan[channel].next = -1;
+    if (pool->ready_head < 0)
+        pool->ready_head = channel;
+    else
+        pool->chan[pool->ready_tail].next = channel;
+    pool->ready_tail = channel;
+    pthread_cond_signal(&pool->work);
+}
+
+static void *worker_entry(void *data) {
+    struct freedv_pool *pool = (struct freedv_pool *)data;
+    struct pool_channel *ch;
+    struct pool_block *b;
+    int channel, nspeech;
+    double latency;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->ready_head < 0 && !pool->quit)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->ready_head < 0)
+            break;
+
+        channel = pool->ready_head;
+        ch = &pool->chan[channel];
+        pool->ready_head = ch->next;
+        b = &ch->queue[ch->head];
+        pthread_mutex_unlock(&pool->lock);
+
+        nspeech = freedv_rx_decode_48k_stereo(ch->rx, ch->speech,
+                pool->max_block * SPEECH_PER_BYTE + SPEECH_BUFFERED,
+                b->data, b->nbytes);
+        if (pool->speech_fn)
+            pool->speech_fn(pool->arg, channel, ch->speech, nspeech);
+        latency = (now() - b->submitted) * 1000;
+
+        pthread_mutex_lock(&pool->lock);
+        freedv_rx_get_stats(ch->rx, &ch->stats.demod);
+        ch->stats.synced = freedv_rx_synced(ch->rx);
+        ch->stats.blocks++;
+        ch->latency_sum += latency;
+        if (latency > ch->stats.latency_max_ms)
+            ch->stats.latency_max_ms = latency;
+        ch->head = (ch->head + 1) % pool->queue_len;
+        ch->count--;
+        if (ch->count)
+            make_ready(pool, channel);
+        else
+            ch->scheduled = 0;
+        pthread_cond_broadcast(&pool->space);
+        if (--pool->outstanding == 0)
+            pthread_cond_broadcast(&pool->idle);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void free_channels(struct freedv_pool *pool) {
+    int i, j;
+
+    for (i = 0; i < pool->nchannels; i++) {
+        struct pool_channel *ch = &pool->chan[i];
+        freedv_rx_destroy(ch->rx);
+        free(ch->speech);
+        if (ch->queue)
+            for (j = 0; j < pool->queue_len; j++)
+                free(ch->queue[j].data);
+        free(ch->queue);
+    }
+    free(pool->chan);
+}
+
+struct freedv_pool *freedv_pool_create(int nthreads, int nchannels,
+        int queue_len, int max_block, freedv_pool_speech_fn speech_fn,
+        void *arg) {
+    struct freedv_pool *pool;
+    int i, j;
+
+    if (nthreads <= 0 || nchannels <= 0 || max_block <= 0)
+        return NULL;
+    if (queue_len <= 0)
+        queue_len = FREEDV_POOL_QUEUE;
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+    pool->ready_head = pool->ready_tail = -1;
+    pool->nchannels = nchannels;
+    pool->queue_len = queue_len;
+    pool->max_block = max_block;
+    pool->speech_fn = speech_fn;
+    pool->arg = arg;
+
+    /* Everything a channel needs is allocated up front, so submit and
+     * the workers never allocate. */
+    pool->chan = calloc(nchannels, sizeof(*pool->chan));
+    if (!pool->chan)
+        goto err;
+    for (i = 0; i < nchannels; i++) {
+        struct pool_channel *ch = &pool->chan[i];
+        ch->rx = freedv_rx_create();
+        ch->speech = malloc((max_block * SPEECH_PER_BYTE + SPEECH_BUFFERED) *
+                sizeof(short));
+        ch->queue = calloc(queue_len, sizeof(*ch->queue));
+        if (!ch->rx || !ch->speech || !ch->queue)
+            goto err;
+        for (j = 0; j < queue_len; j++) {
+            ch->queue[j].data = malloc(max_block);
+            if (!ch->queue[j].data)
+                goto err;
+        }
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->space, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    pool->threads = calloc(nthreads, sizeof(*pool->threads));
+    if (!pool->threads)
+        goto err_threads;
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_entry, pool))
+            goto err_threads;
+        pool->nthreads++;
+    }
+    return pool;
+
+err_threads:
+    freedv_pool_destroy(pool);
+    return NULL;
+err:
+    if (pool->chan)
+        free_channels(pool);
+    free(pool);
+    return NULL;
+}
+
+int freedv_pool_submit(struct freedv_pool *pool, int channel,
+        const uint8_t *pcm, int nbytes, int wait) {
+    struct pool_channel *ch;
+    struct pool_block *b;
+
+    if (channel < 0 || channel >= pool->nchannels || !pcm || nbytes <= 0 ||
+            nbytes > pool->max_block)
+        return -EINVAL;
+    ch = &pool->chan[channel];
+
+    pthread_mutex_lock(&pool->lock);
+    while (ch->count == pool->queue_len) {
+        if (!wait) {
+            ch->stats.rejected++;
+            pthread_mutex_unlock(&pool->lock);
+            return -EAGAIN;
+        }
+        pthread_cond_wait(&pool->space, &pool->lock);
+    }
+
+    b = &ch->queue[(ch->head + ch->count) % pool->queue_len];
+    memcpy(b->data, pcm, nbytes);
+    b->nbytes = nbytes;
+    b->submitted = now();
+    ch->count++;
+    if (ch->count > ch->stats.max_depth)
+        ch->stats.max_depth = ch->count;
+    pool->outstanding++;
+    if (!ch->scheduled) {
+        ch->scheduled = 1;
+        make_ready(pool, channel);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void freedv_pool_drain(struct freedv_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->outstanding)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int freedv_pool_get_stats(struct freedv_pool *pool, int channel,
+        struct freedv_pool_stats *stats) {
+    struct pool_channel *ch;
+
+    if (channel < 0 || channel >= pool->nchannels)
+        return -EINVAL;
+    ch = &pool->chan[channel];
+
+    pthread_mutex_lock(&pool->lock);
+    *stats = ch->stats;
+    stats->depth = ch->count;
+    stats->latency_avg_ms = ch->stats.blocks ?
+            ch->latency_sum / ch->stats.blocks : 0;
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void freedv_pool_destroy(struct freedv_pool *pool) {
+    int i;
+
+    freedv_pool_drain(pool);
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+    free(pool->threads);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->space);
+    pthread_cond_destroy(&pool->idle);
+    free_channels(pool);
+    free(pool);
+}
@@ -0,0 +1,62 @@
+#ifndef FREEDV_POOL_H
+#define FREEDV_POOL_H
+
+#include <stdint.h>
+
+#include "freedv_decode.h"
+
+/*
+ * Decodes many FreeDV channels on a fixed set of worker threads. Each
+ * channel has its own freedv_rx context and a queue of capture blocks.
+ * A channel is only ever handed to one worker at a time and its blocks
+ * are decoded in submit order, so speech comes out in order per channel
+ * while different channels run in parallel.
+ */
+struct freedv_pool;
+
+struct freedv_pool_stats {
+    unsigned long blocks;           /* Blocks decoded. */
+    unsigned long rejected;         /* Submits refused because the queue was full. */
+    int depth;                      /* Blocks queued or being decoded. */
+    int max_depth;
+    double latency_avg_ms;          /* Submit to speech callback. */
+    double latency_max_ms;
+    struct FDMDV_STATS demod;       /* As of the last decoded block. */
+    int synced;
+};
+
+/* Called on a worker thread with the speech decoded from one block. */
+typedef void (*freedv_pool_speech_fn)(void *arg, int channel,
+        const short *speech, int nspeech);
+
+/* Default queue length per channel, in blocks. */
+#define FREEDV_POOL_QUEUE 32
+
+/*
+ * Start nthreads workers for nchannels channels. Each channel queues up
+ * to queue_len blocks (0 for the default) of at most max_block bytes of
+ * 48 kHz 16-bit stereo. speech_fn may be NULL.
+ */
+struct freedv_pool *freedv_pool_create(int nthreads, int nchannels,
+        int queue_len, int max_block, freedv_pool_speech_fn speech_fn,
+        void *arg);
+
+/*
+ * Queue a copy of a capture block for a channel. If the queue is full,
+ * waits for space when wait is set, otherwise returns -EAGAIN and counts
+ * the block as rejected.
+ */
+int freedv_pool_submit(struct freedv_pool *pool, int channel,
+        const uint8_t *pcm, int nbytes, int wait);
+
+/* Blocks until every queued block has been decoded. */
+void freedv_pool_drain(struct freedv_pool *pool);
+
+/* Returns -EINVAL if channel is out of range. */
+int freedv_pool_get_stats(struct freedv_pool *pool, int channel,
+        struct freedv_pool_stats *stats);
+
+/* Decodes what is queued, then stops the workers and frees everything. */
+void freedv_pool_destroy(struct freedv_pool *pool);
+
+#endif
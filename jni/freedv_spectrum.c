@@ -0,0 +1,139 @@
+/*
+ *
+ * Spectrum and waterfall engine for the modem input
+ * Copyright 2012 Joel Stanley <joel@jms.id.au>
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "freedv/kiss_fftr.h"
+#include "freedv_spectrum.h"
+
+#define SPEC_N (2 * FDMDV_NSPEC)    /* FFT length, a power of two. */
+#define SPEC_FS 8000
+
+/* Set in mid while it holds a frame the reader has not taken. */
+#define SPEC_FRESH 4
+
+struct spec_frame {
+    unsigned long seq;
+    float power[FDMDV_NSPEC];
+};
+
+/*
+ * Frames are handed over through a triple buffer. The writer fills
+ * frame[back], then swaps it with mid. The reader swaps mid with
+ * frame[front] when mid is fresh. Only those swaps are shared, so the
+ * writer always has a free frame and the reader's frame is never
+ * written under it.
+ */
+struct freedv_spectrum {
+    kiss_fftr_cfg fft_cfg;
+    float window[SPEC_N];
+    float buf[SPEC_N];              /* Latest SPEC_N samples, circular. */
+    int pos;                        /* Oldest sample in buf. */
+    int interval;                   /* Samples per frame. */
+    int count;                      /* Samples since the last frame. */
+    float beta;
+    float avg[FDMDV_NSPEC];
+    unsigned long seq;
+    struct spec_frame frame[3];
+    int back;                       /* Writer owned. */
+    int mid;                        /* Shared, frame index | SPEC_FRESH. */
+    int front;                      /* Reader owned. */
+};
+
+struct freedv_spectrum *freedv_spectrum_create(int fps, float beta) {
+    struct freedv_spectrum *sp;
+    int i;
+
+    if (!(beta > 0.0 && beta <= 1.0))
+        return NULL;
+    sp = calloc(1, sizeof(*sp));
+    if (!sp)
+        return NULL;
+    sp->fft_cfg = kiss_fftr_alloc(SPEC_N, 0, NULL, NULL);
+    if (!sp->fft_cfg) {
+        free(sp);
+        return NULL;
+    }
+
+    for (i = 0; i < SPEC_N; i++)
+        sp->window[i] = 0.5 - 0.5 * cos(2.0 * M_PI * i / SPEC_N);
+    if (fps <= 0)
+        fps = FREEDV_SPECTRUM_FPS;
+    sp->interval = SPEC_FS / fps;
+    if (sp->interval < FDMDV_NOM_SAMPLES_PER_FRAME)
+        sp->interval = FDMDV_NOM_SAMPLES_PER_FRAME;
+    sp->beta = beta;
+    sp->back = 0;
+    sp->mid = 1;
+    sp->front = 2;
+    return sp;
+}
+
+void freedv_spectrum_destroy(struct freedv_spectrum *sp) {
+    if (!sp)
+        return;
+    KISS_FFT_FREE(sp->fft_cfg);
+    free(sp);
+}
+
+/* Computes a frame from buf and publishes it. */
+static void spec_update(struct freedv_spectrum *sp) {
+    struct spec_frame *fr = &sp->frame[sp->back];
+    float x[SPEC_N];
+    kiss_fft_cpx X[FDMDV_NSPEC + 1];
+    float scale = 1.0 / ((float)FDMDV_NSPEC * FDMDV_NSPEC);
+    float p;
+    int i, j;
+
+    for (i = 0, j = sp->pos; j < SPEC_N; i++, j++)
+        x[i] = sp->window[i] * sp->buf[j];
+    for (j = 0; i < SPEC_N; i++, j++)
+        x[i] = sp->window[i] * sp->buf[j];
+    kiss_fftr(sp->fft_cfg, x, X);
+
+    for (i = 0; i < FDMDV_NSPEC; i++) {
+        p = scale * (X[i].r * X[i].r + X[i].i * X[i].i);
+        if (sp->seq && sp->beta < 1.0)
+            sp->avg[i] = (1.0 - sp->beta) * sp->avg[i] + sp->beta * p;
+        else
+            sp->avg[i] = p;
+        fr->power[i] = sp->avg[i];
+    }
+    fr->seq = ++sp->seq;
+
+    sp->back = __atomic_exchange_n(&sp->mid, sp->back | SPEC_FRESH,
+            __ATOMIC_ACQ_REL) & ~SPEC_FRESH;
+}
+
+void freedv_spectrum_write(struct freedv_spectrum *sp, const COMP in[], int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        sp->buf[sp->pos] = in[i].real;
+        sp->pos = (sp->pos + 1) & (SPEC_N - 1);
+        if (++sp->count == sp->interval) {
+            sp->count = 0;
+            spec_update(sp);
+        }
+    }
+}
+
+unsigned long freedv_spectrum_read(struct freedv_spectrum *sp, float mag_dB[]) {
+    struct spec_frame *fr;
+    int i;
+
+    if (!(__atomic_load_n(&sp->mid, __ATOMIC_ACQUIRE) & SPEC_FRESH))
+        return 0;
+    sp->front = __atomic_exchange_n(&sp->mid, sp->front, __ATOMIC_ACQ_REL) &
+            ~SPEC_FRESH;
+
+    fr = &sp->frame[sp->front];
+    for (i = 0; i < FDMDV_NSPEC; i++)
+        mag_dB[i] = 10.0 * log10(fr->power[i] + 1E-12);
+    return fr->seq;
+}
@@ -0,0 +1,44 @@
+#ifndef FREEDV_SPECTRUM_H
+#define FREEDV_SPECTRUM_H
+
+#include "freedv/fdmdv.h"
+
+/*
+ * Spectrum and waterfall data for the 8 kHz modem input, computed
+ * apart from the demod. The demod thread feeds samples in with
+ * freedv_spectrum_write(), which only copies them until an update is
+ * due, then windows, FFTs and averages FDMDV_NSPEC bins of power and
+ * publishes them. A UI thread picks up the latest frame with
+ * freedv_spectrum_read(), which does the conversion to dB. Neither
+ * side takes a lock or allocates, and a slow reader only ever misses
+ * frames, it never holds up the writer.
+ *
+ * One thread may write and one other thread may read at once.
+ */
+struct freedv_spectrum;
+
+/* Frame rate used when 0 is passed to freedv_spectrum_create(). */
+#define FREEDV_SPECTRUM_FPS 10
+
+/*
+ * Publish fps frames per second of 8 kHz input, at most one per
+ * FDMDV_NOM_SAMPLES_PER_FRAME samples. Each frame is the power of the
+ * latest 2*FDMDV_NSPEC samples averaged with the last frame, weighted
+ * by beta, so 1.0 is no averaging and smaller values smooth more.
+ * Returns NULL if beta is not in (0, 1] or allocation fails.
+ */
+struct freedv_spectrum *freedv_spectrum_create(int fps, float beta);
+void freedv_spectrum_destroy(struct freedv_spectrum *sp);
+
+/* Writer side. Takes the real part of n modem samples. */
+void freedv_spectrum_write(struct freedv_spectrum *sp, const COMP in[], int n);
+
+/*
+ * Reader side. If a frame has been published since the last read,
+ * writes its FDMDV_NSPEC bins, 0 to FDMDV_MAX_F_HZ, to mag_dB in dB on
+ * the scale fdmdv_get_rx_spectrum() uses and returns its sequence number,
+ * counting from 1. Returns 0 if there is nothing new.
+ */
+unsigned long freedv_spectrum_read(struct freedv_spectrum *sp, float mag_dB[]);
+
+#endif
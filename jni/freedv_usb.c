@@ -6,177 +6,126 @@
  */
 
 #include <errno.h>
-#include <fcntl.h>
-#include <signal.h>
+#include <semaphore.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <unistd.h>
-#include <string.h>
-
-#include <libusb-1.0/libusb.h>
 
 #include "freedv_usb.h"
+#include "ringbuf.h"
+#include "usb_transport.h"
+
+/* Capture ring between the USB thread and the decode thread. 128 KiB is
+ * a little over half a second of 48 kHz 16-bit stereo. It is grown if
+ * the transfers in flight could hold more than a quarter of it. */
+#define RING_SIZE (128 * 1024)
 
-/* TI PCM2900C Audio CODEC default VID/PID. */
-#define VID 0x08bb
-#define PID 0x29c0
-
-/* PCM stereo AudioStreaming endpoint. */
-#define EP_ISO_IN	0x84
-#define IFACE_NUM   2
-
-/* We queue many transfers to ensure no packets are missed. */
-#define NUM_TRANSFERS 10
-/* Each transfer will have a max of NUM_PACKETS packets. */
-#define NUM_PACKETS 10
-#define PACKET_SIZE 192
-
-#ifdef ANDROID
-#include <jni.h>
-#include <android/log.h>
-#define LOGD(...) \
-    __android_log_print(ANDROID_LOG_DEBUG, "FreedvUsbNative", __VA_ARGS__)
-#define LOGE(...) \
-    __android_log_print(ANDROID_LOG_ERROR, "FreedvUsbNative", __VA_ARGS__)
-#else
-#define LOGD(...) fprintf(stderr, __VA_ARGS__)
-#define LOGE(...) fprintf(stderr, __VA_ARGS__)
-#endif
-
-#if !defined(ANDROID)
-static int logfd;
-#endif
-
-static struct libusb_device_handle *devh = NULL;
-static int outfd = -1;
+static const struct usb_transport *transport = &usb_libusb_transport;
+static struct ringbuf ring;
+static sem_t ring_sem;
+static unsigned long packet_errors;
+static unsigned long long delivered;
+static bool eof;
 
 bool is_setup = false;
 
-static void transfer_cb(struct libusb_transfer *xfr) {
-    int rc = 0;
-    int len = 0;
-    unsigned int i;
-
-    /* All packets are 192 bytes. */
-    uint8_t* recv = malloc(PACKET_SIZE * xfr->num_iso_packets);
-    uint8_t* recv_next = recv;
-
-    for (i = 0; i < xfr->num_iso_packets; i++) {
-        struct libusb_iso_packet_descriptor *pack = &xfr->iso_packet_desc[i];
-        if (pack->status != LIBUSB_TRANSFER_COMPLETED) {
-            LOGE("Error (status %d: %s)\n", pack->status,
-                    libusb_error_name(pack->status));
-            continue;
-        }
-        const uint8_t *data = libusb_get_iso_packet_buffer_simple(xfr, i);
-        /* PACKET_SIZE == 192 == pack->length */
-        memcpy(recv_next, data, PACKET_SIZE);
-        recv_next += PACKET_SIZE;
-        len += pack->length;
-    }
-    /* At this point, recv points to a buffer containing len bytes of audio. */
-#if !defined(ANDROID)
-    /* Lock around this write? */
-    if ((rc = write(outfd, recv, len)) < 0) {
-        perror("Unable to write to descriptor");
+int usb_ring_init(size_t in_flight) {
+    size_t ring_size = RING_SIZE;
+    int rc;
+
+    usb_ring_free();
+    while (ring_size < 4 * in_flight)
+        ring_size <<= 1;
+    rc = ringbuf_init(&ring, ring_size);
+    if (rc < 0) {
+        LOGD("ringbuf_init failed.\n");
+        return rc;
     }
-#endif
-    free(recv);
-    /* Sanity check. If this is true, we've overflowed the recv buffer. */
-    if (len > PACKET_SIZE * xfr->num_iso_packets) {
-        LOGE("Error: incoming transfer had more data than we thought.\n");
+    sem_init(&ring_sem, 0, 0);
+    packet_errors = 0;
+    delivered = 0;
+    eof = false;
+    return 0;
+}
+
+void usb_ring_free(void) {
+    if (!ring.buf)
         return;
-    }
-	if ((rc = libusb_submit_transfer(xfr)) < 0) {
-		LOGE("libusb_submit_transfer: %s.\n", libusb_error_name(rc));
-	}
+    ringbuf_free(&ring);
+    sem_destroy(&ring_sem);
 }
 
-/* Setup is done once, after permission has been obtained. */
-int usb_setup(void) {
-	int rc = -1;
+size_t usb_ring_space(void) {
+    return ring.size - ringbuf_used(&ring);
+}
 
-	rc = libusb_init(NULL);
-	if (rc < 0) {
-		LOGD("libusb_init: %s\n", libusb_error_name(rc));
-        return rc;
-	}
-
-	devh = libusb_open_device_with_vid_pid(NULL, VID, PID);
-	if (!devh) {
-		LOGD("libusb_open_device_with_vid_pid failed.\n");
-        rc = -1;
-        goto out;
-	}
-
-    rc = libusb_kernel_driver_active(devh, IFACE_NUM);
-    if (rc == 1) {
-        rc = libusb_detach_kernel_driver(devh, IFACE_NUM);
-        if (rc < 0) {
-            LOGD("libusb_detach_kernel_driver: %s.\n", libusb_error_name(rc));
-            goto out;
-        }
-    }
+void usb_deliver_packet(const uint8_t *data, int len) {
+    if (ringbuf_write(&ring, data, len))
+        __atomic_store_n(&delivered, delivered + len, __ATOMIC_RELAXED);
+}
 
-	rc = libusb_claim_interface(devh, IFACE_NUM);
-	if (rc < 0) {
-		LOGD("libusb_claim_interface: %s.\n", libusb_error_name(rc));
-        goto out;
-    }
+void usb_packet_error(void) {
+    __atomic_store_n(&packet_errors, packet_errors + 1, __ATOMIC_RELAXED);
+}
 
-	rc = libusb_set_interface_alt_setting(devh, IFACE_NUM, 1);
-	if (rc < 0) {
-		LOGD("libusb_set_interface_alt_setting: %s.\n", libusb_error_name(rc));
-        goto out;
-	}
+void usb_transfer_done(void) {
+    sem_post(&ring_sem);
+}
 
-    LOGD("Opened USB device %04x:%04x IFACE %d.\n", VID, PID, IFACE_NUM);
-    is_setup = true;
+int usb_use_simulator(const char *path, float rate, float loss,
+        float jitter_ms) {
+    int rc = usb_sim_configure(path, rate, loss, jitter_ms);
+    if (rc < 0)
+        return rc;
+    transport = &usb_sim_transport;
     return 0;
-
-out:
-    if (devh)
-        libusb_close(devh);
-    libusb_exit(NULL);
-    return rc;
 }
 
+/* Setup is done once, after permission has been obtained. */
+int usb_setup(void) {
+    int rc = transport->setup();
+    if (rc < 0)
+        return rc;
+    is_setup = true;
+    return 0;
+}
 
 /* Once setup has succeded, this is called once to start transfers. */
-int usb_start_transfers(int fd) {
+int usb_start_transfers(int num_transfers, int num_packets) {
     if (!is_setup) {
         LOGD("Must call setup before starting.\n");
         return -1;
     }
-	static uint8_t buf[PACKET_SIZE * NUM_PACKETS];
-	static struct libusb_transfer *xfr[NUM_TRANSFERS];
-	int num_iso_pack = NUM_PACKETS;
-    int i;
-
-    outfd = fd;
-    if (outfd < 3) {
-        LOGD("Set outfd to %d. Are you sure?\n", outfd);
-    }
-
-    for (i=0; i<NUM_TRANSFERS; i++) {
-        xfr[i] = libusb_alloc_transfer(num_iso_pack);
-        if (!xfr[i]) {
-            LOGD("libusb_alloc_transfer failed.\n");
-            return -ENOMEM;
-        }
+    if (num_transfers <= 0)
+        num_transfers = USB_NUM_TRANSFERS;
+    if (num_packets <= 0)
+        num_packets = USB_NUM_PACKETS;
 
-        libusb_fill_iso_transfer(xfr[i], devh, EP_ISO_IN, buf,
-                sizeof(buf), num_iso_pack, transfer_cb, NULL, 1000);
-        libusb_set_iso_packet_lengths(xfr[i], sizeof(buf)/num_iso_pack);
+    return transport->start(num_transfers, num_packets);
+}
 
-        libusb_submit_transfer(xfr[i]);
+/* Blocks until captured audio is available, then copies up to len bytes
+ * of it into buf. Returns the number of bytes copied, or 0 once the
+ * source has finished and the ring is empty. */
+int usb_read(void *buf, int len) {
+    size_t n;
+
+    while ((n = ringbuf_read(&ring, buf, len)) == 0) {
+        if (__atomic_load_n(&eof, __ATOMIC_ACQUIRE) && !ringbuf_used(&ring))
+            return 0;
+        if (sem_wait(&ring_sem) < 0 && errno != EINTR)
+            return -errno;
     }
-    return 0;
+    return n;
 }
 
+void usb_get_stats(struct usb_stats *stats) {
+    stats->queued = ringbuf_used(&ring);
+    stats->overruns = __atomic_load_n(&ring.overruns, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&ring.dropped, __ATOMIC_RELAXED);
+    stats->packet_errors = __atomic_load_n(&packet_errors, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&delivered, __ATOMIC_RELAXED);
+}
 
 /* Called when USB is no longer required. */
 void usb_exit(void) {
@@ -185,18 +134,17 @@ void usb_exit(void) {
         return;
     }
     is_setup = false;
-    if (devh)
-        libusb_close(devh);
-    libusb_exit(NULL);
+    transport->exit();
+    usb_ring_free();
 }
 
-/* Call this in a loop. */
-void usb_process(void) {
-    int rc = libusb_handle_events(NULL);
-    if (rc != LIBUSB_SUCCESS) {
-        LOGD("libusb_handle_events: %s.\n", libusb_error_name(rc));
-        return;
+/* Call this in a loop. Returns < 0 once the source has stopped, after
+ * waking any reader blocked in usb_read(). */
+int usb_process(void) {
+    int rc = transport->process();
+    if (rc < 0) {
+        __atomic_store_n(&eof, true, __ATOMIC_RELEASE);
+        sem_post(&ring_sem);
     }
+    return rc;
 }
-
-
@@ -1,10 +1,51 @@
 #ifndef FREEDV_USB_H
 #define FREEDV_USB_H
 
+#include <stddef.h>
+
+struct usb_stats {
+    size_t queued;                  /* Bytes waiting in the capture ring. */
+    unsigned long overruns;         /* Packets dropped because the ring was full. */
+    unsigned long dropped;          /* Bytes lost to overruns. */
+    unsigned long packet_errors;    /* Iso packets that did not complete. */
+    unsigned long long bytes;       /* Bytes captured since transfers started. */
+};
+
+/*
+ * Replay a raw 48 kHz 16-bit stereo file through the capture path
+ * instead of opening the device. rate is a multiple of real time (0 runs
+ * as fast as the consumer allows), loss the fraction of packets reported
+ * as failed and jitter_ms the max random delay added to each transfer.
+ * Call before usb_setup().
+ */
+int usb_use_simulator(const char *path, float rate, float loss,
+        float jitter_ms);
+
 /* Setup is done once, after permission has been obtained. */
 int usb_setup(void);
 
-/* Once setup has succeded, this is called once to start transfers. */
-int usb_start_transfers(int fd);
+/* Default transfer queue: 10 transfers of 10 packets (1 ms each). */
+#define USB_NUM_TRANSFERS 10
+#define USB_NUM_PACKETS 10
+
+/*
+ * Once setup has succeded, this is called once to start transfers.
+ * Fewer packets per transfer lowers latency; more transfers in flight
+ * makes drops less likely when the event thread is held up. Pass 0 for
+ * either to use the default. Packet size comes from the endpoint.
+ */
+int usb_start_transfers(int num_transfers, int num_packets);
+
+/* Call this in a loop from the USB thread until it returns < 0. */
+int usb_process(void);
+
+/* Blocking read of captured audio, called from the decode thread.
+ * Returns 0 once the source has stopped and everything has been read. */
+int usb_read(void *buf, int len);
+
+void usb_get_stats(struct usb_stats *stats);
+
+/* Called when USB is no longer required. */
+void usb_exit(void);
 
 #endif
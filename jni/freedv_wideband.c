@@ -0,0 +1,198 @@
+/*
+ *
+ * Wideband receiver demodulating every FreeDV signal in a capture
+ * Copyright 2012 Joel Stanley <joel@jms.id.au>
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freedv_wideband.h"
+
+/* 8 kHz samples per sub-band channelized per pass. A sub-band's demod
+ * input holds a pass on top of what is left from the last frame. */
+#define WB_BLOCK FDMDV_NOM_SAMPLES_PER_FRAME
+#define WB_FIFO (WB_BLOCK + FDMDV_MAX_SAMPLES_PER_FRAME)
+
+/* A demod is dropped after a second out of sync with no pilot, and
+ * retuned while out of sync if the pilot moves by more than this. */
+#define WB_LOST_FRAMES 50
+#define WB_RETUNE_HZ 100.0
+
+struct wb_sub {
+    struct FDMDV *fdmdv;            /* NULL while the sub-band is idle. */
+    float foff;                     /* Pilot offset from the sub-band centre tuned to. */
+    COMP rect, phase_rect;          /* Tuning oscillator. */
+    COMP fifo[WB_FIFO];
+    int nfifo;
+    int nin;
+    int lost;                       /* Frames out of sync with no pilot. */
+    struct freedv_wideband_stats stats;
+};
+
+struct freedv_wideband {
+    int flags;
+    struct FDMDV_CHANNELIZER *chan;
+    float in48k[FDMDV_OS * WB_BLOCK];
+    int n48k;
+    uint8_t partial[4];             /* Stereo sample split across calls. */
+    int npartial;
+    COMP out8k[FDMDV_NSUB][WB_BLOCK];
+    struct wb_sub sub[FDMDV_NSUB];
+    freedv_wideband_bits_fn bits_fn;
+    void *arg;
+};
+
+struct freedv_wideband *freedv_wideband_create(int flags,
+        freedv_wideband_bits_fn bits_fn, void *arg) {
+    struct freedv_wideband *wb = calloc(1, sizeof(*wb));
+
+    if (!wb)
+        return NULL;
+    wb->chan = fdmdv_channelizer_create();
+    if (!wb->chan) {
+        free(wb);
+        return NULL;
+    }
+    wb->flags = flags;
+    wb->bits_fn = bits_fn;
+    wb->arg = arg;
+    return wb;
+}
+
+static void stop_sub(struct wb_sub *sub) {
+    if (sub->fdmdv)
+        fdmdv_destroy(sub->fdmdv);
+    sub->fdmdv = NULL;
+    sub->stats.active = 0;
+}
+
+void freedv_wideband_destroy(struct freedv_wideband *wb) {
+    int k;
+
+    for (k = 0; k < FDMDV_NSUB; k++)
+        stop_sub(&wb->sub[k]);
+    fdmdv_channelizer_destroy(wb->chan);
+    free(wb);
+}
+
+/* Starts a demod on the sub-band, tuned so a pilot foff Hz from the
+ * sub-band centre lands on FDMDV_FCENTRE. */
+static int start_sub(struct wb_sub *sub, float foff, int flags) {
+    sub->fdmdv = fdmdv_create();
+    if (!sub->fdmdv)
+        return -1;
+    if ((flags & FREEDV_WB_FAST_ACQ) &&
+            fdmdv_set_fast_acquisition(sub->fdmdv, 1) < 0) {
+        stop_sub(sub);
+        return -1;
+    }
+    sub->foff = foff;
+    sub->phase_rect.real = 1.0;
+    sub->phase_rect.imag = 0.0;
+    sub->nfifo = 0;
+    sub->nin = FDMDV_NOM_SAMPLES_PER_FRAME;
+    sub->lost = 0;
+    sub->stats.active = 1;
+    return 0;
+}
+
+/* Feeds the latest n channelized samples of sub-band k to its demod,
+ * starting or stopping the demod as pilots come and go. */
+static void run_sub(struct freedv_wideband *wb, int k, int n) {
+    struct wb_sub *sub = &wb->sub[k];
+    int rx_bits[FDMDV_BITS_PER_FRAME];
+    int sync_bit, nin_prev, pilot;
+    float foff;
+
+    pilot = fdmdv_channelizer_pilot(wb->chan, k, &foff);
+    sub->stats.pilot = pilot;
+    if (pilot)
+        sub->stats.fcentre = k * FDMDV_SUB_HZ + foff;
+    if (wb->flags & FREEDV_WB_SCAN)
+        return;
+
+    if (!sub->fdmdv) {
+        if (!pilot && !(wb->flags & FREEDV_WB_ALL))
+            return;
+        if (start_sub(sub, pilot ? foff : 0.0, wb->flags) < 0)
+            return;
+    } else if (pilot && !sub->stats.demod.fest_coarse_fine &&
+            fabs(foff - sub->foff) > WB_RETUNE_HZ) {
+        sub->foff = foff;
+    }
+
+    fdmdv_freq_shift(&sub->fifo[sub->nfifo], wb->out8k[k],
+            FDMDV_FCENTRE - sub->foff, &sub->rect, &sub->phase_rect, n);
+    sub->nfifo += n;
+
+    while (sub->nfifo >= sub->nin) {
+        nin_prev = sub->nin;
+        fdmdv_demod(sub->fdmdv, rx_bits, &sync_bit, sub->fifo, &sub->nin);
+        sub->nfifo -= nin_prev;
+        memmove(sub->fifo, &sub->fifo[nin_prev], sub->nfifo * sizeof(COMP));
+
+        fdmdv_get_demod_stats(sub->fdmdv, &sub->stats.demod);
+        sub->stats.frames++;
+        if (sub->stats.demod.fest_coarse_fine) {
+            sub->stats.synced++;
+            sub->stats.fcentre = k * FDMDV_SUB_HZ + sub->foff +
+                    sub->stats.demod.foff;
+        }
+        if (wb->bits_fn)
+            wb->bits_fn(wb->arg, k, rx_bits, sync_bit);
+
+        if (pilot || sub->stats.demod.fest_coarse_fine ||
+                (wb->flags & FREEDV_WB_ALL))
+            sub->lost = 0;
+        else if (++sub->lost > WB_LOST_FRAMES) {
+            stop_sub(sub);
+            return;
+        }
+    }
+}
+
+static void run_block(struct freedv_wideband *wb) {
+    COMP *out8k[FDMDV_NSUB];
+    int k, n;
+
+    for (k = 0; k < FDMDV_NSUB; k++)
+        out8k[k] = wb->out8k[k];
+    n = fdmdv_channelize(wb->chan, out8k, wb->in48k, wb->n48k);
+    wb->n48k = 0;
+    for (k = 0; k < FDMDV_NSUB; k++)
+        run_sub(wb, k, n);
+}
+
+/* Stereo is averaged to mono, scaled as the 8 kHz demod input is. */
+void freedv_wideband_process_48k_stereo(struct freedv_wideband *wb,
+        const uint8_t *pcm, int nbytes) {
+    const uint8_t *p = pcm, *end = pcm + nbytes;
+    const uint8_t *s;
+    float scale = 0.5 / FDMDV_SCALE;
+
+    while (1) {
+        if (wb->npartial || end - p < 4) {
+            while (wb->npartial < 4 && p < end)
+                wb->partial[wb->npartial++] = *p++;
+            if (wb->npartial < 4)
+                break;
+            wb->npartial = 0;
+            s = wb->partial;
+        } else {
+            s = p;
+            p += 4;
+        }
+        wb->in48k[wb->n48k++] = scale * ((int16_t)(s[0] | (s[1] << 8)) +
+                (int16_t)(s[2] | (s[3] << 8)));
+        if (wb->n48k == FDMDV_OS * WB_BLOCK)
+            run_block(wb);
+    }
+}
+
+void freedv_wideband_get_stats(struct freedv_wideband *wb, int sub,
+        struct freedv_wideband_stats *stats) {
+    *stats = wb->sub[sub].stats;
+}
@@ -0,0 +1,49 @@
+#ifndef FREEDV_WIDEBAND_H
+#define FREEDV_WIDEBAND_H
+
+#include <stdint.h>
+
+#include "freedv/fdmdv.h"
+
+/*
+ * Monitors every FDMDV signal in a 48 kHz capture at once. The capture
+ * is split into FDMDV_NSUB overlapping 8 kHz sub-bands, FDMDV_SUB_HZ
+ * apart (see fdmdv_channelize()). Each sub-band in which a pilot is
+ * detected gets its own demod, tuned so the signal sits at
+ * FDMDV_FCENTRE. A sub-band carries at most one signal, the one whose
+ * pilot is strongest. A context must not be used from two threads at
+ * once.
+ */
+struct freedv_wideband;
+
+struct freedv_wideband_stats {
+    int pilot;                      /* The detector sees a pilot. */
+    int active;                     /* A demod is running on the sub-band. */
+    float fcentre;                  /* Signal centre in the capture, Hz. */
+    unsigned long frames;           /* Demod frames. */
+    unsigned long synced;           /* Demod frames in fine sync. */
+    struct FDMDV_STATS demod;       /* As of the last frame. */
+};
+
+/* Called with each frame of demod bits from sub-band sub. */
+typedef void (*freedv_wideband_bits_fn)(void *arg, int sub,
+        const int *rx_bits, int sync_bit);
+
+/* Flags */
+#define FREEDV_WB_ALL   1           /* Demodulate every sub-band, pilot or not. */
+#define FREEDV_WB_SCAN  2           /* Detect pilots only, no demods. */
+#define FREEDV_WB_FAST_ACQ 4        /* Demods use fast acquisition. */
+
+/* bits_fn may be NULL. */
+struct freedv_wideband *freedv_wideband_create(int flags,
+        freedv_wideband_bits_fn bits_fn, void *arg);
+void freedv_wideband_destroy(struct freedv_wideband *wb);
+
+/* Pass in raw 48 kHz 16-bit stereo capture, any number of bytes. */
+void freedv_wideband_process_48k_stereo(struct freedv_wideband *wb,
+        const uint8_t *pcm, int nbytes);
+
+void freedv_wideband_get_stats(struct freedv_wideband *wb, int sub,
+        struct freedv_wideband_stats *stats);
+
+#endif
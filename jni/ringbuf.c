@@ -0,0 +1,87 @@
+/*
+ *
+ * Lock-free SPSC ring buffer for the USB capture path
+ * Copyright 2012 Joel Stanley <joel@jms.id.au>
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ringbuf.h"
+
+int ringbuf_init(struct ringbuf *rb, size_t size) {
+    size_t n = 1;
+
+    while (n < size)
+        n <<= 1;
+
+    rb->buf = malloc(n);
+    if (!rb->buf)
+        return -ENOMEM;
+    rb->size = n;
+    rb->head = 0;
+    rb->tail = 0;
+    rb->overruns = 0;
+    rb->dropped = 0;
+    return 0;
+}
+
+void ringbuf_free(struct ringbuf *rb) {
+    free(rb->buf);
+    rb->buf = NULL;
+    rb->size = 0;
+}
+
+size_t ringbuf_write(struct ringbuf *rb, const void *data, size_t len) {
+    size_t head = rb->head;
+    size_t tail = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+    size_t off = head & (rb->size - 1);
+    size_t first;
+
+    if (len > rb->size - (head - tail)) {
+        /* Only the producer writes the counters; readers may see them
+         * slightly stale, which is fine for statistics. */
+        __atomic_store_n(&rb->overruns, rb->overruns + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&rb->dropped, rb->dropped + len, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    first = rb->size - off;
+    if (first > len)
+        first = len;
+    memcpy(rb->buf + off, data, first);
+    memcpy(rb->buf, (const uint8_t *)data + first, len - first);
+
+    __atomic_store_n(&rb->head, head + len, __ATOMIC_RELEASE);
+    return len;
+}
+
+size_t ringbuf_read(struct ringbuf *rb, void *data, size_t len) {
+    size_t tail = rb->tail;
+    size_t head = __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE);
+    size_t off = tail & (rb->size - 1);
+    size_t first;
+
+    if (len > head - tail)
+        len = head - tail;
+    if (len == 0)
+        return 0;
+
+    first = rb->size - off;
+    if (first > len)
+        first = len;
+    memcpy(data, rb->buf + off, first);
+    memcpy((uint8_t *)data + first, rb->buf, len - first);
+
+    __atomic_store_n(&rb->tail, tail + len, __ATOMIC_RELEASE);
+    return len;
+}
+
+size_t ringbuf_used(const struct ringbuf *rb) {
+    size_t head = __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE);
+    size_t tail = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+
+    return head - tail;
+}
@@ -0,0 +1,36 @@
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Single producer, single consumer lock-free byte ring.
+ *
+ * The producer (the libusb completion callback) only ever moves head and
+ * the consumer (the decode thread) only ever moves tail, so neither side
+ * takes a lock or allocates once the ring has been initialised.
+ */
+struct ringbuf {
+    uint8_t *buf;
+    size_t size;                /* Power of two. */
+    size_t head;                /* Total bytes written, producer owned. */
+    size_t tail;                /* Total bytes read, consumer owned. */
+    unsigned long overruns;     /* Writes dropped because the ring was full. */
+    unsigned long dropped;      /* Bytes lost to those overruns. */
+};
+
+/* Allocate storage for at least size bytes. Returns 0 or -errno. */
+int ringbuf_init(struct ringbuf *rb, size_t size);
+void ringbuf_free(struct ringbuf *rb);
+
+/* Producer side. Writes all of len or nothing, counting an overrun. */
+size_t ringbuf_write(struct ringbuf *rb, const void *data, size_t len);
+
+/* Consumer side. Reads up to len bytes, returns the number read. */
+size_t ringbuf_read(struct ringbuf *rb, void *data, size_t len);
+
+/* Bytes currently queued. Safe to call from either side. */
+size_t ringbuf_used(const struct ringbuf *rb);
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ *
+ * libusb transport for the USB Audio receiver
+ * Copyright 2012 Joel Stanley <joel@jms.id.au>
+ *
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <libusb-1.0/libusb.h>
+
+#include "usb_transport.h"
+
+/* TI PCM2900C Audio CODEC default VID/PID. */
+#define VID 0x08bb
+#define PID 0x29c0
+
+/* PCM stereo AudioStreaming endpoint. */
+#define EP_ISO_IN	0x84
+#define IFACE_NUM   2
+
+/* Used if the endpoint descriptor can't be read. */
+#define PACKET_SIZE 192
+
+static struct libusb_device_handle *devh = NULL;
+
+/* Transfers set up by start(), owned here until exit(). in_flight counts
+ * those submitted whose callback has not yet seen them retire. Only
+ * touched on the USB thread, or once it has stopped. */
+static struct libusb_transfer **xfrs;
+static int num_xfrs;
+static int in_flight;
+static bool stopping;
+
+/* Runs on the libusb event thread. No allocation, locking or syscalls
+ * other than the semaphore post; the decode thread drains the ring. */
+static void transfer_cb(struct libusb_transfer *xfr) {
+    int rc = 0;
+    int i;
+
+    if (stopping || xfr->status == LIBUSB_TRANSFER_CANCELLED) {
+        in_flight--;
+        return;
+    }
+
+    for (i = 0; i < xfr->num_iso_packets; i++) {
+        struct libusb_iso_packet_descriptor *pack = &xfr->iso_packet_desc[i];
+        if (pack->status != LIBUSB_TRANSFER_COMPLETED) {
+            usb_packet_error();
+            continue;
+        }
+        usb_deliver_packet(libusb_get_iso_packet_buffer_simple(xfr, i),
+                pack->actual_length);
+    }
+    usb_transfer_done();
+
+	if ((rc = libusb_submit_transfer(xfr)) < 0) {
+		LOGE("libusb_submit_transfer: %s.\n", libusb_error_name(rc));
+		in_flight--;
+	}
+}
+
+/* Cancels whatever is still queued, waits for the callbacks to retire
+ * it and frees every transfer along with its buffer. */
+static void free_transfers(void) {
+    int i;
+
+    stopping = true;
+    for (i = 0; i < num_xfrs; i++)
+        libusb_cancel_transfer(xfrs[i]);
+    while (in_flight > 0) {
+        int rc = libusb_handle_events(NULL);
+        if (rc != LIBUSB_SUCCESS) {
+            /* Freeing a transfer libusb still holds is worse than
+             * leaking it. */
+            LOGE("libusb_handle_events: %s, leaking %d transfers.\n",
+                    libusb_error_name(rc), in_flight);
+            return;
+        }
+    }
+
+    for (i = 0; i < num_xfrs; i++)
+        libusb_free_transfer(xfrs[i]);
+    free(xfrs);
+    xfrs = NULL;
+    num_xfrs = 0;
+}
+
+static int libusb_transport_setup(void) {
+	int rc = -1;
+
+	rc = libusb_init(NULL);
+	if (rc < 0) {
+		LOGD("libusb_init: %s\n", libusb_error_name(rc));
+        return rc;
+	}
+
+	devh = libusb_open_device_with_vid_pid(NULL, VID, PID);
+	if (!devh) {
+		LOGD("libusb_open_device_with_vid_pid failed.\n");
+        rc = -1;
+        goto out;
+	}
+
+    rc = libusb_kernel_driver_active(devh, IFACE_NUM);
+    if (rc == 1) {
+        rc = libusb_detach_kernel_driver(devh, IFACE_NUM);
+        if (rc < 0) {
+            LOGD("libusb_detach_kernel_driver: %s.\n", libusb_error_name(rc));
+            goto out;
+        }
+    }
+
+	rc = libusb_claim_interface(devh, IFACE_NUM);
+	if (rc < 0) {
+		LOGD("libusb_claim_interface: %s.\n", libusb_error_name(rc));
+        goto out;
+    }
+
+	rc = libusb_set_interface_alt_setting(devh, IFACE_NUM, 1);
+	if (rc < 0) {
+		LOGD("libusb_set_interface_alt_setting: %s.\n", libusb_error_name(rc));
+        goto out;
+	}
+
+    LOGD("Opened USB device %04x:%04x IFACE %d.\n", VID, PID, IFACE_NUM);
+    return 0;
+
+out:
+    if (devh)
+        libusb_close(devh);
+    devh = NULL;
+    libusb_exit(NULL);
+    return rc;
+}
+
+static int libusb_transport_start(int num_transfers, int num_packets) {
+    int packet_size;
+    int i, rc;
+
+    packet_size = libusb_get_max_iso_packet_size(libusb_get_device(devh),
+            EP_ISO_IN);
+    if (packet_size <= 0) {
+        LOGD("libusb_get_max_iso_packet_size: %s, assuming %d.\n",
+                libusb_error_name(packet_size), PACKET_SIZE);
+        packet_size = PACKET_SIZE;
+    }
+
+    /* Transfers from an earlier start write into the ring until they
+     * retire, so they go before it is replaced. */
+    if (xfrs)
+        free_transfers();
+    rc = usb_ring_init((size_t)num_transfers * num_packets * packet_size);
+    if (rc < 0)
+        return rc;
+
+    xfrs = calloc(num_transfers, sizeof(*xfrs));
+    if (!xfrs) {
+        usb_ring_free();
+        return -ENOMEM;
+    }
+    stopping = false;
+
+    /* Every transfer gets its own buffer; sharing one would let
+     * transfers that are in flight together overwrite each other. */
+    for (i=0; i<num_transfers; i++) {
+        struct libusb_transfer *xfr;
+        uint8_t *buf;
+
+        xfr = libusb_alloc_transfer(num_packets);
+        buf = malloc(num_packets * packet_size);
+        if (!xfr || !buf) {
+            LOGD("libusb_alloc_transfer failed.\n");
+            if (xfr)
+                libusb_free_transfer(xfr);
+            free(buf);
+            rc = -ENOMEM;
+            goto err;
+        }
+
+        libusb_fill_iso_transfer(xfr, devh, EP_ISO_IN, buf,
+                num_packets * packet_size, num_packets, transfer_cb, NULL, 1000);
+        libusb_set_iso_packet_lengths(xfr, packet_size);
+        xfr->flags |= LIBUSB_TRANSFER_FREE_BUFFER;
+        xfrs[num_xfrs++] = xfr;
+
+        rc = libusb_submit_transfer(xfr);
+        if (rc < 0) {
+            LOGD("libusb_submit_transfer: %s.\n", libusb_error_name(rc));
+            goto err;
+        }
+        in_flight++;
+    }
+
+    /* Packets arrive once per 1 ms frame, so a transfer completes every
+     * num_packets ms and the queue covers num_transfers of those. */
+    LOGD("Queued %d transfers of %d x %d byte packets: %d ms latency, "
+            "%d ms queued.\n", num_transfers, num_packets, packet_size,
+            num_packets, num_transfers * num_packets);
+    return 0;
+
+err:
+    free_transfers();
+    usb_ring_free();
+    return rc;
+}
+
+static int libusb_transport_process(void) {
+    int rc = libusb_handle_events(NULL);
+    if (rc != LIBUSB_SUCCESS) {
+        LOGD("libusb_handle_events: %s.\n", libusb_error_name(rc));
+        return rc;
+    }
+    return 0;
+}
+
+static void libusb_transport_exit(void) {
+    if (xfrs)
+        free_transfers();
+    if (devh)
+        libusb_close(devh);
+    devh = NULL;
+    libusb_exit(NULL);
+}
+
+const struct usb_transport usb_libusb_transport = {
+    .name = "libusb",
+    .setup = libusb_transport_setup,
+    .start = libusb_transport_start,
+    .process = libusb_transport_process,
+    .exit = libusb_transport_exit,
+};
@@ -0,0 +1,138 @@
+/*
+ *
+ * Simulated isochronous transport for the USB Audio receiver
+ * Copyright 2012 Joel Stanley <joel@jms.id.au>
+ *
+ * Replays a raw capture (48 kHz 16-bit stereo, as written by freedv_cli)
+ * through the same packet path as the device, so the capture and decode
+ * pipeline can be exercised and timed without the hardware.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "usb_transport.h"
+
+/* One 1 ms frame of 48 kHz 16-bit stereo, as the PCM2900C sends. */
+#define SIM_PACKET_SIZE 192
+
+static int fd = -1;
+static float rate;          /* Multiple of real time, 0 for flat out. */
+static float loss;          /* Fraction of packets reported as failed. */
+static float jitter_ms;     /* Max random lateness of each transfer. */
+static unsigned int seed = 1;
+
+static int num_packets;
+static uint8_t *buf;
+static struct timespec due;
+
+int usb_sim_configure(const char *path, float r, float l, float j) {
+    if (r < 0 || l < 0 || l > 1 || j < 0)
+        return -EINVAL;
+    if (fd >= 0)
+        close(fd);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOGD("usb_sim: unable to open %s.\n", path);
+        return -errno;
+    }
+    rate = r;
+    loss = l;
+    jitter_ms = j;
+    return 0;
+}
+
+static void timespec_add_ns(struct timespec *ts, long ns) {
+    ts->tv_nsec += ns;
+    while (ts->tv_nsec >= 1000000000) {
+        ts->tv_nsec -= 1000000000;
+        ts->tv_sec++;
+    }
+}
+
+static int sim_setup(void) {
+    if (fd < 0) {
+        LOGD("usb_sim: no file configured.\n");
+        return -EINVAL;
+    }
+    LOGD("Simulated USB device: %.1fx real time, %.1f%% loss, %.1f ms jitter.\n",
+            rate, loss * 100, jitter_ms);
+    return 0;
+}
+
+static int sim_start(int num_transfers, int n) {
+    int rc;
+
+    num_packets = n;
+    rc = usb_ring_init((size_t)num_transfers * num_packets * SIM_PACKET_SIZE);
+    if (rc < 0)
+        return rc;
+    free(buf);
+    buf = malloc(num_packets * SIM_PACKET_SIZE);
+    if (!buf) {
+        usb_ring_free();
+        return -ENOMEM;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &due);
+    return 0;
+}
+
+/* Plays the part of one transfer completing: waits until it is due,
+ * plus any jitter, then hands its packets to the ring. */
+static int sim_process(void) {
+    struct timespec wake;
+    ssize_t len;
+    int i;
+
+    if (rate == 0) {
+        /* Flat out, but never faster than the reader drains the ring. */
+        while (usb_ring_space() < (size_t)num_packets * SIM_PACKET_SIZE)
+            usleep(100);
+    } else {
+        timespec_add_ns(&due, (long)(num_packets * 1000000L / rate));
+        wake = due;
+        if (jitter_ms > 0)
+            timespec_add_ns(&wake,
+                    (long)(jitter_ms * 1000000L * (rand_r(&seed) / (RAND_MAX + 1.0))));
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL)
+                == EINTR)
+            ;
+    }
+
+    len = read(fd, buf, num_packets * SIM_PACKET_SIZE);
+    if (len <= 0)
+        return -1;
+
+    for (i = 0; i * SIM_PACKET_SIZE < len; i++) {
+        int n = len - i * SIM_PACKET_SIZE;
+        if (n > SIM_PACKET_SIZE)
+            n = SIM_PACKET_SIZE;
+        if (loss > 0 && rand_r(&seed) < loss * ((float)RAND_MAX + 1)) {
+            usb_packet_error();
+            continue;
+        }
+        usb_deliver_packet(buf + i * SIM_PACKET_SIZE, n);
+    }
+    usb_transfer_done();
+    return 0;
+}
+
+static void sim_exit(void) {
+    free(buf);
+    buf = NULL;
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+}
+
+const struct usb_transport usb_sim_transport = {
+    .name = "sim",
+    .setup = sim_setup,
+    .start = sim_start,
+    .process = sim_process,
+    .exit = sim_exit,
+};
@@ -0,0 +1,58 @@
+#ifndef USB_TRANSPORT_H
+#define USB_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef ANDROID
+#include <android/log.h>
+#define LOGD(...) \
+    __android_log_print(ANDROID_LOG_DEBUG, "FreedvUsbNative", __VA_ARGS__)
+#define LOGE(...) \
+    __android_log_print(ANDROID_LOG_ERROR, "FreedvUsbNative", __VA_ARGS__)
+#else
+#define LOGD(...) fprintf(stderr, __VA_ARGS__)
+#define LOGE(...) fprintf(stderr, __VA_ARGS__)
+#endif
+
+/*
+ * A source of isochronous audio packets sitting under usb_setup(),
+ * usb_start_transfers(), usb_process() and usb_exit().
+ *
+ * process() runs on the USB thread and hands completed packets to the
+ * capture ring with usb_deliver_packet(), then calls usb_transfer_done()
+ * once per completed transfer. It returns a negative value once the
+ * source has failed or run out of data.
+ */
+struct usb_transport {
+    const char *name;
+    int (*setup)(void);
+    int (*start)(int num_transfers, int num_packets);
+    int (*process)(void);
+    void (*exit)(void);
+};
+
+/* The PCM2900C via libusb. */
+extern const struct usb_transport usb_libusb_transport;
+
+/* Replays a raw capture file, see usb_use_simulator(). */
+extern const struct usb_transport usb_sim_transport;
+int usb_sim_configure(const char *path, float rate, float loss,
+        float jitter_ms);
+
+/* Called by a transport's start() once it knows how many bytes it can
+ * have in flight, to size the capture ring. Nothing may be writing to
+ * the ring from an earlier start(), it is freed and a new one made. */
+int usb_ring_init(size_t in_flight);
+
+/* Frees the capture ring, for a start() that fails after making it. */
+void usb_ring_free(void);
+
+/* Called from process() on the USB thread. */
+size_t usb_ring_space(void);
+void usb_deliver_packet(const uint8_t *data, int len);
+void usb_packet_error(void);
+void usb_transfer_done(void);
+
+#endif
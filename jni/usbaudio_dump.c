@@ -56,20 +56,31 @@
 static int do_exit = 1;
 static struct libusb_device_handle *devh = NULL;
 
-static unsigned long num_bytes = 0, num_xfer = 0;
-static struct timeval tv_start;
+static unsigned long num_bytes = 0, num_xfer = 0, num_drops = 0;
+static struct timeval tv_start, tv_last;
+static unsigned int max_gap_usec = 0;
 
 static JavaVM* java_vm = NULL;
 
 static jclass au_id_jms_usbaudio_AudioPlayback = NULL;
 static jmethodID au_id_jms_usbaudio_AudioPlayback_write;
 
+/* Transfers set up by benchmark_in(), freed by close(). in_flight counts
+ * those submitted that cb_xfr() has not yet seen retire. */
+static struct libusb_transfer **xfrs;
+static int num_xfrs = 0, in_flight = 0;
+
 static void cb_xfr(struct libusb_transfer *xfr)
 {
 	unsigned int i;
 
     int len = 0;
 
+    if (do_exit || xfr->status == LIBUSB_TRANSFER_CANCELLED) {
+        in_flight--;
+        return;
+    }
+
     // Get an env handle
     JNIEnv * env;
     void * void_env;
@@ -83,24 +94,31 @@ static void cb_xfr(struct libusb_transfer *xfr)
         env = void_env;
     }
 
-    // Create a jbyteArray.
-    int start = 0;
-    jbyteArray audioByteArray = (*env)->NewByteArray(env, 192 * xfr->num_iso_packets);
-
+    // Size a jbyteArray for the packets that arrived, so dropped or
+    // short packets don't hand Java a tail of zeros.
     for (i = 0; i < xfr->num_iso_packets; i++) {
         struct libusb_iso_packet_descriptor *pack = &xfr->iso_packet_desc[i];
 
         if (pack->status != LIBUSB_TRANSFER_COMPLETED) {
-            LOGD("Error (status %d: %s) :", pack->status,
-                    libusb_error_name(pack->status));
-            /* This doesn't happen, so bail out if it does. */
-            exit(EXIT_FAILURE);
+            num_drops++;
+            continue;
         }
+        len += pack->actual_length;
+    }
+    jbyteArray audioByteArray = (*env)->NewByteArray(env, len);
+
+    len = 0;
+    for (i = 0; i < xfr->num_iso_packets; i++) {
+        struct libusb_iso_packet_descriptor *pack = &xfr->iso_packet_desc[i];
+
+        if (pack->status != LIBUSB_TRANSFER_COMPLETED)
+            continue;
 
         const uint8_t *data = libusb_get_iso_packet_buffer_simple(xfr, i);
-        (*env)->SetByteArrayRegion(env, audioByteArray, len, pack->length, data);
+        (*env)->SetByteArrayRegion(env, audioByteArray, len,
+                pack->actual_length, data);
 
-        len += pack->length;
+        len += pack->actual_length;
     }
 
     // Call write()
@@ -109,12 +127,23 @@ static void cb_xfr(struct libusb_transfer *xfr)
     (*env)->DeleteLocalRef(env, audioByteArray);
     if ((*env)->ExceptionCheck(env)) {
         LOGD("Exception while trying to pass sound data to java");
+        in_flight--;
         return;
     }
 
 	num_bytes += len;
 	num_xfer++;
 
+    /* Longest wait between completions, i.e. worst case latency seen. */
+    struct timeval tv_now;
+    unsigned int gap;
+    gettimeofday(&tv_now, NULL);
+    gap = (tv_now.tv_sec - tv_last.tv_sec)*1000000 +
+        (tv_now.tv_usec - tv_last.tv_usec);
+    if (gap > max_gap_usec)
+        max_gap_usec = gap;
+    tv_last = tv_now;
+
     if (had_to_attach) {
         (*java_vm)->DetachCurrentThread(java_vm);
     }
@@ -126,16 +155,54 @@ static void cb_xfr(struct libusb_transfer *xfr)
 	}
 }
 
+/* Cancels what is still queued, lets cb_xfr() retire it and frees the
+ * transfers and their buffers. The event loop must have stopped. */
+static void free_transfers(void)
+{
+    int i;
+
+    do_exit = 1;
+    for (i = 0; i < num_xfrs; i++)
+        libusb_cancel_transfer(xfrs[i]);
+    while (in_flight > 0) {
+        if (libusb_handle_events(NULL) != LIBUSB_SUCCESS) {
+            LOGD("Could not retire transfers, leaking %d", in_flight);
+            return;
+        }
+    }
+
+    for (i = 0; i < num_xfrs; i++)
+        libusb_free_transfer(xfrs[i]);
+    free(xfrs);
+    xfrs = NULL;
+    num_xfrs = 0;
+}
+
+/* Default queue depth, overridden by setTransferConfig(). */
 #define NUM_TRANSFERS 10
 #define PACKET_SIZE 192
 #define NUM_PACKETS 10
 
+static int num_transfers = NUM_TRANSFERS;
+static int num_packets = NUM_PACKETS;
+static int packet_size = PACKET_SIZE;
+
 static int benchmark_in(uint8_t ep)
 {
-	static uint8_t buf[PACKET_SIZE * NUM_PACKETS];
-	static struct libusb_transfer *xfr[NUM_TRANSFERS];
-	int num_iso_pack = NUM_PACKETS;
-    int i;
+    int i, rc;
+
+    packet_size = libusb_get_max_iso_packet_size(libusb_get_device(devh), ep);
+    if (packet_size <= 0) {
+        LOGD("Could not read max packet size, assuming %d", PACKET_SIZE);
+        packet_size = PACKET_SIZE;
+    }
+
+    if (xfrs)
+        free_transfers();
+    xfrs = calloc(num_transfers, sizeof(*xfrs));
+    if (!xfrs)
+        return -ENOMEM;
+    do_exit = 0;
 
 	/* NOTE: To reach maximum possible performance the program must
 	 * submit *multiple* transfers here, not just one.
@@ -149,24 +216,49 @@ static int benchmark_in(uint8_t ep)
 	 * that the host controller is always kept busy, and will schedule
 	 * more transfers on the bus while the callback is running for
 	 * transfers which have completed on the bus.
+	 *
+	 * Each transfer owns its buffer, as transfers in flight at the same
+	 * time would otherwise overwrite each other's data.
 	 */
-    for (i=0; i<NUM_TRANSFERS; i++) {
-        xfr[i] = libusb_alloc_transfer(num_iso_pack);
-        if (!xfr[i]) {
+    for (i=0; i<num_transfers; i++) {
+        struct libusb_transfer *t;
+        uint8_t *buf;
+
+        t = libusb_alloc_transfer(num_packets);
+        buf = malloc(num_packets * packet_size);
+        if (!t || !buf) {
             LOGD("Could not allocate transfer");
-            return -ENOMEM;
+            if (t)
+                libusb_free_transfer(t);
+            free(buf);
+            rc = -ENOMEM;
+            goto err;
         }
 
-        libusb_fill_iso_transfer(xfr[i], devh, ep, buf,
-                sizeof(buf), num_iso_pack, cb_xfr, NULL, 1000);
-        libusb_set_iso_packet_lengths(xfr[i], sizeof(buf)/num_iso_pack);
+        libusb_fill_iso_transfer(t, devh, ep, buf,
+                num_packets * packet_size, num_packets, cb_xfr, NULL, 1000);
+        libusb_set_iso_packet_lengths(t, packet_size);
+        t->flags |= LIBUSB_TRANSFER_FREE_BUFFER;
+        xfrs[num_xfrs++] = t;
 
-        libusb_submit_transfer(xfr[i]);
+        rc = libusb_submit_transfer(t);
+        if (rc < 0) {
+            LOGD("Could not submit transfer: %s", libusb_error_name(rc));
+            goto err;
+        }
+        in_flight++;
     }
 
 	gettimeofday(&tv_start, NULL);
+    tv_last = tv_start;
+    num_bytes = num_xfer = num_drops = 0;
+    max_gap_usec = 0;
 
     return 1;
+
+err:
+    free_transfers();
+    return rc;
 }
 
 unsigned int measure(void)
@@ -181,6 +273,11 @@ unsigned int measure(void)
 
 	printf("%lu transfers (total %lu bytes) in %u miliseconds => %lu bytes/sec\n",
 		num_xfer, num_bytes, diff_msec, (num_bytes*1000)/diff_msec);
+	/* Packets are 1 ms apart, so nominal latency is one transfer. */
+	printf("%d transfers x %d packets x %d bytes: %d ms latency (worst %u ms), "
+		"%d ms queued, %lu packets dropped\n",
+		num_transfers, num_packets, packet_size, num_packets,
+		max_gap_usec/1000, num_transfers * num_packets, num_drops);
 
     return num_bytes;
 }
@@ -190,6 +287,15 @@ Java_au_id_jms_usbaudio_UsbAudio_measure(JNIEnv* env UNUSED, jobject foo UNUSED)
     return measure();
 }
 
+JNIEXPORT void JNICALL
+Java_au_id_jms_usbaudio_UsbAudio_setTransferConfig(JNIEnv* env UNUSED,
+        jobject foo UNUSED, jint transfers, jint packets) {
+    if (transfers > 0)
+        num_transfers = transfers;
+    if (packets > 0)
+        num_packets = packets;
+}
+
 JNIEXPORT jint JNICALL
 JNI_OnLoad(JavaVM* vm, void* reserved UNUSED)
 {
@@ -302,6 +408,8 @@ Java_au_id_jms_usbaudio_UsbAudio_close(JNIEnv* env UNUSED, jobject foo UNUSED) {
     if (do_exit == 0) {
         return false;
     }
+	if (xfrs)
+		free_transfers();
 	libusb_release_interface(devh, IFACE_NUM);
 	if (devh)
 		libusb_close(devh);
@@ -10,5 +10,7 @@ public class UsbAudio {
     public native void loop();
     public native boolean stop();
     public native int measure();
+    /* Must be called before setup(); 0 keeps the default. */
+    public native void setTransferConfig(int transfers, int packets);
 
 }
\ No newline at end of file